@@ -13,15 +13,49 @@ adc_init (void)
 	ADCSRA |= _BV (ADEN) | _BV (ADPS2) | _BV (ADPS1) | _BV (ADPS0);
 }
 
+//
+//	Run one conversion on the channel `mux' and return the result register.
+//
+
+static uint16_t
+adc_convert (uint8_t mux)
+{
+	ADMUX = mux;
+	ADCSRA |= _BV (ADSC);
+	loop_until_bit_is_set (ADCSRA, ADIF);
+
+	return ADC;
+}
+
 uint16_t
 adc_get_sample (uint8_t channel)
 {
 	uint16_t sample = 0;
 
-	ADMUX = channel;
-	ADCSRA |= _BV (ADSC);
-	loop_until_bit_is_set (ADCSRA, ADIF);
-
-	sample = ADC;
+	sample = adc_convert (channel);
 	return sample;
 }
+
+int16_t
+adc_get_differential_sample (uint8_t mux)
+{
+	uint16_t sample;
+
+	if ((ADMUX & 0x1F) != mux)		/* 1 */
+		adc_convert (mux);
+
+	sample = adc_convert (mux);
+
+	if (sample & 0x0200)			/* 2 */
+		sample |= 0xFC00;
+
+	return (int16_t)sample;
+}
+
+//
+//	1.	The gain stage's offset cancellation needs a conversion's time to
+//		settle after a channel change, and the first result is not to be
+//		trusted.
+//
+//	2.	Differential results are in two's complement, 10 bits wide.
+//
@@ -9,10 +9,65 @@
 
 #include <inttypes.h>
 
+//
+//	Low pressure range. Single-ended, one ADC code is about 1.5 psi. At low
+//	pressure a sensor can be read instead as the difference between it and
+//	a fixed reference voltage, through the ADC's gain stage. That gives
+//	`ADC_LOW_GAIN' / 2 times the resolution over a band of 1024 codes /
+//	`ADC_LOW_GAIN' either side of the reference, about 150 psi at 10x.
+//
+//	The gain stage only takes ADC1 against ADC0 and ADC3 against ADC2, so
+//	the low range needs the board revision with the front sensor on ADC1
+//	and the rear on ADC3, and a divider holding ADC0 and ADC2 at the
+//	reference. Build with `ADC_LOW_RANGE' set to 1 for it. On the original
+//	board the sensors are on ADC0 and ADC1, and are only read single-ended.
+//
+
+#ifndef ADC_LOW_RANGE
+#define	ADC_LOW_RANGE				0
+#endif
+
+#define	ADC_LOW_GAIN				10			/* 10 or 200 */
+
+#define	ADC_LOW_RANGE_ENTER			384			/* differential codes from the reference */
+#define	ADC_LOW_RANGE_EXIT			480
+
+#define	ADC_RANGE_CALIBRATION_SAMPLES	8
+
+//
+//	Fine samples are in 1/64ths of a single-ended code, so both ranges
+//	carry through the conversion to psi on the one scale.
+//
+
+#define	ADC_FINE_SHIFT				6
+#define	ADC_FINE_MAX				(1023U << ADC_FINE_SHIFT)
+
+//
+//	The gain channel that reads `positive' against `negative', or
+//	`negative' against itself for the gain stage's offset.
+//
+
+#define	ADC_MUX_DIFFERENTIAL(positive, negative)							\
+	(0x08 | (((negative) >> 1) << 2) | ((ADC_LOW_GAIN == 200) ? 0x02 : 0x00) |	\
+	((positive) & 0x01))
+
 //
 //	Analogue-to-Digital Channel Allocations
 //
 
+#if ADC_LOW_RANGE
+
+typedef enum adc_chan_t
+{
+	adc_chan_front_reference	= 0,
+	adc_chan_front_pressure		= 1,
+	adc_chan_rear_reference		= 2,
+	adc_chan_rear_pressure		= 3
+}
+adc_chan_t;
+
+#else
+
 typedef enum adc_chan_t
 {
 	adc_chan_front_pressure	= 0,
@@ -20,6 +75,15 @@ typedef enum adc_chan_t
 }
 adc_chan_t;
 
+#endif
+
+typedef enum adc_range_t
+{
+	adc_range_normal	= 0,
+	adc_range_low		= 1
+}
+adc_range_t;
+
 //
 //	Initialize the ADC subsystem.
 //
@@ -40,4 +104,39 @@ adc_get_sample
 	uint8_t channel
 );
 
+//
+//	Return a signed 10-bit sample from the gain channel `mux', see
+//	`ADC_MUX_DIFFERENTIAL'. If the last conversion was on another channel,
+//	a first conversion is made and thrown away while the gain stage
+//	settles, so this takes twice as long.
+//
+
+int16_t
+adc_get_differential_sample
+(
+	uint8_t mux
+);
+
+//
+//	Measure the low range references and the gain stage offsets. Until
+//	this has run, every channel is read single-ended. Takes about 4 ms;
+//	interrupts are only held off for one conversion at a time.
+//
+
+void
+adc_range_calibrate (void);
+
+//
+//	Return a fine sample from the ADC channel `channel'. A channel with a
+//	low range moves into it when a single-ended sample is well inside the
+//	band, and back out as soon as a differential sample nears the edge of
+//	it, so the caller never sees which range a sample came from.
+//
+
+uint16_t
+adc_range_get_sample
+(
+	uint8_t channel
+);
+
 #endif
@@ -0,0 +1,138 @@
+//
+//	adc_range.c
+//	Low pressure range switching. Kept apart from `adc.c' so the simulator
+//	can build it over its own conversions.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#include <util/atomic.h>
+
+#include "adc.h"
+
+typedef struct adc_range_state_t
+{
+	uint8_t		range;			/* `adc_range_t' */
+	uint8_t		calibrated;
+	uint16_t	reference;		/* fine sample */
+	int16_t		zero;			/* gain stage offset, differential codes, Q3 */
+}
+adc_range_state_t;
+
+static adc_range_state_t ranges[2];
+
+//
+//	Return the range state of `channel', or 0 if it has no low range. The
+//	gain stage only takes odd channels against the even one below (1).
+//
+
+static adc_range_state_t *
+adc_range_lookup (uint8_t channel)
+{
+	if (!ADC_LOW_RANGE || !(channel & 0x01) || channel > 3)
+		return 0;
+
+	return &ranges[channel >> 1];
+}
+
+//
+//	1.	ADC1 against ADC0, and ADC3 against ADC2, both at 10x or 200x.
+//
+
+void
+adc_range_calibrate (void)
+{
+	adc_range_state_t	*state;
+	uint16_t			reference;
+	int16_t				zero;
+	uint8_t				channel, i;
+
+	for (channel = 1; channel <= 3; channel += 2)
+	{
+		state = adc_range_lookup (channel);
+
+		if (!state)
+			continue;
+
+		reference = 0;
+		zero = 0;
+
+		for (i = 0; i < ADC_RANGE_CALIBRATION_SAMPLES; i++)
+			ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+			{
+				reference += adc_get_sample (channel - 1);
+			}
+
+		for (i = 0; i < ADC_RANGE_CALIBRATION_SAMPLES; i++)
+			ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+			{
+				zero += adc_get_differential_sample (ADC_MUX_DIFFERENTIAL (channel - 1, channel - 1));
+			}
+
+		ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+		{
+			state->reference = reference << (ADC_FINE_SHIFT - 3);	/* 1 */
+			state->zero = zero;
+			state->range = adc_range_normal;
+			state->calibrated = 1;
+		}
+	}
+}
+
+//
+//	1.	Eight samples are summed, so the sums are already in Q3.
+//
+
+uint16_t
+adc_range_get_sample (uint8_t channel)
+{
+	adc_range_state_t	*state = adc_range_lookup (channel);
+	uint16_t			sample;
+	int32_t				offset;
+
+	if (state && state->range == adc_range_low)
+	{
+		offset = ((int32_t)adc_get_differential_sample (ADC_MUX_DIFFERENTIAL (channel, channel - 1)) << 3) -
+			state->zero;
+
+		if (offset > -((int32_t)ADC_LOW_RANGE_EXIT << 3) && offset < ((int32_t)ADC_LOW_RANGE_EXIT << 3))
+		{
+			offset = (offset << (ADC_FINE_SHIFT - 2)) + ((offset < 0) ? -ADC_LOW_GAIN / 2 : ADC_LOW_GAIN / 2);
+			offset = (int32_t)state->reference + offset / ADC_LOW_GAIN;		/* 1 */
+
+			return (offset < 0) ? 0 : (offset > (int32_t)ADC_FINE_MAX) ? ADC_FINE_MAX : (uint16_t)offset;
+		}
+
+		state->range = adc_range_normal;		/* 2 */
+	}
+
+	sample = adc_get_sample (channel) << ADC_FINE_SHIFT;
+
+	if (state && state->calibrated)				/* 3 */
+	{
+		offset = (int32_t)sample - state->reference;
+
+		if (offset < 0)
+			offset = -offset;
+
+		if (offset <= ((int32_t)ADC_LOW_RANGE_ENTER << (ADC_FINE_SHIFT + 1)) / ADC_LOW_GAIN)
+			state->range = adc_range_low;
+	}
+
+	return sample;
+}
+
+//
+//	1.	Differential samples span +/-512 codes over +/-VREF / gain, so one
+//		differential code is 2 / gain single-ended codes. The offset is in
+//		Q3, which leaves a shift of `ADC_FINE_SHIFT' + 1 - 3.
+//
+//	2.	Near the edge of the band the gain stage is close to clipping, so
+//		the sample is taken again single-ended straight away. A clipped
+//		sample is never returned; leaving the range costs one conversion.
+//
+//	3.	The range is entered for the next sample. Entering well inside the
+//		band and leaving only near its edge is 96 differential codes of
+//		hysteresis, about 19 single-ended codes at 10x, so noise can't make
+//		the range chatter.
+//
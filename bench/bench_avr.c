@@ -0,0 +1,136 @@
+//
+//	bench_avr.c
+//	Cycle counts for the conversion variants in `kernels.c', on the AVR
+//	under simavr.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+//	From the top of the tree, with libcan's headers (for `pressure.h') and
+//	simavr's `avr_mcu_section.h' on the include path:
+//
+//		avr-gcc -mmcu=atmega128 -DF_CPU=16000000UL -Os -std=gnu99 -I. -Ibench
+//			-I<libcan> -I<simavr>/simavr/sim/avr -o bench_avr.elf
+//			bench/bench_avr.c bench/kernels.c pressure_convert.c
+//		simavr bench_avr.elf
+//
+//	simavr has no AT90CAN128 core, so this runs on the ATmega128, which
+//	has the same CPU, the same 128 KB of flash and the same instruction
+//	timings. Build with the firmware's own optimization level, or the counts
+//	won't mean much.
+//
+//	Timer 1 runs at the CPU clock, and is read either side of each
+//	conversion. The count for an empty call is taken off, so what is left is
+//	the cycles inside the variant.
+//
+
+#include <stdio.h>
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/sleep.h>
+
+#include "avr_mcu_section.h"
+
+#include "pressure.h"
+
+#include "kernels.h"
+
+AVR_MCU (F_CPU, "atmega128");
+AVR_MCU_SIMAVR_CONSOLE (&OCR2);		/* 1 */
+
+//
+//	1.	Any register the benchmark doesn't otherwise use; simavr prints
+//		whatever is written to it.
+//
+
+typedef struct bench_cycles_t
+{
+	uint16_t	min, max;
+	uint32_t	total;
+}
+bench_cycles_t;
+
+static int
+console_putchar (char c, FILE *stream)
+{
+	OCR2 = c;
+	return 0;
+}
+
+static FILE console = FDEV_SETUP_STREAM (console_putchar, NULL, _FDEV_SETUP_WRITE);
+
+static volatile uint16_t sink;
+
+static void
+bench_time (uint16_t (*convert)(uint16_t sample), bench_cycles_t *cycles)
+{
+	uint16_t sample, start, elapsed;
+
+	cycles->min = UINT16_MAX;
+	cycles->max = 0;
+	cycles->total = 0;
+
+	for (sample = 0; sample < BENCH_CODES; sample++)
+	{
+		start = TCNT1;
+		sink = convert (sample);
+		elapsed = TCNT1 - start;
+
+		if (elapsed < cycles->min)
+			cycles->min = elapsed;
+
+		if (elapsed > cycles->max)
+			cycles->max = elapsed;
+
+		cycles->total += elapsed;
+	}
+}
+
+int
+main (void)
+{
+	bench_cycles_t	empty, cycles;
+	uint16_t		sample, psi, reference;
+	uint8_t			i, bad;
+
+	stdout = &console;
+
+	TCCR1A = 0;
+	TCCR1B = _BV (CS10);
+
+	bench_kernels_init ();
+	bench_time (bench_convert_none, &empty);
+
+	printf ("%-28s %6s %6s %6s\n", "variant", "min", "mean", "max");
+
+	for (i = 0; i < bench_kernel_count; i++)
+	{
+		const bench_kernel_t *kernel = &bench_kernels[i];
+
+		for (sample = 0, bad = 0; sample < BENCH_CODES && !bad; sample++)
+		{
+			psi = kernel->convert (sample);
+			reference = pressure_convert_sample_to_psi (sample);
+
+			bad = (psi > reference ? psi - reference : reference - psi) >
+				(kernel->exact ? 0 : BENCH_TOLERANCE);
+		}
+
+		bench_time (kernel->convert, &cycles);
+
+		printf ("%-28s %6u %6lu %6u%s\n", kernel->name,
+			cycles.min - empty.min, (cycles.total - empty.total) / BENCH_CODES,
+			cycles.max - empty.min, bad ? "  MISMATCH" : "");
+	}
+
+	printf ("\ncycles at %lu MHz, less %u for the call\n", F_CPU / 1000000, empty.min);
+
+	cli ();
+	sleep_mode ();		/* 2 */
+
+	return 0;
+}
+
+//
+//	2.	simavr stops when the CPU sleeps with interrupts off.
+//
@@ -0,0 +1,119 @@
+//
+//	bench_host.c
+//	Host benchmark of the conversion variants in `kernels.c', with a check
+//	of every variant against the firmware's conversion over all 1024 codes.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+//	Usage: bench_host [passes]
+//
+//	From the top of the tree, against the simulator's stand-in headers:
+//
+//		cc -std=gnu99 -O2 -Wall -Isim -I. -Ibench -o bench_host
+//			bench/bench_host.c bench/kernels.c pressure_convert.c
+//
+//	Host timings only rank the variants roughly, since the host has a
+//	hardware divider and a cache; `bench_avr.c' counts the cycles on the
+//	AVR itself.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "pressure.h"
+
+#include "kernels.h"
+
+static volatile uint16_t sink;
+
+static uint64_t
+host_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//
+//	Return the largest difference from the firmware's conversion, or -1 if
+//	the variant is out by more than it is allowed to be.
+//
+
+static int
+bench_check (const bench_kernel_t *kernel)
+{
+	uint16_t	sample;
+	int			diff, worst = 0;
+
+	for (sample = 0; sample < BENCH_CODES; sample++)
+	{
+		diff = abs ((int)kernel->convert (sample) - (int)pressure_convert_sample_to_psi (sample));
+
+		if (diff > worst)
+			worst = diff;
+	}
+
+	if (worst > (kernel->exact ? 0 : BENCH_TOLERANCE))
+		return -1;
+
+	return worst;
+}
+
+static double
+bench_time (uint16_t (*convert)(uint16_t sample), uint32_t passes)
+{
+	uint64_t	start;
+	uint32_t	pass;
+	uint16_t	sample;
+
+	start = host_ns ();
+
+	for (pass = 0; pass < passes; pass++)
+	{
+		for (sample = 0; sample < BENCH_CODES; sample++)
+			sink = convert (sample);
+	}
+
+	return (double)(host_ns () - start) / ((double)passes * BENCH_CODES);
+}
+
+int
+main (int argc, char **argv)
+{
+	uint32_t	passes = (argc > 1) ? strtoul (argv[1], 0, 0) : 20000;
+	double		overhead, ns, reference = 0.0;
+	int			worst, failures = 0;
+	uint8_t		i;
+
+	bench_kernels_init ();
+
+	overhead = bench_time (bench_convert_none, passes);
+
+	printf ("%-28s %8s %10s %10s\n", "variant", "max err", "ns each", "relative");
+	printf ("%-28s %8s %10.2f\n", "(empty call)", "", overhead);
+
+	for (i = 0; i < bench_kernel_count; i++)
+	{
+		const bench_kernel_t *kernel = &bench_kernels[i];
+
+		worst = bench_check (kernel);
+		ns = bench_time (kernel->convert, passes);
+
+		if (i == 0)
+			reference = ns;
+
+		if (worst < 0)
+		{
+			printf ("%-28s %8s\n", kernel->name, "FAILED");
+			failures++;
+
+			continue;
+		}
+
+		printf ("%-28s %8d %10.2f %9.2fx\n", kernel->name, worst, ns, ns / reference);
+	}
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,88 @@
+//
+//	kernels.c
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#include <avr/pgmspace.h>
+
+#include "pressure.h"
+
+#include "kernels.h"
+
+#define	PSI_PER_CODE_Q8		((uint32_t)PSI_PER_VOLT * 5 * 256 / 1024)	/* 1 */
+
+//
+//	1.	1500 / 1024 = 375 / 256 exactly, so the Q8 reciprocal loses
+//		nothing against the divide.
+//
+
+//
+//	The table is filled in by the preprocessor, 1024 entries of two bytes
+//	each, in flash.
+//
+
+#define	E(s)		(uint16_t)((uint32_t)(s) * PSI_PER_VOLT * 5 / 1024)
+#define	E4(s)		E (s), E ((s) + 1), E ((s) + 2), E ((s) + 3)
+#define	E16(s)		E4 (s), E4 ((s) + 4), E4 ((s) + 8), E4 ((s) + 12)
+#define	E64(s)		E16 (s), E16 ((s) + 16), E16 ((s) + 32), E16 ((s) + 48)
+#define	E256(s)		E64 (s), E64 ((s) + 64), E64 ((s) + 128), E64 ((s) + 192)
+
+static const uint16_t psi_table[BENCH_CODES] PROGMEM =
+{
+	E256 (0), E256 (256), E256 (512), E256 (768)
+};
+
+static pressure_curve_t nominal_curve;
+
+uint16_t
+bench_convert_none (uint16_t sample)
+{
+	return sample;
+}
+
+static uint16_t
+bench_convert_q8 (uint16_t sample)
+{
+	return (uint16_t)(((uint32_t)sample * PSI_PER_CODE_Q8) >> 8);
+}
+
+//
+//	1500 / 1024 = 1 + 1/2 - 9/256, so everything stays in 16 bits. Each
+//	term is rounded on its own, though, so the result can be a psi out.
+//
+
+static uint16_t
+bench_convert_shift_add (uint16_t sample)
+{
+	return sample + (sample >> 1) - ((sample * 9) >> 8);
+}
+
+static uint16_t
+bench_convert_table (uint16_t sample)
+{
+	return pgm_read_word (&psi_table[sample]);
+}
+
+static uint16_t
+bench_convert_nominal_curve (uint16_t sample)
+{
+	return pressure_convert_sample (&nominal_curve, sample);
+}
+
+const bench_kernel_t bench_kernels[] =
+{
+	{ "mul/div (firmware)",			pressure_convert_sample_to_psi,	1 },
+	{ "Q8 reciprocal",				bench_convert_q8,				1 },
+	{ "16-bit shift-add",			bench_convert_shift_add,		0 },
+	{ "lookup table (2 KB flash)",	bench_convert_table,			1 },
+	{ "nominal curve (firmware)",	bench_convert_nominal_curve,	0 }
+};
+
+const uint8_t bench_kernel_count = sizeof (bench_kernels) / sizeof (bench_kernels[0]);
+
+void
+bench_kernels_init (void)
+{
+	pressure_build_nominal_curve (&nominal_curve);
+}
@@ -0,0 +1,56 @@
+//
+//	kernels.h
+//	Sample to psi conversion variants, for the benchmarks.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#ifndef _BENCH_KERNELS_H
+#define _BENCH_KERNELS_H
+
+#include <inttypes.h>
+
+//
+//	Every variant converts a 10-bit ADC code to psi with the nominal sensor
+//	scaling, `PSI_PER_VOLT'. The first is the firmware's own conversion,
+//	which the rest are checked against over all 1024 codes. Exact variants
+//	have to match it everywhere; the others are allowed to be out by up to
+//	`BENCH_TOLERANCE' psi, and the largest difference is reported.
+//
+//	All of them are called through a pointer, so they are timed with the
+//	same call overhead, and the compiler can't fold them into the loop.
+//
+
+#define	BENCH_CODES			1024
+#define	BENCH_TOLERANCE		1			/* psi */
+
+typedef struct bench_kernel_t
+{
+	const char	*name;
+	uint16_t	(*convert)(uint16_t sample);
+	uint8_t		exact;
+}
+bench_kernel_t;
+
+extern const bench_kernel_t	bench_kernels[];
+extern const uint8_t		bench_kernel_count;
+
+//
+//	Build the curves the curve variants use. Call once before the
+//	benchmarks run.
+//
+
+void
+bench_kernels_init (void);
+
+//
+//	Return `sample' unchanged, for timing the call itself.
+//
+
+uint16_t
+bench_convert_none
+(
+	uint16_t sample
+);
+
+#endif
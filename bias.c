@@ -0,0 +1,543 @@
+//
+//	bias.c
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#include <util/atomic.h>
+
+#include "can.h"
+#include "can_config.h"
+#include "eeprom.h"
+
+#include "bias.h"
+#include "error.h"
+#include "flush.h"
+#include "pressure.h"
+#include "state.h"
+#include "stepper.h"
+
+static bias_curve_t		curve;
+
+static int16_t			sweep_start, sweep_end;
+static uint16_t			sweep_speed;
+
+static volatile uint8_t	sampling;
+static int32_t			slice_position[BIAS_CURVE_POINTS];		/* sums */
+static uint32_t			slice_share[BIAS_CURVE_POINTS];
+static uint16_t			slice_count[BIAS_CURVE_POINTS];
+
+static int16_t			saved_position;
+static uint8_t			position_saved;
+
+static uint8_t			curve_bytes[1 + 4 * BIAS_CURVE_POINTS];		/* waiting to be stored */
+static uint8_t			curve_pending;
+
+void
+bias_init (void)
+{
+	uint8_t	bytes[1 + 4 * BIAS_CURVE_POINTS];
+	uint8_t	i, points, rising;
+
+	eeprom_read_many (bias_curve_addr, bytes, sizeof (bytes));
+
+	points = (bytes[0] >= 2 && bytes[0] <= BIAS_CURVE_POINTS) ? bytes[0] : 0;
+	rising = ((bytes[7] << 8) | bytes[8]) > ((bytes[3] << 8) | bytes[4]);
+
+	for (i = 0; i < points; i++)
+	{
+		curve.position[i] = (int16_t)((bytes[1 + 4 * i] << 8) | bytes[2 + 4 * i]);
+		curve.share[i] = (bytes[3 + 4 * i] << 8) | bytes[4 + 4 * i];
+
+		if
+		(
+			i > 0 &&
+			(
+				curve.position[i] <= curve.position[i - 1] ||
+				curve.share[i] == curve.share[i - 1] ||
+				(curve.share[i] > curve.share[i - 1]) != rising
+			)
+		)
+		{
+			points = 0;		/* 1 */
+		}
+	}
+
+	curve.points = points;
+
+	eeprom_read_many (bias_position_addr, bytes, 3);
+
+	if (bytes[0] == BIAS_POSITION_MAGIC)
+	{
+		saved_position = (int16_t)((bytes[1] << 8) | bytes[2]);
+		position_saved = stepper_set_position (saved_position);
+
+		if (!position_saved)
+		{
+			error_set_error_code (err_bias_position_lost);
+			error_broadcast_error_code (err_sev_recoverable, err_bias_position_lost);
+		}
+	}
+}
+
+//
+//	1.	The same checks as a new curve gets in `bias_calibration_update',
+//		so that no two neighbouring points share a position or a share and
+//		`bias_share_to_position' never divides by zero.
+//
+
+void
+bias_flush (void)
+{
+	uint8_t	bytes[3];
+	int16_t	position;
+
+	if (curve_pending)
+	{
+		if (flush_bytes (bias_curve_addr, curve_bytes, sizeof (curve_bytes)))
+			return;
+
+		curve_pending = 0;
+	}
+
+	if (stepper_is_moving ())
+		return;
+
+	position = stepper_get_position ();
+
+	if (position_saved && position == saved_position)
+		return;
+
+	bytes[0] = BIAS_POSITION_MAGIC;
+	bytes[1] = (uint8_t)(position >> 8);
+	bytes[2] = (uint8_t)(position);
+
+	if (flush_bytes (bias_position_addr, bytes, 3))
+	{
+		position_saved = 0;		/* 1 */
+		return;
+	}
+
+	saved_position = position;
+	position_saved = 1;
+}
+
+//
+//	1.	The eeprom no longer holds `saved_position' once a byte of the new
+//		one is written, so the adjuster coming back to it part way through
+//		must not stop the write.
+//
+
+void
+bias_periodic_interrupt_handler (void)
+{
+	uint16_t	front, rear;
+	uint32_t	total;
+	int16_t		position;
+	int32_t		slice;
+
+	if (!sampling)
+		return;
+
+	position = stepper_get_position ();
+	front = pressure_sample_front_sensor ();		/* 1 */
+	rear = pressure_sample_rear_sensor ();
+
+	total = (uint32_t)front + rear;
+
+	if (total < BIAS_CAL_MIN_PSI)
+		return;
+
+	slice = ((int32_t)position - sweep_start) * BIAS_CURVE_POINTS / ((int32_t)sweep_end - sweep_start);
+
+	if (slice < 0)
+		slice = 0;
+	else if (slice >= BIAS_CURVE_POINTS)
+		slice = BIAS_CURVE_POINTS - 1;
+
+	if (slice_count[slice] == UINT16_MAX)
+		return;
+
+	slice_position[slice] += position;
+	slice_share[slice] += (uint32_t)front * BIAS_SHARE_SCALE / total;
+	slice_count[slice]++;
+}
+
+//
+//	1.	Both sensors are sampled every tick during the sweep, whatever the
+//		update period, on top of the regular updates. That is about 200 us
+//		of conversions per millisecond, but only while calibrating.
+//
+
+int16_t
+bias_share_to_position (const bias_curve_t *curve, uint16_t share, uint16_t *reached)
+{
+	uint8_t		last = curve->points - 1;
+	uint8_t		rising = curve->share[last] > curve->share[0];
+	uint8_t		i;
+	int32_t		position;
+
+	if (rising ? share <= curve->share[0] : share >= curve->share[0])
+	{
+		*reached = curve->share[0];
+		return curve->position[0];
+	}
+
+	if (rising ? share >= curve->share[last] : share <= curve->share[last])
+	{
+		*reached = curve->share[last];
+		return curve->position[last];
+	}
+
+	for (i = 0; i < last - 1; i++)
+	{
+		if (rising ? share <= curve->share[i + 1] : share >= curve->share[i + 1])
+			break;
+	}
+
+	position = curve->position[i] +
+		((int32_t)share - curve->share[i]) * (curve->position[i + 1] - curve->position[i]) /
+		((int32_t)curve->share[i + 1] - curve->share[i]);
+
+	*reached = curve->share[i] +
+		(position - curve->position[i]) * ((int32_t)curve->share[i + 1] - curve->share[i]) /
+		(curve->position[i + 1] - curve->position[i]);
+
+	return (int16_t)position;
+}
+
+//
+//	Send the calibration message `message', followed by `length' bytes of
+//	`data', to the driver.
+//
+
+static void
+bias_calibration_send (bcal_msg_t message, uint8_t *data, uint8_t length)
+{
+	uint8_t packet[8];
+	uint8_t i;
+
+	packet[0] = message;
+
+	for (i = 0; i < length; i++)
+		packet[i + 1] = data[i];
+
+	can_load_data (mob_out_bias_calibration, packet, length + 1);
+	can_ready_to_send (mob_out_bias_calibration);
+}
+
+//
+//	Queue a move to absolute position `position'. Returns 0 if the move
+//	queue is full.
+//
+
+static uint8_t
+bias_move_to (int16_t position, uint16_t speed)
+{
+	int32_t steps = (int32_t)position - stepper_get_target ();
+
+	if (steps > INT16_MAX)
+		steps = INT16_MAX;
+	else if (steps < INT16_MIN)
+		steps = INT16_MIN;
+
+	return stepper_queue_move ((int16_t)steps, speed, 0);
+}
+
+static void
+bias_set_share (uint16_t share)
+{
+	uint16_t	reached;
+	int16_t		position;
+	uint8_t		data[4];
+
+	if (!curve.points)
+	{
+		bias_calibration_send (bcal_msg_share_failed, 0, 0);
+		error_set_error_code (err_bcal_no_curve);
+		error_broadcast_error_code (err_sev_recoverable, err_bcal_no_curve);
+
+		return;
+	}
+
+	position = bias_share_to_position (&curve, share, &reached);
+
+	if (!bias_move_to (position, 0))
+	{
+		bias_calibration_send (bcal_msg_share_failed, 0, 0);
+		error_set_error_code (err_bias_queue_full);
+		error_broadcast_error_code (err_sev_recoverable, err_bias_queue_full);
+
+		return;
+	}
+
+	data[0] = (uint8_t)(position >> 8);
+	data[1] = (uint8_t)(position);
+	data[2] = (uint8_t)(reached >> 8);
+	data[3] = (uint8_t)(reached);
+
+	bias_calibration_send (bcal_msg_share_set, data, 4);
+}
+
+void
+bias_calibration_rx_callback (uint8_t mob_index, uint32_t id, packet_type_t type)
+{
+	uint8_t 	data[8];
+	state_t		current_state;
+
+	can_read_data (mob_index, data, 8);
+	current_state = state_get_current_state ();
+
+	switch (data[0])
+	{
+		case bcal_msg_begin_calibration:
+
+			if (current_state != state_idle)
+			{
+				error_raise_from_isr (err_cmd_unexpected);
+			}
+			else
+			{
+				sweep_start = (int16_t)((data[1] << 8) | data[2]);
+				sweep_end = (int16_t)((data[3] << 8) | data[4]);
+				sweep_speed = (data[5] << 8) | data[6];
+
+				if (!sweep_speed)
+					sweep_speed = BIAS_CAL_SWEEP_SPEED;
+
+				state_isr_transition (state_bcal_move_start);
+			}
+
+			break;
+
+		case bcal_msg_abort_calibration:
+
+			if
+			(
+				current_state != state_bcal_move_start 		&&
+				current_state != state_bcal_wait_start 		&&
+				current_state != state_bcal_wait_pressure 	&&
+				current_state != state_bcal_sweep 			&&
+				current_state != state_bcal_wait_sweep
+			)
+			{
+				error_raise_from_isr (err_cmd_unexpected);
+			}
+			else
+			{
+				state_isr_transition (state_bcal_abort);
+			}
+
+			break;
+
+		case bcal_msg_pressure_applied:
+
+			if (current_state != state_bcal_wait_pressure)
+			{
+				error_raise_from_isr (err_cmd_unexpected);
+			}
+			else
+			{
+				state_isr_transition (state_bcal_sweep);
+			}
+
+			break;
+
+		case bcal_msg_set_share:
+
+			if (current_state != state_idle)
+			{
+				error_raise_from_isr (err_cmd_unexpected);
+			}
+			else
+			{
+				bias_set_share ((data[1] << 8) | data[2]);
+			}
+
+			break;
+
+		default:
+
+			error_raise_from_isr (err_cmd_unknown);
+
+			break;
+	}
+
+	can_ready_to_receive (mob_in_bias_calibration);
+}
+
+//
+//	Fail the calibration with error code `error_code'.
+//
+
+static void
+bias_calibration_fail (err_code_t error_code)
+{
+	sampling = 0;
+
+	bias_calibration_send (bcal_msg_calibration_failed, 0, 0);
+	error_set_error_code (error_code);
+	state_transition (state_error_recoverable);
+}
+
+void
+bias_calibration_move_start (void)
+{
+	if (sweep_start == sweep_end)
+		bias_calibration_fail (err_bcal_curve_invalid);
+	else if (!bias_move_to (sweep_start, 0))
+		bias_calibration_fail (err_bias_queue_full);
+	else
+		state_transition (state_bcal_wait_start);
+}
+
+void
+bias_calibration_wait_start (void)
+{
+	if (stepper_is_moving ())
+		return;
+
+	bias_calibration_send (bcal_msg_apply_pressure, 0, 0);
+	state_transition (state_bcal_wait_pressure);
+}
+
+void
+bias_calibration_wait_pressure (void)
+{
+	/* zzz... */
+}
+
+void
+bias_calibration_sweep (void)
+{
+	uint8_t i;
+
+	for (i = 0; i < BIAS_CURVE_POINTS; i++)
+	{
+		slice_position[i] = 0;
+		slice_share[i] = 0;
+		slice_count[i] = 0;
+	}
+
+	sampling = 1;
+
+	if (!bias_move_to (sweep_end, sweep_speed))
+		bias_calibration_fail (err_bias_queue_full);
+	else
+		state_transition (state_bcal_wait_sweep);
+}
+
+void
+bias_calibration_wait_sweep (void)
+{
+	if (stepper_is_moving ())
+		return;
+
+	sampling = 0;
+	state_transition (state_bcal_update);
+}
+
+void
+bias_calibration_update (void)
+{
+	static bias_curve_t	new_curve;
+
+	uint8_t		i, slice, rising;
+	uint16_t	count;
+
+	rising = 0;
+
+	for (i = 0; i < BIAS_CURVE_POINTS; i++)
+	{
+		slice = (sweep_end > sweep_start) ? i : BIAS_CURVE_POINTS - 1 - i;		/* 1 */
+		count = slice_count[slice];
+
+		if (count < BIAS_CAL_MIN_SAMPLES)
+		{
+			bias_calibration_fail (err_bcal_curve_invalid);
+			return;
+		}
+
+		new_curve.position[i] = (int16_t)((slice_position[slice] +
+			(slice_position[slice] < 0 ? -(int32_t)count : (int32_t)count) / 2) / count);
+		new_curve.share[i] = (uint16_t)((slice_share[slice] + count / 2) / count);
+
+		if (i == 1)
+			rising = new_curve.share[1] > new_curve.share[0];
+
+		if
+		(
+			i > 0 &&
+			(
+				new_curve.position[i] <= new_curve.position[i - 1] ||
+				new_curve.share[i] == new_curve.share[i - 1] ||
+				(new_curve.share[i] > new_curve.share[i - 1]) != rising
+			)
+		)
+		{
+			bias_calibration_fail (err_bcal_curve_invalid);
+			return;
+		}
+	}
+
+	new_curve.points = BIAS_CURVE_POINTS;
+
+	curve_bytes[0] = new_curve.points;
+
+	for (i = 0; i < new_curve.points; i++)
+	{
+		curve_bytes[1 + 4 * i] = (uint8_t)(new_curve.position[i] >> 8);
+		curve_bytes[2 + 4 * i] = (uint8_t)(new_curve.position[i]);
+		curve_bytes[3 + 4 * i] = (uint8_t)(new_curve.share[i] >> 8);
+		curve_bytes[4 + 4 * i] = (uint8_t)(new_curve.share[i]);
+	}
+
+	curve_pending = 1;		/* 2 */
+
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+	{
+		curve = new_curve;
+	}
+
+	bias_calibration_send (bcal_msg_calibration_ok, &new_curve.points, 1);
+	state_transition (state_idle);
+}
+
+//
+//	1.	The curve is kept in order of increasing position, so a sweep
+//		towards lower positions fills it from the last slice back.
+//
+//	2.	33 bytes is about 110 ms of writing, so the curve is stored a byte
+//		at a time from the idle state by `bias_flush'.
+//
+
+void
+bias_calibration_abort (void)
+{
+	sampling = 0;
+
+	bias_calibration_send (bcal_msg_calibration_failed, 0, 0);
+	state_transition (state_idle);
+}
+
+void
+bias_adjust_rx_callback (uint8_t mob_index, uint32_t id, packet_type_t type)
+{
+	uint8_t		data[6];
+	int16_t		steps;
+	uint16_t	speed, accel;
+
+	can_read_data (mob_index, data, 6);
+
+	steps = (int16_t)((data[0] << 8) | data[1]);
+	speed = (data[2] << 8) | data[3];
+	accel = (data[4] << 8) | data[5];
+
+	if (!stepper_queue_move (steps, speed, accel))
+	{
+		error_set_error_code (err_bias_queue_full);
+		error_broadcast_error_code (err_sev_recoverable, err_bias_queue_full);
+	}
+
+	can_ready_to_receive (mob_in_bias_adjust);
+}
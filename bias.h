@@ -0,0 +1,235 @@
+//
+//	bias.h
+//	Brake bias adjuster, driven by the stepper motor.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#ifndef _BIAS_H
+#define _BIAS_H
+
+#include <inttypes.h>
+
+#include "can.h"
+
+//
+//	Bias adjust packets move the adjuster relative to where the moves
+//	already queued will leave it. A packet arriving while the adjuster is
+//	still moving in the same direction extends that move, so a stream of
+//	small adjustments runs as one continuous move.
+//
+//	0+1: The MSB and LSB of the signed number of steps to move
+//	2+3: The MSB and LSB of the speed, in steps/s (0 for the default)
+//	4+5: The MSB and LSB of the acceleration, in steps/s^2 (0 for the default)
+//
+//	If the move queue is full, the packet is dropped and `err_bias_queue_full'
+//	is broadcast as a recoverable error.
+//
+
+//
+//	The bias calibration sweeps the adjuster across a range of positions
+//	while the driver holds the brakes on, and measures the front share of
+//	the total pressure as it goes. The share is then known as a function of
+//	position, so a bias request can name the share it wants and be reached
+//	in one open-loop move.
+//
+//	After `begin calibration' (1) the module moves to the start of the
+//	sweep and asks for pressure. Once the driver replies that it is applied,
+//	the module sweeps to the end at a constant speed, sampling both sensors
+//	every millisecond, and replies with `calibration ok' (2) or `failed'.
+//	The driver can then let go.
+//
+//	The samples are averaged in `BIAS_CURVE_POINTS' equal slices of the
+//	sweep, and each slice's mean position and mean share becomes a point of
+//	a piecewise-linear curve. The share has to keep going the same way along
+//	the whole curve, and every slice has to have at least
+//	`BIAS_CAL_MIN_SAMPLES' samples taken with at least `BIAS_CAL_MIN_PSI' of
+//	total pressure, or the calibration fails with `err_bcal_curve_invalid'.
+//	The curve is kept in the eeprom next to the pressure calibration.
+//
+//	Positions only mean anything against the curve if they survive a reset,
+//	so the adjuster's position is written to the eeprom from the idle state
+//	whenever it comes to rest somewhere new, and restored at start-up.
+//
+
+#define	BIAS_CURVE_POINTS			8
+#define	BIAS_CAL_MIN_SAMPLES		10
+#define	BIAS_CAL_MIN_PSI			100			/* front and rear together */
+#define	BIAS_CAL_SWEEP_SPEED		100			/* steps/s, 3 */
+#define	BIAS_SHARE_SCALE			10000		/* 100.00 % */
+
+#define	BIAS_POSITION_MAGIC			0xB5
+
+//
+//	1.	Followed by the MSB and LSB of the start and then the end of the
+//		sweep, as signed positions in steps, and of the sweep speed in
+//		steps/s (0 for `BIAS_CAL_SWEEP_SPEED').
+//
+//	2.	Followed by the number of points in the curve.
+//
+//	3.	Slow enough that the hydraulics keep up; at 100 steps/s a 1000 step
+//		sweep takes 10 s and gives each slice over 1000 samples.
+//
+
+typedef enum bcal_msg_t
+{
+	bcal_msg_begin_calibration		= 0x00,		/* driver -> brake module, 1 */
+	bcal_msg_abort_calibration		= 0x01,		/* driver -> brake module */
+	bcal_msg_apply_pressure			= 0x02,		/* driver <- brake module */
+	bcal_msg_pressure_applied		= 0x03,		/* driver -> brake module */
+	bcal_msg_calibration_ok			= 0x04,		/* driver <- brake module, 2 */
+	bcal_msg_calibration_failed		= 0x05,		/* driver <- brake module */
+	bcal_msg_set_share				= 0x06,		/* driver -> brake module, 4 */
+	bcal_msg_share_set				= 0x07,		/* driver <- brake module, 5 */
+	bcal_msg_share_failed			= 0x08		/* driver <- brake module */
+}
+bcal_msg_t;
+
+//
+//	4.	Followed by the MSB and LSB of the front share wanted, in units of
+//		0.01 % of the total (`BIAS_SHARE_SCALE' is all front).
+//
+//	5.	Followed by the MSB and LSB of the position being moved to, and of
+//		the share the curve gives there. A share beyond either end of the
+//		curve is taken to the nearest end. Without a curve, the reply is
+//		`share failed' and `err_bcal_no_curve' is broadcast.
+//
+
+typedef enum bias_eeprom_addr_t
+{
+	bias_curve_addr			= 0xA0,		/* points, then position and share of each */
+	bias_position_addr		= 0xC8		/* magic, then position */
+}
+bias_eeprom_addr_t;
+
+typedef struct bias_curve_t
+{
+	uint8_t		points;
+	int16_t		position[BIAS_CURVE_POINTS];	/* steps, increasing */
+	uint16_t	share[BIAS_CURVE_POINTS];		/* `BIAS_SHARE_SCALE', strictly monotonic */
+}
+bias_curve_t;
+
+//
+//	Load the bias curve and restore the adjuster's position from the
+//	eeprom. Call after `stepper_init'. If the stepper is already running a
+//	move, the position can't be restored and `err_bias_position_lost' is
+//	raised.
+//
+
+void
+bias_init (void);
+
+//
+//	Write back at most one byte of a new bias curve, or else of the
+//	adjuster's position if it has come to rest somewhere new (see
+//	`flush.h'). Never waits. Called from the idle state.
+//
+
+void
+bias_flush (void);
+
+//
+//	Bias calibration interrupt handler. Called every millisecond from the
+//	timer interrupt; samples both sensors while a sweep is running.
+//
+
+void
+bias_periodic_interrupt_handler (void);
+
+//
+//	Bias calibration message received callback function.
+//
+
+void
+bias_calibration_rx_callback
+(
+	uint8_t 		mob_index,
+	uint32_t 		id,
+	packet_type_t 	type
+);
+
+//
+//	Return the position at which the curve `curve' gives front share
+//	`share', taking shares beyond either end to that end. Store the share
+//	the curve gives there at `reached'.
+//
+
+int16_t
+bias_share_to_position
+(
+	const bias_curve_t	*curve,
+	uint16_t			share,
+	uint16_t			*reached
+);
+
+//
+//	Queue the move to the start of the sweep. Transition into waiting for
+//	it to finish.
+//
+
+void
+bias_calibration_move_start (void);
+
+//
+//	Wait for the adjuster to reach the start of the sweep, then ask the
+//	driver to apply pressure. Transition into waiting for the pressure.
+//
+
+void
+bias_calibration_wait_start (void);
+
+//
+//	Wait for the driver to apply pressure. Just a `nop' style function like
+//	the idle state.
+//
+
+void
+bias_calibration_wait_pressure (void);
+
+//
+//	Start sampling and queue the sweep. Transition into waiting for the
+//	sweep to finish.
+//
+
+void
+bias_calibration_sweep (void);
+
+//
+//	Wait for the sweep to finish, then stop sampling. Transition into
+//	updating the curve.
+//
+
+void
+bias_calibration_wait_sweep (void);
+
+//
+//	Build the curve from the samples. If it is good, store it in the eeprom
+//	and reply `calibration ok'; otherwise reply `calibration failed' and
+//	raise `err_bcal_curve_invalid'.
+//
+
+void
+bias_calibration_update (void);
+
+//
+//	Stop sampling and reply `calibration failed'. Return to idle. The
+//	adjuster finishes whatever move it was making.
+//
+
+void
+bias_calibration_abort (void);
+
+//
+//	Bias adjust message received callback function.
+//
+
+void
+bias_adjust_rx_callback
+(
+	uint8_t 		mob_index,
+	uint32_t 		id,
+	packet_type_t 	type
+);
+
+#endif
@@ -0,0 +1,333 @@
+//
+//	boot.c
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#include <string.h>
+
+#include "boot.h"
+
+typedef enum boot_program_state_t
+{
+	program_idle,
+	program_erasing,
+	program_writing
+}
+boot_program_state_t;
+
+#define	NO_BUFFER	0xFF
+
+static uint8_t		buffers[2][BOOT_PAGE_SIZE];
+static uint8_t		buffer_busy[2];			/* holding a page not yet filled */
+
+static uint8_t		rx_buffer;				/* buffer the next page goes into */
+static uint8_t		rx_active;
+static uint8_t		rx_frames;
+static uint16_t		rx_page, rx_crc;
+static uint8_t		ack_deferred;
+
+static uint8_t		queued_buffer = NO_BUFFER;
+static uint16_t		queued_page;
+
+static uint8_t		program_state = program_idle;
+static uint8_t		program_buffer;
+static uint32_t		program_addr;
+
+static uint8_t		update_active, finish_pending, run_requested;
+static uint32_t		image_size;
+static uint16_t		image_crc, next_page;
+
+static uint8_t		timeout_armed;
+static uint16_t		start_millis;
+
+static void
+boot_reply (boot_reply_t reply, uint8_t command, uint16_t page)
+{
+	boot_frame_t frame;
+
+	frame.id = BOOT_REPLY_ID;
+	frame.length = 4;
+	frame.data[0] = reply;
+	frame.data[1] = command;
+	frame.data[2] = (uint8_t)(page >> 8);
+	frame.data[3] = (uint8_t)(page);
+
+	boot_hal_can_send (&frame);		/* 1 */
+}
+
+//
+//	1.	If the reply can't be sent, the host times out waiting for it and
+//		sends the command again, which every command is safe against (see
+//		`boot_command'). So there is nothing more to do here.
+//
+
+static uint8_t
+boot_application_valid (void)
+{
+	return boot_hal_eeprom_read (BOOT_EEPROM_VALID) == BOOT_VALID_MAGIC;
+}
+
+uint8_t
+boot_init (void)
+{
+	uint8_t requested, valid;
+
+	requested = boot_hal_eeprom_read (BOOT_EEPROM_REQUEST) == BOOT_REQUEST_MAGIC;
+	valid = boot_application_valid ();
+
+	if (requested)
+		boot_hal_eeprom_write (BOOT_EEPROM_REQUEST, 0xFF);
+
+	if (!requested && valid)
+		return 0;
+
+	timeout_armed = requested && valid;
+	start_millis = boot_hal_millis ();
+
+	boot_reply (boot_reply_ready, BOOT_VERSION, 0);
+	return 1;
+}
+
+//
+//	Move the flash programming along by at most one step. A queued page is
+//	erased, then filled into the page buffer and written. Its RAM buffer is
+//	free as soon as it has been filled, and that's when a deferred ack for
+//	the page received after it goes out.
+//
+
+static void
+boot_program_step (void)
+{
+	switch (program_state)
+	{
+		case program_idle:
+
+			if (queued_buffer == NO_BUFFER)
+				break;
+
+			program_buffer = queued_buffer;
+			program_addr = (uint32_t)queued_page * BOOT_PAGE_SIZE;
+			queued_buffer = NO_BUFFER;
+
+			boot_hal_flash_erase (program_addr);
+			program_state = program_erasing;
+
+			break;
+
+		case program_erasing:
+
+			if (boot_hal_flash_busy ())
+				break;
+
+			boot_hal_flash_fill (program_addr, buffers[program_buffer]);
+			boot_hal_flash_write (program_addr);
+
+			buffer_busy[program_buffer] = 0;
+			program_state = program_writing;
+
+			if (ack_deferred)
+			{
+				ack_deferred = 0;
+				boot_reply (boot_reply_ok, boot_cmd_page, next_page - 1);
+			}
+
+			break;
+
+		case program_writing:
+
+			if (boot_hal_flash_busy ())
+				break;
+
+			boot_hal_flash_release ();
+			program_state = program_idle;
+
+			break;
+	}
+}
+
+static void
+boot_page_received (void)
+{
+	uint16_t	crc = 0xFFFF;
+	uint16_t	i;
+
+	rx_active = 0;
+
+	for (i = 0; i < BOOT_PAGE_SIZE; i++)
+		crc = boot_crc16_update (crc, buffers[rx_buffer][i]);
+
+	if (crc != rx_crc)
+	{
+		boot_reply (boot_reply_nak, boot_cmd_page, rx_page);
+		return;
+	}
+
+	buffer_busy[rx_buffer] = 1;
+	queued_buffer = rx_buffer;
+	queued_page = rx_page;
+	next_page = rx_page + 1;
+
+	rx_buffer ^= 1;
+
+	if (buffer_busy[rx_buffer])
+		ack_deferred = 1;
+	else
+		boot_reply (boot_reply_ok, boot_cmd_page, rx_page);
+}
+
+static void
+boot_finish (void)
+{
+	uint16_t	crc = 0xFFFF;
+	uint32_t	addr;
+
+	finish_pending = 0;
+
+	for (addr = 0; addr < image_size; addr++)
+		crc = boot_crc16_update (crc, boot_hal_flash_read (addr));
+
+	if (crc != image_crc || next_page * (uint32_t)BOOT_PAGE_SIZE < image_size)
+	{
+		boot_reply (boot_reply_error, boot_cmd_finish, 0);
+		return;
+	}
+
+	boot_hal_eeprom_write (BOOT_EEPROM_SIZE, (uint8_t)(image_size >> 16));
+	boot_hal_eeprom_write (BOOT_EEPROM_SIZE + 1, (uint8_t)(image_size >> 8));
+	boot_hal_eeprom_write (BOOT_EEPROM_SIZE + 2, (uint8_t)(image_size));
+	boot_hal_eeprom_write (BOOT_EEPROM_CRC, (uint8_t)(image_crc >> 8));
+	boot_hal_eeprom_write (BOOT_EEPROM_CRC + 1, (uint8_t)(image_crc));
+	boot_hal_eeprom_write (BOOT_EEPROM_VALID, BOOT_VALID_MAGIC);
+
+	update_active = 0;
+	boot_reply (boot_reply_ok, boot_cmd_finish, 0);
+}
+
+static void
+boot_command (const boot_frame_t *frame)
+{
+	uint16_t page;
+
+	timeout_armed = 0;
+
+	switch (frame->data[0])
+	{
+		case boot_cmd_ping:
+
+			boot_reply (boot_reply_ready, BOOT_VERSION, 0);
+			break;
+
+		case boot_cmd_begin:
+
+			image_size = ((uint32_t)frame->data[1] << 16) | ((uint32_t)frame->data[2] << 8) | frame->data[3];
+			image_crc = (uint16_t)(frame->data[4] << 8) | frame->data[5];
+
+			if (image_size == 0 || image_size > BOOT_APP_MAX_SIZE || program_state != program_idle)
+			{
+				boot_reply (boot_reply_error, boot_cmd_begin, 0);
+				break;
+			}
+
+			boot_hal_eeprom_write (BOOT_EEPROM_VALID, 0xFF);
+
+			update_active = 1;
+			next_page = 0;
+			rx_active = 0;
+			ack_deferred = 0;
+
+			boot_reply (boot_reply_ok, boot_cmd_begin, 0);
+			break;
+
+		case boot_cmd_page:
+
+			page = (uint16_t)(frame->data[1] << 8) | frame->data[2];
+
+			if (update_active && page < next_page)		/* 1 */
+			{
+				if (!ack_deferred || page != next_page - 1)
+					boot_reply (boot_reply_ok, boot_cmd_page, page);
+			}
+			else if
+			(
+				!update_active || page != next_page || buffer_busy[rx_buffer] ||
+				(uint32_t)page * BOOT_PAGE_SIZE >= image_size
+			)
+			{
+				boot_reply (boot_reply_error, boot_cmd_page, page);
+			}
+			else
+			{
+				rx_page = page;
+				rx_crc = (uint16_t)(frame->data[3] << 8) | frame->data[4];
+				rx_frames = 0;
+				rx_active = 1;
+			}
+
+			break;
+
+		case boot_cmd_finish:
+
+			if (update_active)
+				finish_pending = 1;
+			else if (boot_application_valid ())		/* 2 */
+				boot_reply (boot_reply_ok, boot_cmd_finish, 0);
+			else
+				boot_reply (boot_reply_error, boot_cmd_finish, 0);
+
+			break;
+
+		case boot_cmd_run:
+
+			if (boot_application_valid ())
+			{
+				boot_reply (boot_reply_ok, boot_cmd_run, 0);
+				run_requested = 1;
+			}
+			else
+			{
+				boot_reply (boot_reply_error, boot_cmd_run, 0);
+			}
+
+			break;
+	}
+}
+
+//
+//	1.	The host only resends a page it has already had acknowledged when
+//		the ack got lost or was slow to come, so just acknowledge it again,
+//		unless the ack is still being held back for a free buffer.
+//
+//	2.	Same again for a finish whose reply got lost.
+//
+
+uint8_t
+boot_poll (void)
+{
+	boot_frame_t frame;
+
+	boot_program_step ();
+
+	if (boot_hal_can_receive (&frame))
+	{
+		if (frame.id == BOOT_COMMAND_ID)
+		{
+			boot_command (&frame);
+		}
+		else if (frame.id == BOOT_DATA_ID && rx_active && frame.length == 8)
+		{
+			memcpy (&buffers[rx_buffer][rx_frames * 8], frame.data, 8);
+
+			if (++rx_frames == BOOT_FRAMES_PER_PAGE)
+				boot_page_received ();
+		}
+	}
+
+	if (finish_pending && program_state == program_idle && queued_buffer == NO_BUFFER)
+		boot_finish ();
+
+	if (timeout_armed && (uint16_t)(boot_hal_millis () - start_millis) > BOOT_REQUEST_TIMEOUT)
+		run_requested = 1;
+
+	return run_requested && program_state == program_idle;
+}
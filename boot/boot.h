@@ -0,0 +1,171 @@
+//
+//	boot.h
+//	CAN bootloader protocol and core.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#ifndef _BOOT_H
+#define _BOOT_H
+
+#include <inttypes.h>
+
+#include "can_config.h"
+
+//
+//	The bootloader lives in the boot section and runs first after every
+//	reset. It stays in the bootloader if the application asked for an
+//	update (through the `svc_cmd_enter_bootloader' service) or if there is
+//	no verified application in flash; otherwise it runs the application
+//	straight away.
+//
+//	The image is sent one flash page at a time. Each page starts with a
+//	`boot_cmd_page' command carrying its index and CRC, followed by
+//	`BOOT_FRAMES_PER_PAGE' data packets of eight bytes. Once a page is in
+//	and its CRC checks out, it is acknowledged and programmed while the
+//	next page is being received. A page is only acknowledged once there is
+//	a buffer free for the next one, which is the flow control. A bad CRC
+//	is answered with a nak, and the host sends the page again.
+//
+
+#define	BOOT_PAGE_SIZE			256		/* SPM_PAGESIZE on the AT90CAN128 */
+#define	BOOT_FRAMES_PER_PAGE	(BOOT_PAGE_SIZE / 8)
+#define	BOOT_APP_MAX_SIZE		0x1E000	/* everything below the boot section */
+#define	BOOT_VERSION			0x01
+
+#define	BOOT_REQUEST_TIMEOUT	5000	/* ms, 1 */
+
+//
+//	1.	If the application asked for the bootloader but no update starts
+//		within this time, and the application is still valid, run it.
+//
+
+#define	BOOT_COMMAND_ID		((MODULE_ID << 8) | msg_id_boot_command)
+#define	BOOT_DATA_ID		((MODULE_ID << 8) | msg_id_boot_data)
+#define	BOOT_REPLY_ID		((MODULE_ID << 8) | msg_id_boot_reply)
+
+//
+//	Commands, host -> bootloader. The first byte is the command.
+//
+//	Ping:	 0: `boot_cmd_ping'
+//
+//	Begin:	 0: `boot_cmd_begin'
+//			 1+2+3: The image size in bytes, MSB first
+//			 4+5: The MSB and LSB of the CRC of the whole image
+//
+//	Page:	 0: `boot_cmd_page'
+//			 1+2: The MSB and LSB of the page index
+//			 3+4: The MSB and LSB of the CRC of the page
+//
+//	Finish:	 0: `boot_cmd_finish'
+//
+//	Run:	 0: `boot_cmd_run'
+//
+
+typedef enum boot_cmd_t
+{
+	boot_cmd_ping			= 0x00,
+	boot_cmd_begin			= 0x01,
+	boot_cmd_page			= 0x02,
+	boot_cmd_finish			= 0x03,
+	boot_cmd_run			= 0x04
+}
+boot_cmd_t;
+
+//
+//	Replies, bootloader -> host.
+//
+//	0: The `boot_reply_t'
+//	1: The command being answered (or the version, for `ready')
+//	2+3: The MSB and LSB of the page index, for page replies
+//
+
+typedef enum boot_reply_t
+{
+	boot_reply_ready		= 0x00,		/* bootloader started */
+	boot_reply_ok			= 0x01,
+	boot_reply_nak			= 0x02,		/* page CRC mismatch, resend */
+	boot_reply_error		= 0x03		/* out of sequence or bad image */
+}
+boot_reply_t;
+
+//
+//	The application record and the update request are kept at the top of
+//	the eeprom, out of the way of the application's own data.
+//
+
+#define	BOOT_EEPROM_REQUEST		0xFF0	/* `BOOT_REQUEST_MAGIC' to stay */
+#define	BOOT_EEPROM_VALID		0xFF1	/* `BOOT_VALID_MAGIC' once verified */
+#define	BOOT_EEPROM_SIZE		0xFF2	/* three bytes, MSB first */
+#define	BOOT_EEPROM_CRC			0xFF5	/* two bytes, MSB first */
+
+#define	BOOT_REQUEST_MAGIC		0xB0
+#define	BOOT_VALID_MAGIC		0xA5
+
+typedef struct boot_frame_t
+{
+	uint16_t	id;
+	uint8_t		length;
+	uint8_t		data[8];
+}
+boot_frame_t;
+
+//
+//	CRC-16/CCITT (polynomial 0x1021, MSB first, starting from 0xFFFF), as
+//	used for pages and images. This is the byte-at-a-time form of the usual
+//	bitwise loop; the whole image is checked before it is marked valid, so
+//	it's worth about a quarter of a second at 16 MHz. Shared with the host
+//	side.
+//
+
+static inline uint16_t
+boot_crc16_update (uint16_t crc, uint8_t data)
+{
+	crc = (uint16_t)(crc >> 8) | (uint16_t)(crc << 8);
+	crc ^= data;
+	crc ^= (uint8_t)(crc & 0xFF) >> 4;
+	crc ^= (uint16_t)(crc << 12);
+	crc ^= (uint16_t)((crc & 0xFF) << 5);
+
+	return crc;
+}
+
+//
+//	Start the bootloader core. Return 1 if it should stay in the bootloader,
+//	or 0 to run the application.
+//
+
+uint8_t
+boot_init (void);
+
+//
+//	Run one pass of the bootloader: handle any received packet and move
+//	the flash programming along. Return 1 once the application should be
+//	started.
+//
+
+uint8_t
+boot_poll (void);
+
+//
+//	Hardware layer, provided by `boot_avr.c' on the target and by the
+//	simulator on the host. Flash programming is split so the core can keep
+//	receiving while the hardware is busy.
+//
+
+uint8_t		boot_hal_can_receive (boot_frame_t *frame);		/* 1 if a frame was read */
+uint8_t		boot_hal_can_send (const boot_frame_t *frame);	/* 0 if it couldn't be sent */
+
+void		boot_hal_flash_erase (uint32_t addr);
+void		boot_hal_flash_fill (uint32_t addr, const uint8_t *data);
+void		boot_hal_flash_write (uint32_t addr);
+uint8_t		boot_hal_flash_busy (void);
+void		boot_hal_flash_release (void);						/* re-enable reads */
+uint8_t		boot_hal_flash_read (uint32_t addr);
+
+uint8_t		boot_hal_eeprom_read (uint16_t addr);
+void		boot_hal_eeprom_write (uint16_t addr, uint8_t data);
+
+uint16_t	boot_hal_millis (void);
+
+#endif
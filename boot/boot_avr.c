@@ -0,0 +1,321 @@
+//
+//	boot_avr.c
+//	Bootloader entry point and hardware layer for the AT90CAN128.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+//
+//	The bootloader is built on its own, with `boot.c' and this file, and
+//	linked into the boot section:
+//
+//		-mmcu=at90can128 -Os -Wl,--section-start=.text=0x1E000
+//
+//	The fuses must select a 4K word boot section (BOOTSZ = 00) and the boot
+//	reset vector (BOOTRST programmed). Nothing here uses interrupts, and
+//	the CAN controller is driven directly rather than through libcan, so
+//	the bootloader stays well inside the 8K boot section.
+//
+
+#include <avr/boot.h>
+#include <avr/eeprom.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <avr/wdt.h>
+
+#include "boot.h"
+
+#define	BOOT_RX_MOB		0		/* and the one after, 1 */
+#define	BOOT_TX_MOB		14
+
+#define	BOOT_TX_TIMEOUT	20		/* ms */
+
+#define	BOOT_TIMER_TICKS_PER_MS		250		/* 16 MHz / 64 */
+
+//
+//	1.	Two receive message objects take frames in turn, so one can arrive
+//		while the last is still waiting to be read. Frames go to the lowest
+//		free one, so they are read back in the order of their timestamps.
+//
+
+static uint16_t	millis, timer_last, timer_ticks;
+
+//
+//	Runs before `main'. The application's start-up code reads the reset
+//	flags out of GPIOR0, since they have to be cleared here to turn off the
+//	watchdog.
+//
+
+void
+boot_early_init (void)
+__attribute__ ((naked, used, section (".init3")));
+
+void
+boot_early_init (void)
+{
+	GPIOR0 = MCUSR;
+	MCUSR = 0;
+	wdt_disable ();
+}
+
+static void
+boot_can_init (void)
+{
+	uint8_t mob;
+
+	CANGCON = _BV (SWRES);
+
+	CANBT1 = 0x02;		/* 500 kbit/s at 16 MHz, 1 */
+	CANBT2 = 0x0C;
+	CANBT3 = 0x37;
+
+	for (mob = 0; mob < 15; mob++)
+	{
+		CANPAGE = mob << 4;
+		CANSTMOB = 0;
+		CANCDMOB = 0;
+	}
+
+	//
+	//	Accept both the command and data IDs, which only differ in the
+	//	lowest bit.
+	//
+
+	for (mob = BOOT_RX_MOB; mob <= BOOT_RX_MOB + 1; mob++)
+	{
+		CANPAGE = mob << 4;
+		CANIDT1 = (uint8_t)(BOOT_COMMAND_ID >> 3);
+		CANIDT2 = (uint8_t)(BOOT_COMMAND_ID << 5);
+		CANIDT4 = 0;
+		CANIDM1 = (uint8_t)(0x7FE >> 3);
+		CANIDM2 = (uint8_t)(0x7FE << 5);
+		CANIDM4 = _BV (RTRMSK) | _BV (IDEMSK);
+		CANCDMOB = _BV (CONMOB1) | 8;
+	}
+
+	CANTCON = 0xFF;		/* 2 */
+
+	CANGCON = _BV (ENASTB);
+	loop_until_bit_is_set (CANGSTA, ENFG);
+}
+
+//
+//	1.	The same bit timing as libcan uses in the application, so the
+//		bootloader sits on the same bus without any configuration.
+//
+//	2.	The timestamp counter ticks every 2048 clocks, 128 us, so it takes
+//		over 8 s to wrap.
+//
+
+//
+//	Return 1 and the timestamp in `stamp' if the receive message object
+//	`mob' is holding a frame.
+//
+
+static uint8_t
+boot_can_rx_full (uint8_t mob, uint16_t *stamp)
+{
+	CANPAGE = mob << 4;
+
+	if (bit_is_clear (CANSTMOB, RXOK))
+		return 0;
+
+	*stamp = CANSTM;
+
+	return 1;
+}
+
+//
+//	Wait up to `BOOT_TX_TIMEOUT' for the transmit message object to be
+//	free. If it isn't by then, the frame on it is aborted and 0 returned.
+//
+
+static uint8_t
+boot_can_wait_tx (void)
+{
+	uint16_t start = boot_hal_millis ();
+
+	while (CANEN1 & _BV (BOOT_TX_MOB - 8))
+	{
+		if ((uint16_t)(boot_hal_millis () - start) > BOOT_TX_TIMEOUT)
+		{
+			CANPAGE = BOOT_TX_MOB << 4;
+			CANCDMOB = 0;		/* 1 */
+
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+//
+//	1.	Nothing acknowledged the frame, or it never won the bus. Disabling
+//		the message object aborts it, once any attempt on the bus right
+//		now has finished.
+//
+
+uint8_t
+boot_hal_can_receive (boot_frame_t *frame)
+{
+	uint16_t	first, second;
+	uint8_t		mob, i;
+
+	if (boot_can_rx_full (BOOT_RX_MOB, &first))
+	{
+		mob = BOOT_RX_MOB;
+
+		if (boot_can_rx_full (BOOT_RX_MOB + 1, &second) && (int16_t)(second - first) < 0)
+			mob = BOOT_RX_MOB + 1;
+	}
+	else if (boot_can_rx_full (BOOT_RX_MOB + 1, &second))
+	{
+		mob = BOOT_RX_MOB + 1;
+	}
+	else
+	{
+		return 0;
+	}
+
+	CANPAGE = mob << 4;
+
+	frame->id = ((uint16_t)CANIDT1 << 3) | (CANIDT2 >> 5);
+	frame->length = CANCDMOB & 0x0F;
+
+	if (frame->length > 8)
+		frame->length = 8;
+
+	for (i = 0; i < frame->length; i++)
+		frame->data[i] = CANMSG;
+
+	CANSTMOB = 0;
+	CANCDMOB = _BV (CONMOB1) | 8;
+
+	return 1;
+}
+
+uint8_t
+boot_hal_can_send (const boot_frame_t *frame)
+{
+	uint8_t i;
+
+	if (!boot_can_wait_tx ())
+		return 0;
+
+	CANPAGE = BOOT_TX_MOB << 4;
+	CANSTMOB = 0;
+	CANIDT1 = (uint8_t)(frame->id >> 3);
+	CANIDT2 = (uint8_t)(frame->id << 5);
+	CANIDT4 = 0;
+
+	for (i = 0; i < frame->length; i++)
+		CANMSG = frame->data[i];
+
+	CANCDMOB = _BV (CONMOB0) | frame->length;
+
+	return 1;
+}
+
+void
+boot_hal_flash_erase (uint32_t addr)
+{
+	boot_page_erase (addr);
+}
+
+void
+boot_hal_flash_fill (uint32_t addr, const uint8_t *data)
+{
+	uint16_t i;
+
+	for (i = 0; i < BOOT_PAGE_SIZE; i += 2)
+		boot_page_fill (addr + i, data[i] | (data[i + 1] << 8));
+}
+
+void
+boot_hal_flash_write (uint32_t addr)
+{
+	boot_page_write (addr);
+}
+
+uint8_t
+boot_hal_flash_busy (void)
+{
+	return boot_spm_busy ();
+}
+
+void
+boot_hal_flash_release (void)
+{
+	boot_rww_enable ();
+}
+
+uint8_t
+boot_hal_flash_read (uint32_t addr)
+{
+	return pgm_read_byte_far (addr);
+}
+
+uint8_t
+boot_hal_eeprom_read (uint16_t addr)
+{
+	return eeprom_read_byte ((uint8_t *)addr);
+}
+
+void
+boot_hal_eeprom_write (uint16_t addr, uint8_t data)
+{
+	eeprom_write_byte ((uint8_t *)addr, data);
+}
+
+//
+//	Timer 1 free-runs at 250 kHz and is folded into milliseconds whenever
+//	this is called, which the main loop does far more often than the 262 ms
+//	it takes to wrap.
+//
+
+uint16_t
+boot_hal_millis (void)
+{
+	uint16_t now = TCNT1;
+
+	timer_ticks += now - timer_last;
+	timer_last = now;
+
+	while (timer_ticks >= BOOT_TIMER_TICKS_PER_MS)
+	{
+		timer_ticks -= BOOT_TIMER_TICKS_PER_MS;
+		millis++;
+	}
+
+	return millis;
+}
+
+int
+main (void)
+{
+	TCCR1A = 0;
+	TCCR1B = _BV (CS11) | _BV (CS10);
+
+	boot_can_init ();
+
+	if (boot_init ())
+	{
+		while (!boot_poll ())
+			boot_hal_millis ();
+
+		boot_can_wait_tx ();		/* 1 */
+	}
+
+	TCCR1B = 0;
+	CANGCON = _BV (SWRES);
+
+	((void (*)(void))0)();
+
+	for (;;)
+		;
+}
+
+//
+//	1.	Let the last reply get out before the CAN controller is reset for
+//		the application.
+//
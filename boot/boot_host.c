@@ -0,0 +1,194 @@
+//
+//	boot_host.c
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#include <string.h>
+
+#include "boot_host.h"
+
+#define	STALE_REPLIES	4		/* 1 */
+
+//
+//	Wait for the reply to command `command' (and page `page', for page
+//	commands). Returns the `boot_reply_t', or -1 on a timeout.
+//
+
+static int
+boot_host_wait_reply (const boot_host_link_t *link, uint8_t command, uint16_t page, uint32_t timeout)
+{
+	boot_frame_t	frame;
+	uint8_t			i;
+
+	for (i = 0; i <= STALE_REPLIES; i++)
+	{
+		if (!link->receive (link->context, &frame, timeout))
+			return -1;
+
+		if (frame.id != BOOT_REPLY_ID || frame.length < 4)
+			continue;
+
+		if (frame.data[0] == boot_reply_ready)		/* 2 */
+		{
+			if (command == boot_cmd_ping)
+				return boot_reply_ready;
+
+			continue;
+		}
+
+		if (frame.data[1] != command)
+			continue;
+
+		if (command == boot_cmd_page && ((frame.data[2] << 8) | frame.data[3]) != page)
+			continue;
+
+		return frame.data[0];
+	}
+
+	return -1;
+}
+
+//
+//	1.	Replies to earlier attempts (a page ack that was only late, not
+//		lost) are skipped, but only so many of them.
+//
+//	2.	`ready' carries the version where other replies carry the command,
+//		and is also sent unprompted when the bootloader starts.
+//
+
+static int
+boot_host_command (const boot_host_link_t *link, uint8_t *data, uint8_t length,
+	uint32_t timeout, boot_host_stats_t *stats)
+{
+	boot_frame_t	frame;
+	uint8_t			attempt;
+	int				reply;
+
+	frame.id = BOOT_COMMAND_ID;
+	frame.length = length;
+	memcpy (frame.data, data, length);
+
+	for (attempt = 0; attempt < BOOT_HOST_RETRIES; attempt++)
+	{
+		link->send (link->context, &frame);
+		reply = boot_host_wait_reply (link, data[0], 0, timeout);
+
+		if (reply >= 0)
+			return reply;
+
+		stats->timeouts++;
+	}
+
+	return -1;
+}
+
+static int
+boot_host_send_page (const boot_host_link_t *link, const uint8_t *page_data, uint16_t page,
+	boot_host_stats_t *stats)
+{
+	boot_frame_t	frame;
+	uint16_t		crc = 0xFFFF;
+	uint16_t		i;
+	uint8_t			attempt;
+	int				reply;
+
+	for (i = 0; i < BOOT_PAGE_SIZE; i++)
+		crc = boot_crc16_update (crc, page_data[i]);
+
+	for (attempt = 0; attempt < BOOT_HOST_RETRIES; attempt++)
+	{
+		frame.id = BOOT_COMMAND_ID;
+		frame.length = 5;
+		frame.data[0] = boot_cmd_page;
+		frame.data[1] = (uint8_t)(page >> 8);
+		frame.data[2] = (uint8_t)(page);
+		frame.data[3] = (uint8_t)(crc >> 8);
+		frame.data[4] = (uint8_t)(crc);
+
+		link->send (link->context, &frame);
+
+		frame.id = BOOT_DATA_ID;
+		frame.length = 8;
+
+		for (i = 0; i < BOOT_FRAMES_PER_PAGE; i++)
+		{
+			memcpy (frame.data, &page_data[i * 8], 8);
+			link->send (link->context, &frame);
+		}
+
+		reply = boot_host_wait_reply (link, boot_cmd_page, page, BOOT_HOST_REPLY_TIMEOUT);
+
+		if (reply == boot_reply_ok)
+			return 0;
+		else if (reply == boot_reply_nak)
+			stats->naks++;
+		else if (reply < 0)
+			stats->timeouts++;
+		else
+			return -1;
+	}
+
+	return -1;
+}
+
+int
+boot_host_upload (const boot_host_link_t *link, const uint8_t *image, uint32_t size,
+	boot_host_stats_t *stats)
+{
+	uint8_t		page_data[BOOT_PAGE_SIZE];
+	uint8_t		data[6];
+	uint16_t	crc = 0xFFFF;
+	uint16_t	page, pages;
+	uint32_t	i, offset;
+
+	memset (stats, 0, sizeof (*stats));
+
+	if (size == 0 || size > BOOT_APP_MAX_SIZE)
+		return -1;
+
+	for (i = 0; i < size; i++)
+		crc = boot_crc16_update (crc, image[i]);
+
+	data[0] = boot_cmd_ping;
+
+	if (boot_host_command (link, data, 1, BOOT_HOST_REPLY_TIMEOUT, stats) != boot_reply_ready)
+		return -1;
+
+	data[0] = boot_cmd_begin;
+	data[1] = (uint8_t)(size >> 16);
+	data[2] = (uint8_t)(size >> 8);
+	data[3] = (uint8_t)(size);
+	data[4] = (uint8_t)(crc >> 8);
+	data[5] = (uint8_t)(crc);
+
+	if (boot_host_command (link, data, 6, BOOT_HOST_REPLY_TIMEOUT, stats) != boot_reply_ok)
+		return -1;
+
+	pages = (size + BOOT_PAGE_SIZE - 1) / BOOT_PAGE_SIZE;
+
+	for (page = 0; page < pages; page++)
+	{
+		offset = (uint32_t)page * BOOT_PAGE_SIZE;
+
+		memset (page_data, 0xFF, BOOT_PAGE_SIZE);	/* erased flash */
+		memcpy (page_data, &image[offset], size - offset < BOOT_PAGE_SIZE ? size - offset : BOOT_PAGE_SIZE);
+
+		if (boot_host_send_page (link, page_data, page, stats) < 0)
+			return -1;
+
+		stats->pages++;
+	}
+
+	data[0] = boot_cmd_finish;
+
+	if (boot_host_command (link, data, 1, BOOT_HOST_FINISH_TIMEOUT, stats) != boot_reply_ok)
+		return -1;
+
+	data[0] = boot_cmd_run;
+
+	if (boot_host_command (link, data, 1, BOOT_HOST_REPLY_TIMEOUT, stats) != boot_reply_ok)
+		return -1;
+
+	return 0;
+}
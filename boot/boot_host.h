@@ -0,0 +1,64 @@
+//
+//	boot_host.h
+//	Host side of the CAN bootloader protocol.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#ifndef _BOOT_HOST_H
+#define _BOOT_HOST_H
+
+#include <inttypes.h>
+
+#include "boot.h"
+
+#define	BOOT_HOST_REPLY_TIMEOUT		100		/* ms, 1 */
+#define	BOOT_HOST_FINISH_TIMEOUT	2000	/* ms, 2 */
+#define	BOOT_HOST_RETRIES			8
+
+//
+//	1.	Long enough to cover a page erase and write (about 9 ms) plus a
+//		fully loaded bus.
+//
+//	2.	The bootloader checks the CRC of the whole image in flash and
+//		writes the application record before it answers.
+//
+
+//
+//	How the uploader gets at the bus. `receive' waits at most `timeout' ms
+//	for a frame and returns 1 if it got one, 0 otherwise.
+//
+
+typedef struct boot_host_link_t
+{
+	void	(*send)(void *context, const boot_frame_t *frame);
+	uint8_t	(*receive)(void *context, boot_frame_t *frame, uint32_t timeout);
+	void	*context;
+}
+boot_host_link_t;
+
+typedef struct boot_host_stats_t
+{
+	uint16_t	pages;
+	uint16_t	naks;			/* pages resent after a CRC mismatch */
+	uint16_t	timeouts;		/* pages or commands resent after a timeout */
+}
+boot_host_stats_t;
+
+//
+//	Upload the `size' byte image in `image' and start it. The image is a
+//	raw binary starting at flash address 0. Returns 0 on success, or -1 if
+//	the bootloader refused the image or stopped answering; `stats' is
+//	filled in either way.
+//
+
+int
+boot_host_upload
+(
+	const boot_host_link_t	*link,
+	const uint8_t			*image,
+	uint32_t				size,
+	boot_host_stats_t		*stats
+);
+
+#endif
@@ -0,0 +1,184 @@
+//
+//	canflash.c
+//	Upload an application image to the bootloader over Linux SocketCAN.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+//
+//	Build on the host, from the top of the tree:
+//
+//		cc -std=gnu99 -O2 -Wall -I. -Iboot -o canflash boot/canflash.c boot/boot_host.c
+//
+//	and run with the CAN interface and a raw binary image:
+//
+//		avr-objcopy -O binary -R .eeprom pbr_braking.elf pbr_braking.bin
+//		canflash can0 pbr_braking.bin
+//
+//	The module is asked to reset into its bootloader first, through the
+//	`svc_cmd_enter_bootloader' service. A module that is already sitting in
+//	the bootloader (no valid application) ignores that and answers the
+//	ping anyway.
+//
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include "boot_host.h"
+
+#define	SERVICE_ID		((MODULE_ID << 8) | msg_id_service)
+
+static void
+link_send (void *context, const boot_frame_t *frame)
+{
+	struct can_frame	out;
+	int					fd = *(int *)context;
+
+	memset (&out, 0, sizeof (out));
+	out.can_id = frame->id;
+	out.can_dlc = frame->length;
+	memcpy (out.data, frame->data, frame->length);
+
+	while (write (fd, &out, sizeof (out)) < 0)		/* 1 */
+	{
+		if (errno != ENOBUFS)
+		{
+			perror ("write");
+			exit (1);
+		}
+
+		usleep (200);
+	}
+}
+
+//
+//	1.	A page is written in one burst of 33 frames, which can overrun the
+//		socket's transmit queue; back off and try again.
+//
+
+static uint8_t
+link_receive (void *context, boot_frame_t *frame, uint32_t timeout)
+{
+	struct can_frame	in;
+	struct pollfd		pfd;
+
+	pfd.fd = *(int *)context;
+	pfd.events = POLLIN;
+
+	if (poll (&pfd, 1, timeout) <= 0)
+		return 0;
+
+	if (read (pfd.fd, &in, sizeof (in)) != sizeof (in))
+		return 0;
+
+	frame->id = in.can_id & CAN_SFF_MASK;
+	frame->length = in.can_dlc;
+	memcpy (frame->data, in.data, 8);
+
+	return 1;
+}
+
+int
+main (int argc, char **argv)
+{
+	static uint8_t		image[BOOT_APP_MAX_SIZE + 1];
+	struct sockaddr_can	addr;
+	struct can_filter	filter;
+	struct ifreq		ifr;
+	boot_host_link_t	link;
+	boot_host_stats_t	stats;
+	boot_frame_t		frame;
+	FILE				*file;
+	size_t				size;
+	int					fd;
+
+	if (argc != 3)
+	{
+		fprintf (stderr, "usage: %s <interface> <image.bin>\n", argv[0]);
+		return 2;
+	}
+
+	if (!(file = fopen (argv[2], "rb")))
+	{
+		perror (argv[2]);
+		return 1;
+	}
+
+	size = fread (image, 1, sizeof (image), file);
+	fclose (file);
+
+	if (size == 0 || size > BOOT_APP_MAX_SIZE)
+	{
+		fprintf (stderr, "%s: image must be 1 to %d bytes\n", argv[2], BOOT_APP_MAX_SIZE);
+		return 1;
+	}
+
+	if ((fd = socket (PF_CAN, SOCK_RAW, CAN_RAW)) < 0)
+	{
+		perror ("socket");
+		return 1;
+	}
+
+	strncpy (ifr.ifr_name, argv[1], IFNAMSIZ - 1);
+	ifr.ifr_name[IFNAMSIZ - 1] = 0;
+
+	if (ioctl (fd, SIOCGIFINDEX, &ifr) < 0)
+	{
+		perror (argv[1]);
+		return 1;
+	}
+
+	filter.can_id = BOOT_REPLY_ID;
+	filter.can_mask = CAN_SFF_MASK | CAN_EFF_FLAG | CAN_RTR_FLAG;
+	setsockopt (fd, SOL_CAN_RAW, CAN_RAW_FILTER, &filter, sizeof (filter));
+
+	memset (&addr, 0, sizeof (addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = ifr.ifr_ifindex;
+
+	if (bind (fd, (struct sockaddr *)&addr, sizeof (addr)) < 0)
+	{
+		perror ("bind");
+		return 1;
+	}
+
+	link.send = link_send;
+	link.receive = link_receive;
+	link.context = &fd;
+
+	frame.id = SERVICE_ID;
+	frame.length = 5;
+	frame.data[0] = svc_cmd_enter_bootloader;
+	memcpy (&frame.data[1], "BOOT", 4);
+
+	link_send (&fd, &frame);
+	usleep (100000);	/* 2 */
+
+	if (boot_host_upload (&link, image, size, &stats) < 0)
+	{
+		fprintf (stderr, "upload failed after %u pages (%u naks, %u timeouts)\n",
+			stats.pages, stats.naks, stats.timeouts);
+		return 1;
+	}
+
+	printf ("%zu bytes in %u pages (%u naks, %u timeouts)\n",
+		size, stats.pages, stats.naks, stats.timeouts);
+
+	close (fd);
+	return 0;
+}
+
+//
+//	2.	Enough for the module to write the request to eeprom and reset; the
+//		uploader keeps pinging until the bootloader answers anyway.
+//
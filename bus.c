@@ -0,0 +1,213 @@
+//
+//	bus.c
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#include <avr/io.h>
+#include <util/atomic.h>
+
+#include "can.h"
+#include "can_config.h"
+
+#include "bus.h"
+#include "diagnostic.h"
+#include "error.h"
+#include "pressure.h"
+#include "watchdog.h"
+
+static bus_state_t	state = bus_state_on;
+
+static uint16_t		backoff = BUS_BACKOFF_MIN;
+static uint16_t		wait;
+static uint16_t		stable;			/* ms on the bus since the last recovery */
+static uint8_t		passive;
+
+static uint8_t		recoveries;
+static uint8_t		passive_count;
+static uint8_t		peak_tec;
+static uint16_t		off_time;		/* ms, this time */
+static uint16_t		last_off_time;
+static uint16_t		total_off_time;
+
+//
+//	Restore the message objects and count the recovery. Interrupts must be
+//	off.
+//
+
+static void
+bus_restore (void)
+{
+	mob_init ();
+
+	diagnostic_restart ();
+	error_restart_broadcasts ();
+	pressure_restart_brake_events ();
+
+	state = bus_state_on;
+	stable = 0;
+
+	if (recoveries != UINT8_MAX)
+		recoveries++;
+
+	last_off_time = off_time;
+	total_off_time = (total_off_time > UINT16_MAX - off_time) ? UINT16_MAX : total_off_time + off_time;
+
+	error_broadcast_error_code (err_sev_recoverable, err_can_bus_off);
+	bus_broadcast_report ();
+}
+
+//
+//	Take the controller off the bus and into standby for the backoff period.
+//	The backoff doubles if the last recovery didn't last, up to
+//	`BUS_BACKOFF_MAX'.
+//
+
+static void
+bus_back_off (void)
+{
+	CANGCON &= ~_BV (ENASTB);
+
+	if (state != bus_state_on || (recoveries && stable < BUS_STABLE_PERIOD))
+		backoff = (backoff < BUS_BACKOFF_MAX / 2) ? 2 * backoff : BUS_BACKOFF_MAX;
+	else
+		backoff = BUS_BACKOFF_MIN;
+
+	state = bus_state_off;
+	wait = backoff;
+}
+
+void
+bus_periodic_interrupt_handler (void)
+{
+	uint8_t status = CANGSTA;
+
+	if (CANTEC > peak_tec)
+		peak_tec = CANTEC;
+
+	switch (state)
+	{
+		case bus_state_on:
+
+			if (status & _BV (BOFF))
+			{
+				bus_back_off ();
+
+				off_time = 0;
+				passive = 0;
+
+				break;
+			}
+
+			if ((status & _BV (ERRP)) && !passive && passive_count != UINT8_MAX)
+				passive_count++;
+
+			passive = status & _BV (ERRP);
+
+			if (stable < BUS_STABLE_PERIOD)
+				stable++;
+
+			if (status & _BV (ENFG))
+				watchdog_checkin (watchdog_task_can);
+
+			break;
+
+		case bus_state_off:
+
+			if (off_time != UINT16_MAX)
+				off_time++;
+
+			watchdog_checkin (watchdog_task_can);		/* 1 */
+
+			if (--wait == 0)
+			{
+				CANGCON |= _BV (ENASTB);
+				state = bus_state_recovering;
+				wait = BUS_RECOVERY_TIMEOUT;
+			}
+
+			break;
+
+		case bus_state_recovering:
+
+			if (off_time != UINT16_MAX)
+				off_time++;
+
+			if (!(status & _BV (BOFF)))
+			{
+				if (status & _BV (ENFG))
+					state = bus_state_restoring;
+
+				break;		/* 2 */
+			}
+
+			watchdog_checkin (watchdog_task_can);
+
+			if (--wait == 0)
+				bus_back_off ();		/* 3 */
+
+			break;
+
+		case bus_state_restoring:
+
+			if (off_time != UINT16_MAX)
+				off_time++;
+
+			break;
+	}
+}
+
+//
+//	1.	Being off the bus, or still waiting to get back on, is the bus's
+//		fault rather than the controller's, and a reset would not help.
+//
+//	2.	Out of bus-off. If the controller isn't enabled either, it has
+//		stopped responding, so the CAN task is left to run out and reset
+//		it.
+//
+//	3.	The bus was never quiet for long enough to get back on. The
+//		controller is put back in standby and tried again after a longer
+//		backoff.
+//
+
+void
+bus_service (void)
+{
+	if (state != bus_state_restoring)
+		return;
+
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+	{
+		if (!(CANGIT & _BV (CANIT)))		/* 1 */
+			bus_restore ();
+	}
+}
+
+//
+//	1.	A message object with a frame waiting for the CAN interrupt would
+//		lose it to `mob_init', so the restore waits for a pass of the main
+//		loop after libcan has dealt with it.
+//
+
+bus_state_t
+bus_get_state (void)
+{
+	return state;
+}
+
+void
+bus_broadcast_report (void)
+{
+	uint8_t data[8];
+
+	data[0] = diag_id_bus_report;
+	data[1] = recoveries;
+	data[2] = (uint8_t)(total_off_time >> 8);
+	data[3] = (uint8_t)(total_off_time);
+	data[4] = (uint8_t)(last_off_time >> 8);
+	data[5] = (uint8_t)(last_off_time);
+	data[6] = passive_count;
+	data[7] = peak_tec;
+
+	diagnostic_send (data, 8);
+}
@@ -0,0 +1,107 @@
+//
+//	bus.h
+//	CAN bus health monitor and bus-off recovery.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#ifndef _BUS_H
+#define _BUS_H
+
+#include <inttypes.h>
+
+//
+//	The controller's status and error counters are checked every
+//	millisecond from the timer interrupt (1). On bus-off, the controller is
+//	held in standby for a backoff period and then re-enabled, which takes
+//	it back onto the bus after 128 runs of 11 recessive bits. Once it is
+//	back, the main loop sets the message objects up again from `mob_init'
+//	(2) and a bus report is sent, along with `err_can_bus_off' for the
+//	journal.
+//
+//	The backoff starts at `BUS_BACKOFF_MIN' and doubles, up to
+//	`BUS_BACKOFF_MAX', for each bus-off that follows less than
+//	`BUS_STABLE_PERIOD' after the last recovery. If the controller is still
+//	bus-off `BUS_RECOVERY_TIMEOUT' after being re-enabled, because the bus
+//	has been too noisy to get back on, it goes back into standby for the
+//	next, doubled, backoff.
+//
+//	The watchdog's CAN task is checked in on every tick that the controller
+//	is enabled and on the bus, error active or passive, and all through a
+//	bus-off recovery, however long the bus stays bad. Frames that nobody
+//	acknowledges, with the bus unplugged, only take the controller error
+//	passive, so that is no reason to reset either. Only a controller that
+//	stops responding, neither on the bus nor bus-off, ends in a watchdog
+//	reset once `WATCHDOG_CAN_DEADLINE' runs out.
+//
+
+#define	BUS_BACKOFF_MIN			10			/* ms */
+#define	BUS_BACKOFF_MAX			640			/* ms, 3 */
+#define	BUS_RECOVERY_TIMEOUT	50			/* ms, 4 */
+#define	BUS_STABLE_PERIOD		5000		/* ms */
+
+//
+//	1.	The CAN interrupt vector belongs to libcan, and the general
+//		interrupts share it with the message objects, so the status is
+//		polled instead. A millisecond is nothing next to the recovery
+//		itself.
+//
+//	2.	Not from the timer interrupt, which could go off part way through a
+//		message object being loaded, and would hold every other interrupt
+//		off for all 15 of them.
+//
+//	3.	Long enough that a bus that keeps going bad isn't hammered with
+//		retries, and short enough that pressure is back on the bus soon
+//		after it clears.
+//
+//	4.	The recovery itself is 128 runs of 11 recessive bits, under 3 ms at
+//		500 kbit/s, so this leaves plenty of room for ordinary traffic.
+//
+
+typedef enum bus_state_t
+{
+	bus_state_on,				/* on the bus, error active or passive */
+	bus_state_off,				/* bus-off, held in standby for the backoff */
+	bus_state_recovering,		/* re-enabled, waiting to be back on the bus */
+	bus_state_restoring			/* back on the bus, waiting for `bus_service' */
+}
+bus_state_t;
+
+//
+//	Bus monitor interrupt handler. Called every millisecond from the timer
+//	interrupt.
+//
+
+void
+bus_periodic_interrupt_handler (void);
+
+//
+//	Restore the message objects once the controller is back on the bus
+//	after a bus-off. Called from the main loop.
+//
+
+void
+bus_service (void);
+
+//
+//	Return the current state of the bus monitor.
+//
+
+bus_state_t
+bus_get_state (void);
+
+//
+//	Broadcast a bus report on the diagnostic channel:
+//
+//	0: `diag_id_bus_report'
+//	1: The number of bus-off recoveries since start-up (saturates)
+//	2+3: The MSB and LSB of the total time spent off the bus, in ms
+//	4+5: The MSB and LSB of the time spent off the bus the last time, in ms
+//	6: The number of times the controller has gone error passive
+//	7: The highest transmit error count seen
+//
+
+void
+bus_broadcast_report (void);
+
+#endif
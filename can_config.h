@@ -21,21 +21,93 @@ typedef enum can_mob_t
 	mob_out_bias_adjust,
 	mob_rpl_bias_position,
 	mob_out_overtravel,
-	mob_out_error
+	mob_out_error,
+	mob_out_diagnostic,
+	mob_in_service,
+	mob_out_service,
+	mob_out_brake_event
 }
 mob_id_t;
 
+//
+//	Set up every message object for its message ID and callbacks. Defined
+//	in `main.c', and called again to restore them after a bus-off (see
+//	`bus.h').
+//
+
+void
+mob_init (void);
+
+//
+//	Regular messages are sent on (MODULE_ID << 8) | message ID. Events that
+//	other modules have to react to quickly are sent on `EVENT_ID' instead,
+//	so they win arbitration against all regular traffic on the bus.
+//
+//	IDs 0x000 to 0x01F are reserved for events: the event is in bits 3
+//	and 4 and the sending module in bits 0 to 2, which leaves room for four
+//	events from each of modules 0 to 7. Module 0 must not send regular
+//	messages below 0x020, so that its block stays clear of the events.
+//
+
+#define	EVENT_ID(event)	(((event) << 3) | MODULE_ID)
+
 typedef enum can_message_id_t
 {
 	msg_id_pressure_calibration		= 0x00,
 	msg_id_pressure_front			= 0x01,
 	msg_id_pressure_rear			= 0x02,
+	msg_id_brake_summary			= 0x03,
 	msg_id_bias_calibration			= 0x10,
 	msg_id_bias_position			= 0x11,
 	msg_id_bias_adjust				= 0x12,
 	msg_id_overtravel				= 0x20,
-	msg_id_error					= 0x30
+	msg_id_error					= 0x30,
+	msg_id_diagnostic				= 0x31,
+	msg_id_service					= 0x32,
+	msg_id_boot_command				= 0x40,
+	msg_id_boot_data				= 0x41,
+	msg_id_boot_reply				= 0x42
 }
 can_message_id_t;
 
+typedef enum can_event_id_t
+{
+	event_id_brake_onset			= 0x00
+}
+can_event_id_t;
+
+//
+//	Diagnostic packets all share one message ID. The first payload byte
+//	identifies the report, and the rest is specific to each report.
+//
+
+typedef enum can_diag_id_t
+{
+	diag_id_reset_report			= 0x00,
+	diag_id_onset_report			= 0x01,
+	diag_id_stack_report			= 0x02,
+	diag_id_bus_report				= 0x03,
+	diag_id_boot_report				= 0x04,
+	diag_id_stats_report			= 0x05
+}
+can_diag_id_t;
+
+//
+//	Service requests all share one message ID in each direction. The first
+//	payload byte is the command, and the reply echoes it back.
+//
+
+typedef enum can_svc_cmd_t
+{
+	svc_cmd_param_read				= 0x00,
+	svc_cmd_param_write				= 0x01,
+	svc_cmd_param_info				= 0x02,
+	svc_cmd_error_journal			= 0x03,
+	svc_cmd_error_counts			= 0x04,
+	svc_cmd_error_clear				= 0x05,
+	svc_cmd_subscribe				= 0x06,
+	svc_cmd_enter_bootloader		= 0x10
+}
+can_svc_cmd_t;
+
 #endif
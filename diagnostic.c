@@ -0,0 +1,89 @@
+//
+//	diagnostic.c
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#include <string.h>
+
+#include <util/atomic.h>
+
+#include "can.h"
+#include "can_config.h"
+
+#include "diagnostic.h"
+
+typedef struct diagnostic_frame_t
+{
+	uint8_t	data[8];
+	uint8_t	length;
+}
+diagnostic_frame_t;
+
+static diagnostic_frame_t	queue[DIAGNOSTIC_QUEUE_SIZE];
+static volatile uint8_t		queue_head, queue_count;
+static volatile uint8_t		dropped;
+
+//
+//	Load the frame at the head of the queue onto the message object.
+//	Interrupts must be off.
+//
+
+static void
+diagnostic_send_head (void)
+{
+	can_load_data (mob_out_diagnostic, queue[queue_head].data, queue[queue_head].length);
+	can_ready_to_send (mob_out_diagnostic);
+}
+
+void
+diagnostic_send (uint8_t *data, uint8_t length)
+{
+	diagnostic_frame_t *frame;
+
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+	{
+		if (queue_count == DIAGNOSTIC_QUEUE_SIZE)
+		{
+			if (dropped != UINT8_MAX)
+				dropped++;
+
+			return;
+		}
+
+		frame = &queue[(queue_head + queue_count) % DIAGNOSTIC_QUEUE_SIZE];
+		memcpy (frame->data, data, length);
+		frame->length = length;
+
+		if (queue_count++ == 0)
+			diagnostic_send_head ();
+	}
+}
+
+void
+diagnostic_restart (void)
+{
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+	{
+		if (queue_count)
+			diagnostic_send_head ();
+	}
+}
+
+uint8_t
+diagnostic_get_dropped (void)
+{
+	return dropped;
+}
+
+void
+diagnostic_tx_callback (uint8_t mob_index, uint32_t id, packet_type_t type)
+{
+	if (!queue_count)
+		return;
+
+	queue_head = (queue_head + 1) % DIAGNOSTIC_QUEUE_SIZE;
+
+	if (--queue_count)
+		diagnostic_send_head ();
+}
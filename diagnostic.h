@@ -0,0 +1,66 @@
+//
+//	diagnostic.h
+//	Sender for the diagnostic message ID.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#ifndef _DIAGNOSTIC_H
+#define _DIAGNOSTIC_H
+
+#include <inttypes.h>
+
+#include "can.h"
+
+//
+//	Every report on the diagnostic message ID goes out through the one
+//	message object, and a report loaded while the last is still waiting to
+//	go would overwrite it. So the reports are queued here, and the next one
+//	is loaded from the transmit callback once the last has gone. The frame
+//	at the head of the queue is the one on the message object. If the queue
+//	is full, the new report is dropped.
+//
+
+#define	DIAGNOSTIC_QUEUE_SIZE	4		/* frames */
+
+//
+//	Queue the report of `length' bytes at `data' to be sent. Safe to call
+//	from interrupts.
+//
+
+void
+diagnostic_send
+(
+	uint8_t	*data,
+	uint8_t	length
+);
+
+//
+//	Send the frame at the head of the queue again. Called after the message
+//	objects have been set up anew, which loses a frame waiting on them (see
+//	`bus.h').
+//
+
+void
+diagnostic_restart (void);
+
+//
+//	Return the number of reports dropped because the queue was full.
+//
+
+uint8_t
+diagnostic_get_dropped (void);
+
+//
+//	Transmit callback for the diagnostic message object.
+//
+
+void
+diagnostic_tx_callback
+(
+	uint8_t			mob_index,
+	uint32_t		id,
+	packet_type_t	type
+);
+
+#endif
@@ -4,16 +4,50 @@
 //	Michael Jean <michael.jean@shaw.ca>
 //
 
+#include <string.h>
+
+#include <avr/eeprom.h>
 #include <avr/io.h>
+#include <util/atomic.h>
 #include <util/delay.h>
 
 #include "can.h"
 #include "can_config.h"
+#include "eeprom.h"
 
 #include "error.h"
+#include "flush.h"
+#include "service.h"
 #include "state.h"
+#include "timer.h"
+#include "watchdog.h"
+
+#define	UNUSED_SEQUENCE		0xFF
+#define	ALL_DIRTY			0xFFFF
+#define	ALL_COUNTS_DIRTY	0xFFFFFFFFUL
+
+typedef struct error_journal_t
+{
+	uint16_t		magic;
+	uint8_t			head;					/* next slot to record into */
+	uint8_t			sequence;				/* next sequence number */
+	uint16_t		dirty_records;			/* one bit per slot */
+	uint32_t		dirty_counts;			/* one bit per code */
+	uint8_t			dirty_head;
+	error_record_t	records[ERROR_JOURNAL_SIZE];
+	uint16_t		counts[ERROR_CODE_COUNT];
+}
+error_journal_t;
+
+static error_journal_t journal __attribute__ ((section (".noinit")));
 
 static volatile err_code_t error_code = 0;
+static volatile state_t error_state;
+
+static uint8_t journal_wanted;
+
+static uint8_t			broadcasts[ERROR_BROADCAST_QUEUE_SIZE][2];
+static volatile uint8_t	broadcast_head, broadcast_count;
 
 err_code_t
 error_get_error_code (void)
@@ -25,6 +59,20 @@ void
 error_set_error_code (err_code_t new_error_code)
 {
 	error_code = new_error_code;
+	error_state = state_get_current_state ();
+}
+
+void
+error_raise_from_isr (err_code_t new_error_code)
+{
+	if (state_is_booting ())
+	{
+		error_broadcast_error_code (err_sev_recoverable, new_error_code);
+		return;
+	}
+
+	error_set_error_code (new_error_code);
+	state_isr_transition (state_error_recoverable);
 }
 
 void
@@ -33,29 +81,407 @@ error_clear_error_code (void)
 	error_code = 0;
 }
 
+//
+//	Record an error in the journal and count it.
+//
+
+static void
+error_record (err_severity_t severity, err_code_t code)
+{
+	error_record_t	*record;
+	state_t			state;
+
+	state = (code == error_code) ? error_state : state_get_current_state ();	/* 1 */
+
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+	{
+		record = &journal.records[journal.head];
+
+		record->sequence = journal.sequence;
+		record->code = code;
+		record->severity = severity;
+		record->state = state;
+		record->time = timer_get_ticks ();
+
+		journal.dirty_records |= 1 << journal.head;
+		journal.dirty_head = 1;
+
+		journal.head = (journal.head + 1) % ERROR_JOURNAL_SIZE;
+		journal.sequence = (journal.sequence + 1) % UNUSED_SEQUENCE;
+
+		if (code < ERROR_CODE_COUNT && journal.counts[code] != UINT16_MAX)
+		{
+			journal.counts[code]++;
+			journal.dirty_counts |= 1UL << code;
+		}
+	}
+}
+
+//
+//	1.	By the time an error is broadcast the state machine has usually
+//		moved on to handle it, so the state noted when the code was set is
+//		the one worth keeping.
+//
+
+//
+//	Load the error packet at the head of the broadcast queue onto the
+//	message object. Interrupts must be off.
+//
+
+static void
+error_send_head (void)
+{
+	can_load_data (mob_out_error, broadcasts[broadcast_head], 2);
+	can_ready_to_send (mob_out_error);
+}
+
 void
 error_broadcast_error_code (err_severity_t error_severity, err_code_t error_code)
 {
-	uint8_t data[2] = { error_severity, error_code };
+	uint8_t *data;
 
-	can_load_data (mob_out_error, data, 2);
-	can_ready_to_send (mob_out_error);
+	error_record (error_severity, error_code);
+
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+	{
+		if (broadcast_count == ERROR_BROADCAST_QUEUE_SIZE)
+			return;		/* 1 */
+
+		data = broadcasts[(broadcast_head + broadcast_count) % ERROR_BROADCAST_QUEUE_SIZE];
+		data[0] = error_severity;
+		data[1] = error_code;
+
+		if (broadcast_count++ == 0)
+			error_send_head ();
+	}
 }
 
+//
+//	1.	The error is still in the journal and counted; only the packet is
+//		lost.
+//
+
 void
-error_fatal_error (void)
+error_restart_broadcasts (void)
 {
-	error_broadcast_error_code (err_sev_fatal, error_code);
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+	{
+		if (broadcast_count)
+			error_send_head ();
+	}
+}
+
+void
+error_tx_callback (uint8_t mob_index, uint32_t id, packet_type_t type)
+{
+	if (!broadcast_count)
+		return;
+
+	broadcast_head = (broadcast_head + 1) % ERROR_BROADCAST_QUEUE_SIZE;
+
+	if (--broadcast_count)
+		error_send_head ();
+}
+
+void
+error_init (void)
+{
+	uint8_t		bytes[8];
+	uint8_t		i, newest;
+
+	if
+	(
+		journal.magic == ERROR_JOURNAL_MAGIC && journal.head < ERROR_JOURNAL_SIZE &&
+		!(watchdog_reset_flags () & (_BV (PORF) | _BV (BORF)))
+	)
+		return;		/* 1 */
+
+	memset (&journal, 0, sizeof (journal));
+
+	eeprom_read_many (ERROR_EEPROM_HEAD, bytes, 2);
+
+	if (bytes[1] != ERROR_EEPROM_LAYOUT)
+	{
+		for (i = 0; i < ERROR_JOURNAL_SIZE; i++)		/* 2 */
+			memset (&journal.records[i], 0xFF, sizeof (error_record_t));
 
-	can_init (); 	/* 1 */
+		journal.dirty_records = ALL_DIRTY;
+		journal.dirty_counts = ALL_COUNTS_DIRTY;
+		journal.dirty_head = 1;
+		journal.magic = ERROR_JOURNAL_MAGIC;
 
-	while (1)
+		return;
+	}
+
+	journal.head = (bytes[0] < ERROR_JOURNAL_SIZE) ? bytes[0] : 0;
+
+	for (i = 0; i < ERROR_CODE_COUNT; i++)
 	{
-		PORTG ^= _BV (PG3);
-		_delay_ms (250.0);
+		eeprom_read_many (ERROR_EEPROM_COUNTS + 2 * i, bytes, 2);
+
+		if (bytes[0] != 0xFF || bytes[1] != 0xFF)
+			journal.counts[i] = (bytes[0] << 8) | bytes[1];
 	}
+
+	for (i = 0; i < ERROR_JOURNAL_SIZE; i++)
+	{
+		eeprom_read_many (ERROR_EEPROM_RECORDS + 8 * i, bytes, 8);
+
+		journal.records[i].sequence = bytes[0];
+		journal.records[i].code = bytes[1];
+		journal.records[i].severity = bytes[2];
+		journal.records[i].state = bytes[3];
+		journal.records[i].time =
+			((uint32_t)bytes[4] << 24) | ((uint32_t)bytes[5] << 16) |
+			((uint32_t)bytes[6] << 8) | bytes[7];
+	}
+
+	newest = (journal.head + ERROR_JOURNAL_SIZE - 1) % ERROR_JOURNAL_SIZE;
+
+	if (journal.records[newest].sequence != UNUSED_SEQUENCE)
+		journal.sequence = (journal.records[newest].sequence + 1) % UNUSED_SEQUENCE;
+
+	journal.magic = ERROR_JOURNAL_MAGIC;
 }
 
+//
+//	1.	The RAM copy survived a reset and may hold errors that were never
+//		written back, so it is newer than the eeprom. Its dirty bits
+//		survived with it. After a power-on or brown-out reset the RAM can't
+//		be trusted, even if the magic happens to match, so the journal is
+//		always reloaded.
+//
+//	2.	A blank eeprom, or a journal in an older layout. The journal is
+//		started over empty and written out in the new layout from the idle
+//		state, the layout byte along with the head.
+//
+
+//
+//	Lay out the next changed part of the journal as it is kept in the
+//	eeprom, at `bytes', and mark it clean. Returns its length, or zero if
+//	nothing has changed.
+//
+
+static uint8_t
+error_next_dirty (uint16_t *addr, uint8_t *bytes, uint8_t *job, uint8_t *index)
+{
+	error_record_t	*record;
+	uint8_t			i;
+
+	for (i = 0; i < ERROR_JOURNAL_SIZE; i++)
+	{
+		if (!(journal.dirty_records & (1 << i)))
+			continue;
+
+		journal.dirty_records &= ~(1 << i);
+		record = &journal.records[i];
+
+		bytes[0] = record->sequence;
+		bytes[1] = record->code;
+		bytes[2] = record->severity;
+		bytes[3] = record->state;
+		bytes[4] = (uint8_t)(record->time >> 24);
+		bytes[5] = (uint8_t)(record->time >> 16);
+		bytes[6] = (uint8_t)(record->time >> 8);
+		bytes[7] = (uint8_t)(record->time);
+
+		*addr = ERROR_EEPROM_RECORDS + 8 * i;
+		*job = 0;
+		*index = i;
+
+		return 8;
+	}
+
+	for (i = 0; i < ERROR_CODE_COUNT; i++)
+	{
+		if (!(journal.dirty_counts & (1UL << i)))
+			continue;
+
+		journal.dirty_counts &= ~(1UL << i);
+
+		bytes[0] = (uint8_t)(journal.counts[i] >> 8);
+		bytes[1] = (uint8_t)(journal.counts[i]);
+
+		*addr = ERROR_EEPROM_COUNTS + 2 * i;
+		*job = 1;
+		*index = i;
+
+		return 2;
+	}
+
+	if (journal.dirty_head)
+	{
+		journal.dirty_head = 0;
+
+		bytes[0] = journal.head;
+		bytes[1] = ERROR_EEPROM_LAYOUT;
+
+		*addr = ERROR_EEPROM_HEAD;
+		*job = 2;
+		*index = 0;
+
+		return 2;
+	}
+
+	return 0;
+}
+
+void
+error_flush (void)
+{
+	uint8_t		bytes[8];
+	uint16_t	addr;
+	uint8_t		length, job, index;
+
+	if (!eeprom_is_ready ())
+		return;
+
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+	{
+		length = error_next_dirty (&addr, bytes, &job, &index);
+	}
+
+	if (!length || !flush_bytes (addr, bytes, length))
+		return;
+
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)		/* 1 */
+	{
+		if (job == 0)
+			journal.dirty_records |= 1 << index;
+		else if (job == 1)
+			journal.dirty_counts |= 1UL << index;
+		else
+			journal.dirty_head = 1;
+	}
+}
+
+//
+//	1.	Only one byte is written per call. The part is marked dirty again
+//		so the next call carries on with the rest.
+//
+
+//
+//	Fill in the journal readout, newest record first.
+//
+
+static uint8_t
+error_fill_journal (uint8_t index, uint8_t *data)
+{
+	error_record_t	record;
+	uint8_t			slot;
+
+	if (index >= ERROR_JOURNAL_SIZE || (journal_wanted && index >= journal_wanted))
+		return 0;
+
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+	{
+		slot = (journal.head + ERROR_JOURNAL_SIZE - 1 - index) % ERROR_JOURNAL_SIZE;
+		record = journal.records[slot];
+	}
+
+	if (record.sequence == UNUSED_SEQUENCE)
+		return 0;
+
+	data[0] = svc_cmd_error_journal;
+	data[1] = record.sequence;
+	data[2] = record.code;
+	data[3] = record.severity;
+	data[4] = record.state;
+	data[5] = (uint8_t)(record.time >> 16);
+	data[6] = (uint8_t)(record.time >> 8);
+	data[7] = (uint8_t)(record.time);
+
+	return 8;
+}
+
+//
+//	Fill in the counts readout, three codes to a packet.
+//
+
+static uint8_t
+error_fill_counts (uint8_t index, uint8_t *data)
+{
+	uint16_t	count;
+	uint8_t		code, i;
+
+	code = 3 * index;
+
+	if (code >= ERROR_CODE_COUNT)
+		return 0;
+
+	data[0] = svc_cmd_error_counts;
+	data[1] = code;
+
+	for (i = 0; i < 3 && code + i < ERROR_CODE_COUNT; i++)
+	{
+		ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+		{
+			count = journal.counts[code + i];
+		}
+
+		data[2 + 2 * i] = (uint8_t)(count >> 8);
+		data[3 + 2 * i] = (uint8_t)(count);
+	}
+
+	return 2 + 2 * i;
+}
+
+void
+error_service_request (uint8_t *data)
+{
+	uint8_t i;
+
+	switch (data[0])
+	{
+		case svc_cmd_error_journal:
+
+			journal_wanted = data[1];
+			service_send_replies (error_fill_journal);
+			break;
+
+		case svc_cmd_error_counts:
+
+			service_send_replies (error_fill_counts);
+			break;
+
+		case svc_cmd_error_clear:
+
+			ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+			{
+				for (i = 0; i < ERROR_JOURNAL_SIZE; i++)
+					memset (&journal.records[i], 0xFF, sizeof (error_record_t));
+
+				memset (journal.counts, 0, sizeof (journal.counts));
+
+				journal.head = 0;
+				journal.sequence = 0;
+				journal.dirty_records = ALL_DIRTY;
+				journal.dirty_counts = ALL_COUNTS_DIRTY;
+				journal.dirty_head = 1;
+			}
+
+			service_send_reply (data, 1);
+			break;
+	}
+}
+
+void
+error_fatal_error (void)
+{
+	error_broadcast_error_code (err_sev_fatal, error_code);
+
+	PORTG &= ~_BV (PG3);
+	_delay_ms (1.0);	/* 1 */
+
+	watchdog_reset_system (watchdog_task_fatal_error);
+}
+
+//
+//	1.	Give the CAN controller time to get the error packet out before the
+//		reset takes it off the bus. The reset report sent at boot carries
+//		the error code again, in case this one is lost.
+//
+
 void
 error_recoverable_error (void)
 {
@@ -7,6 +7,10 @@
 #ifndef _ERROR_H
 #define _ERROR_H
 
+#include <inttypes.h>
+
+#include "can.h"
+
 //
 //	The error packet is made up of two payload bytes. The first byte is the
 //	severity. The second byte is the actual error code. Both are defined below.
@@ -26,10 +30,66 @@ typedef enum err_code_t
 	err_pcal_minf_gt_maxf			= 0x03,
 	err_pcal_minr_gt_maxr			= 0x04,
 	err_pcal_deltaf_lt_threshf		= 0x05,
-	err_pcal_deltar_lt_threshr		= 0x06
+	err_pcal_deltar_lt_threshr		= 0x06,
+	err_pcal_curve_invalid			= 0x07,
+	err_bias_queue_full				= 0x08,
+	err_stack_low					= 0x09,
+	err_can_bus_off					= 0x0A,
+	err_bcal_curve_invalid			= 0x0B,
+	err_bcal_no_curve				= 0x0C,
+	err_sensor_fault				= 0x0D,
+	err_bias_position_lost			= 0x0E,
+	err_stats_rest_drift			= 0x0F,
+	err_stats_fade					= 0x10,
+	err_stats_balance_drift			= 0x11,
+	err_boot_bad_key				= 0x12,
+	err_svc_busy					= 0x13
 }
 err_code_t;
 
+//
+//	Every error that is broadcast is also recorded in a journal, along with
+//	a running count for each error code. The journal is a ring of the last
+//	`ERROR_JOURNAL_SIZE' errors in RAM, mirrored slot for slot in a
+//	reserved area of the eeprom. Recording only touches RAM, so it is safe
+//	from interrupts and never waits; changed slots and counts are written
+//	back a byte at a time from the idle state, whenever the eeprom isn't
+//	busy (see `error_flush').
+//
+//	The RAM copy is kept in `.noinit', so errors that haven't been written
+//	back yet survive a watchdog reset, including the one that follows a
+//	fatal error. It is reloaded from the eeprom after a power-on or
+//	brown-out reset.
+//
+
+#define	ERROR_JOURNAL_SIZE		16			/* records */
+#define	ERROR_CODE_COUNT		32			/* counted codes, 1 */
+#define	ERROR_JOURNAL_MAGIC		0xE7A2		/* 2 */
+#define	ERROR_EEPROM_LAYOUT		0x02
+
+#define	ERROR_EEPROM_COUNTS		0x100		/* two bytes per code, MSB first */
+#define	ERROR_EEPROM_HEAD		0x140		/* head, then `ERROR_EEPROM_LAYOUT' */
+#define	ERROR_EEPROM_RECORDS	0x148		/* eight bytes per record */
+
+//
+//	1.	Codes from zero up to this are counted; room is reserved in the
+//		eeprom for all of them, so there are spare slots for codes still
+//		to come.
+//
+//	2.	Changed with the layout, so a RAM copy left by older firmware is
+//		not taken up. An eeprom journal in another layout is started over.
+//
+
+typedef struct error_record_t
+{
+	uint8_t		sequence;		/* wraps; 0xFF in the eeprom means unused */
+	uint8_t		code;			/* `err_code_t' */
+	uint8_t		severity;		/* `err_severity_t' */
+	uint8_t		state;			/* `state_t' the error was raised in */
+	uint32_t	time;			/* ms since start-up */
+}
+error_record_t;
+
 //
 //	Return the currently set error code.
 //
@@ -38,7 +98,8 @@ err_code_t
 error_get_error_code (void);
 
 //
-//	Set the current error code to `error_code'.
+//	Set the current error code to `error_code'. The current state is noted
+//	as the state the error was raised in, for the journal.
 //
 
 void
@@ -47,6 +108,20 @@ error_set_error_code
 	err_code_t error_code
 );
 
+//
+//	Raise `error_code' from an interrupt handler, e.g. for a message that
+//	came at the wrong time: set it and go to the recoverable error state.
+//	While the start-up states are running the error is broadcast straight
+//	away instead, and the state is left alone, so start-up always runs to
+//	the end.
+//
+
+void
+error_raise_from_isr
+(
+	err_code_t error_code
+);
+
 //
 //	Clear the current error code.
 //
@@ -56,8 +131,15 @@ error_clear_error_code (void);
 
 //
 //	Broadcast an error code `error_code' over the CAN channel. Set the error
-//	severity to `error_severity'.
+//	severity to `error_severity'. The error is recorded in the journal.
 //
+//	The packets go out through one message object, so they are queued and
+//	the next one is loaded from its transmit callback. If
+//	`ERROR_BROADCAST_QUEUE_SIZE' packets are already waiting, the packet
+//	is dropped.
+//
+
+#define	ERROR_BROADCAST_QUEUE_SIZE	4
 
 void
 error_broadcast_error_code
@@ -66,10 +148,76 @@ error_broadcast_error_code
 	err_code_t 		error_code
 );
 
+//
+//	Send the error packet at the head of the queue again. Called after the
+//	message objects have been set up anew (see `bus.h').
+//
+
+void
+error_restart_broadcasts (void);
+
+//
+//	Transmit callback for the error message object.
+//
+
+void
+error_tx_callback
+(
+	uint8_t			mob_index,
+	uint32_t		id,
+	packet_type_t	type
+);
+
+//
+//	Load the journal from the eeprom, unless the RAM copy survived a reset.
+//
+
+void
+error_init (void);
+
+//
+//	Write back at most one changed byte of the journal, if the eeprom is
+//	ready. Never waits. Called from the idle state.
+//
+
+void
+error_flush (void);
+
+//
+//	Handle a service request for the journal. Both readouts are sent as a
+//	run of service replies, one per packet:
+//
+//	Journal:	0: `svc_cmd_error_journal'
+//				1: The number of records wanted, newest first (0 for all)
+//
+//	0: The command
+//	1: The record's sequence number
+//	2: The error code
+//	3: The severity
+//	4: The state the error was raised in
+//	5+6+7: The time of the error, in ms since start-up (low 24 bits, MSB first)
+//
+//	Counts:		0: `svc_cmd_error_counts'
+//
+//	0: The command
+//	1: The first error code in this packet
+//	2-7: The MSB and LSB of the counts for that code and the next two
+//
+//	Clear:		0: `svc_cmd_error_clear'
+//
+//	Clears the journal and the counts, and replies with just the command.
+//
+
+void
+error_service_request
+(
+	uint8_t *data
+);
+
 //
 //	Handle a fatal error state. Announce the error over the CAN channel.
-//	Enter a failure mode and blink the status LED rapidly. Disable all
-//	incoming and outgoing CAN communications.
+//	Light the status LED and reset into a safe state through the watchdog
+//	supervisor. The error code is kept for the reset report.
 //
 
 void
@@ -0,0 +1,38 @@
+//
+//	flush.c
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#include <avr/eeprom.h>
+
+#include "eeprom.h"
+
+#include "flush.h"
+
+uint8_t
+flush_bytes (uint16_t addr, const uint8_t *data, uint8_t length)
+{
+	uint8_t i;
+
+	if (!eeprom_is_ready ())
+		return 1;
+
+	for (i = 0; i < length; i++)
+	{
+		if (eeprom_read_byte ((const uint8_t *)(uintptr_t)(addr + i)) == data[i])
+			continue;
+
+		eeprom_write_byte ((uint8_t *)(uintptr_t)(addr + i), data[i]);		/* 1 */
+		return 1;
+	}
+
+	return 0;
+}
+
+//
+//	1.	The write runs on in the background, and the eeprom can't be read
+//		again until it is done, so the next call returns straight away
+//		until then. The bytes already written match by then and are
+//		skipped.
+//
@@ -0,0 +1,37 @@
+//
+//	flush.h
+//	Background eeprom writes from the idle state.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#ifndef _FLUSH_H
+#define _FLUSH_H
+
+#include <inttypes.h>
+
+//
+//	An eeprom byte write takes about 3.3 ms, so anything longer than a few
+//	bytes written in one go would hold up the main loop past its deadline
+//	(see `watchdog.h'). Instead, each owner keeps the bytes it wants stored
+//	and hands them to `flush_bytes' on every idle pass until they are all
+//	there. Every caller waits its turn on the one eeprom, so at most one
+//	byte is written per pass of the main loop.
+//
+
+//
+//	Start writing the first of the `length' bytes at `data' that doesn't
+//	match the eeprom at `addr'. Returns 1 if a byte was written, or the
+//	eeprom was still busy and nothing was checked, and 0 once every byte
+//	matches. Never waits.
+//
+
+uint8_t
+flush_bytes
+(
+	uint16_t		addr,
+	const uint8_t	*data,
+	uint8_t			length
+);
+
+#endif
@@ -11,8 +11,22 @@
 #include "can_config.h"
 
 #include "adc.h"
+#include "bias.h"
+#include "bus.h"
+#include "diagnostic.h"
+#include "error.h"
+#include "param.h"
 #include "pressure.h"
+#include "service.h"
+#include "stack.h"
+#include "startup.h"
 #include "state.h"
+#include "stepper.h"
+#include "timer.h"
+#include "watchdog.h"
+
+void
+idle_state_handler (void);
 
 //
 //	System state handling functions are defined here. This variable is
@@ -21,17 +35,32 @@
 
 void (*state_handlers[])(void) =
 {
-	idle_state_handler, 	/* state_idle */
-	idle_state_handler, 	/* state_error_recoverable */
-	idle_state_handler,		/* state_error_fatal */
-	idle_state_handler,		/* state_pcal_request_min */
-	idle_state_handler,		/* state_pcal_wait_min */
-	idle_state_handler,		/* state_pcal_sample_min */
-	idle_state_handler,		/* state_pcal_request_max */
-	idle_state_handler,		/* state_pcal_wait_max */
-	idle_state_handler,		/* state_pcal_sample_max */
-	idle_state_handler,		/* state_pcal_update */
-	idle_state_handler 		/* state_pcal_abort */
+	idle_state_handler, 				/* state_idle */
+	error_recoverable_error, 			/* state_error_recoverable */
+	error_fatal_error,					/* state_error_fatal */
+	pressure_calibration_request_min,	/* state_pcal_request_min */
+	pressure_calibration_wait_min,		/* state_pcal_wait_min */
+	pressure_calibration_sample_min,	/* state_pcal_sample_min */
+	pressure_calibration_request_max,	/* state_pcal_request_max */
+	pressure_calibration_wait_max,		/* state_pcal_wait_max */
+	pressure_calibration_sample_max,	/* state_pcal_sample_max */
+	pressure_calibration_update,		/* state_pcal_update */
+	pressure_calibration_abort, 		/* state_pcal_abort */
+	pressure_calibration_request_point,	/* state_pcal_request_point */
+	pressure_calibration_wait_point,	/* state_pcal_wait_point */
+	pressure_calibration_sample_point,	/* state_pcal_sample_point */
+	pressure_calibration_update_curve,	/* state_pcal_update_curve */
+	bias_calibration_move_start,		/* state_bcal_move_start */
+	bias_calibration_wait_start,		/* state_bcal_wait_start */
+	bias_calibration_wait_pressure,		/* state_bcal_wait_pressure */
+	bias_calibration_sweep,				/* state_bcal_sweep */
+	bias_calibration_wait_sweep,		/* state_bcal_wait_sweep */
+	bias_calibration_update,			/* state_bcal_update */
+	bias_calibration_abort,				/* state_bcal_abort */
+	startup_load_calibration,			/* state_boot_load */
+	startup_wake_stepper,				/* state_boot_wake_stepper */
+	startup_wait_stepper,				/* state_boot_wait_stepper */
+	startup_self_test					/* state_boot_self_test */
 };
 
 //
@@ -41,17 +70,38 @@ void (*state_handlers[])(void) =
 
 ISR (TIMER0_COMP_vect)
 {
+	timer_periodic_interrupt_handler ();
+	watchdog_periodic_interrupt_handler ();
+	bus_periodic_interrupt_handler ();
 	pressure_periodic_interrupt_handler ();
+	bias_periodic_interrupt_handler ();
+}
+
+//
+//	Stepper timer interrupt handler. Fires once per step while the bias
+//	adjuster is moving.
+//
+
+ISR (TIMER1_COMPA_vect)
+{
+	stepper_step_interrupt_handler ();
 }
 
 //
-//	The idle state handler runs when the system has nothing to do.
+//	The idle state handler runs when the system has nothing to do. Any
+//	parameter changes, the error journal, the bias adjuster's position and
+//	new curves are written back to the eeprom from here, a byte per pass,
+//	and the stack high-water mark is updated.
 //
 
 void
 idle_state_handler (void)
 {
-	/* zzz... */
+	param_flush ();
+	error_flush ();
+	bias_flush ();
+	pressure_flush ();
+	stack_scan ();
 }
 
 //
@@ -67,9 +117,15 @@ io_init (void)
 }
 
 //
-//	Initialize the message objects.
+//	Initialize the message objects. The sensor channels' are set up from
+//	`PRESSURE_CHANNELS'.
 //
 
+#define	PRESSURE_CHANNEL_MOB(name, adc, convert, curve_addr, min_addr, max_addr, filter, mob, msg, tx) \
+	mob_config.id = (MODULE_ID << 8) | msg;										\
+	mob_config.tx_callback_ptr = tx;											\
+	can_config_mob (mob, &mob_config);
+
 void
 mob_init (void)
 {
@@ -88,25 +144,29 @@ mob_init (void)
 	mob_config.rx_callback_ptr = 0;
 	can_config_mob (mob_out_pressure_calibration, &mob_config);
 
-	mob_config.id = (MODULE_ID << 8) | msg_id_pressure_front;
 	mob_config.rx_callback_ptr = 0;
-	can_config_mob (mob_out_pressure_front, &mob_config);
+	PRESSURE_CHANNELS (PRESSURE_CHANNEL_MOB)
+	mob_config.tx_callback_ptr = 0;
 
-	mob_config.id = (MODULE_ID << 8) | msg_id_pressure_rear;
+	mob_config.id = (MODULE_ID << 8) | msg_id_brake_summary;
 	mob_config.rx_callback_ptr = 0;
-	can_config_mob (mob_out_pressure_rear, &mob_config);
+	mob_config.tx_callback_ptr = pressure_brake_event_tx_callback;
+	can_config_mob (mob_out_brake_event, &mob_config);
+	mob_config.tx_callback_ptr = 0;
 
 	mob_config.id = (MODULE_ID << 8) | msg_id_bias_calibration;
-	mob_config.rx_callback_ptr = 0;
+	mob_config.rx_callback_ptr = bias_calibration_rx_callback;
 	can_config_mob (mob_in_bias_calibration, &mob_config);
+	can_ready_to_receive (mob_in_bias_calibration);
 
 	mob_config.id = (MODULE_ID << 8) | msg_id_bias_calibration;
 	mob_config.rx_callback_ptr = 0;
 	can_config_mob (mob_out_bias_calibration, &mob_config);
 
 	mob_config.id = (MODULE_ID << 8) | msg_id_bias_adjust;
-	mob_config.rx_callback_ptr = 0;
+	mob_config.rx_callback_ptr = bias_adjust_rx_callback;
 	can_config_mob (mob_in_bias_adjust, &mob_config);
+	can_ready_to_receive (mob_in_bias_adjust);
 
 	mob_config.id = (MODULE_ID << 8) | msg_id_bias_adjust;
 	mob_config.rx_callback_ptr = 0;
@@ -122,41 +182,62 @@ mob_init (void)
 
 	mob_config.id = (MODULE_ID << 8) | msg_id_error;
 	mob_config.rx_callback_ptr = 0;
+	mob_config.tx_callback_ptr = error_tx_callback;
 	can_config_mob (mob_out_error, &mob_config);
-}
+	mob_config.tx_callback_ptr = 0;
 
-//
-//	Initialize the general-purpose timer to interrupt every millisecond.
-//
+	mob_config.id = (MODULE_ID << 8) | msg_id_diagnostic;
+	mob_config.rx_callback_ptr = 0;
+	mob_config.tx_callback_ptr = diagnostic_tx_callback;
+	can_config_mob (mob_out_diagnostic, &mob_config);
+	mob_config.tx_callback_ptr = 0;
 
-void
-timer_init (void)
-{
-	TCCR0A = _BV (WGM01) | _BV (CS01) | _BV (CS00);
-	OCR0A = 249;
-	TIMSK0 = _BV (OCIE0A);
+	mob_config.id = (MODULE_ID << 8) | msg_id_service;
+	mob_config.rx_callback_ptr = service_rx_callback;
+	can_config_mob (mob_in_service, &mob_config);
+	can_ready_to_receive (mob_in_service);
+
+	mob_config.id = (MODULE_ID << 8) | msg_id_service;
+	mob_config.rx_callback_ptr = 0;
+	mob_config.tx_callback_ptr = service_tx_callback;
+	can_config_mob (mob_out_service, &mob_config);
+	mob_config.tx_callback_ptr = 0;
 }
 
 //
-//	Program entry point here.
+//	Program entry point here. This is the first stage of start-up, and the
+//	state machine runs the rest (see `startup.h').
 //
 
 int
 main (void)
 {
+	timer_init ();
 	adc_init ();
 	can_init ();
 
 	io_init ();
 	mob_init ();
-	timer_init ();
+	stepper_init ();
+
+	param_init ();
+	error_init ();
+	watchdog_init ();
 
-	pressure_init ();
+	pressure_boot ();
+	startup_alive_sent ();
 
 	sei ();
 
+	watchdog_broadcast_reset_report ();
+
 	for (;;)
+	{
+		watchdog_service ();
+		bus_service ();
+		service_service ();
 		state_execute_current_state ();
+	}
 
 	return 0;
 }
@@ -0,0 +1,230 @@
+//
+//	param.c
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+#include "can_config.h"
+
+#include "eeprom.h"
+
+#include "flush.h"
+#include "param.h"
+#include "pressure.h"
+#include "service.h"
+
+static const param_entry_t param_table[param_count] PROGMEM =
+{
+	/* param_pressure_update_period */
+	{ param_type_u16, 0, 1000, PRESSURE_UPDATE_PERIOD },
+
+	/* param_pressure_broadcast_period */
+	{ param_type_u16, 0, 2000, PRESSURE_BROADCAST_PERIOD },		/* 1 */
+
+	/* param_pressure_calibration_min_diff */
+	{ param_type_u16, 10, 1000, PRESSURE_CALIBRATION_MIN_DIFF },
+
+	/* param_pressure_fast_update_period */
+	{ param_type_u16, 1, 1000, PRESSURE_FAST_UPDATE_PERIOD },
+
+	/* param_pressure_fast_rate_threshold */
+	{ param_type_u16, 100, 60000, PRESSURE_FAST_RATE_THRESHOLD },
+
+	/* param_pressure_fast_level_threshold */
+	{ param_type_u16, 0, 1500, PRESSURE_FAST_LEVEL_THRESHOLD },
+
+	/* param_pressure_fast_quiet_period */
+	{ param_type_u16, 0, 10000, PRESSURE_FAST_QUIET_PERIOD },
+
+	/* param_pressure_event_threshold */
+	{ param_type_u16, 2, 1500, PRESSURE_EVENT_THRESHOLD },
+
+	/* param_pressure_onset_rate_threshold */
+	{ param_type_u16, 0, 60000, PRESSURE_ONSET_RATE_THRESHOLD },
+
+	/* param_pressure_onset_rise_threshold */
+	{ param_type_u16, 1, 500, PRESSURE_ONSET_RISE_THRESHOLD },
+
+	/* param_pressure_rest_drift_threshold */
+	{ param_type_u16, 0, 500, PRESSURE_STATS_REST_DRIFT },
+
+	/* param_pressure_peak_fade_threshold */
+	{ param_type_u16, 0, 1500, PRESSURE_STATS_PEAK_FADE },
+
+	/* param_pressure_balance_drift_threshold */
+	{ param_type_u16, 0, 1000, PRESSURE_STATS_BALANCE_DRIFT }
+};
+
+//
+//	1.	Zero turns the periodic broadcast off, for a bus where every node
+//		that wants pressure subscribes (see `subscription.h'). The watchdog
+//		doesn't depend on it; the CAN task checks in from the bus monitor.
+//
+
+volatile uint16_t param_values[param_count];
+
+static volatile uint8_t dirty[(param_count + 7) / 8];
+
+param_status_t
+param_get_entry (param_id_t id, param_entry_t *entry)
+{
+	if (id >= param_count)
+		return param_status_unknown;
+
+	entry->type = pgm_read_byte (&param_table[id].type);
+	entry->min = pgm_read_word (&param_table[id].min);
+	entry->max = pgm_read_word (&param_table[id].max);
+	entry->def = pgm_read_word (&param_table[id].def);
+
+	return param_status_ok;
+}
+
+void
+param_init (void)
+{
+	param_entry_t	entry;
+	uint8_t			bytes[2];
+	uint16_t		value;
+	uint8_t			i;
+
+	for (i = 0; i < param_count; i++)
+	{
+		param_get_entry (i, &entry);
+		eeprom_read_many (PARAM_EEPROM_ADDR + 2 * i, bytes, 2);
+
+		value = (uint16_t)(bytes[0] << 8) | bytes[1];
+		param_values[i] = (value >= entry.min && value <= entry.max) ? value : entry.def;
+	}
+}
+
+param_status_t
+param_set (param_id_t id, uint16_t value)
+{
+	param_entry_t entry;
+
+	if (param_get_entry (id, &entry) != param_status_ok)
+		return param_status_unknown;
+
+	if (value < entry.min || value > entry.max)
+		return param_status_out_of_range;
+
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+	{
+		param_values[id] = value;
+		dirty[id / 8] |= 1 << (id % 8);
+	}
+
+	return param_status_ok;
+}
+
+void
+param_flush (void)
+{
+	uint8_t		bytes[2];
+	uint16_t	value;
+	uint8_t		i, pending;
+
+	if (!eeprom_is_ready ())
+		return;
+
+	for (i = 0; i < param_count; i++)
+	{
+		ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+		{
+			pending = dirty[i / 8] & (1 << (i % 8));
+			dirty[i / 8] &= ~(1 << (i % 8));
+			value = param_values[i];
+		}
+
+		if (!pending)
+			continue;
+
+		bytes[0] = (uint8_t)(value >> 8);
+		bytes[1] = (uint8_t)(value);
+
+		if (flush_bytes (PARAM_EEPROM_ADDR + 2 * i, bytes, 2))		/* 1 */
+		{
+			ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+			{
+				dirty[i / 8] |= 1 << (i % 8);
+			}
+
+			return;
+		}
+	}
+}
+
+//
+//	1.	At most one byte is written per call. The parameter is marked dirty
+//		again so the next call checks it once more; a parameter already
+//		stored as it is goes by without a write.
+//
+
+//
+//	Reply to a read or write with the parameter's current value.
+//
+
+static void
+param_send_value (uint8_t command, uint8_t id, param_status_t status)
+{
+	uint16_t	value = (status == param_status_unknown) ? 0 : param_get (id);
+	uint8_t		reply[5];
+
+	reply[0] = command;
+	reply[1] = id;
+	reply[2] = status;
+	reply[3] = (uint8_t)(value >> 8);
+	reply[4] = (uint8_t)(value);
+
+	service_send_reply (reply, 5);
+}
+
+void
+param_service_request (uint8_t *data)
+{
+	param_entry_t	entry;
+	param_status_t	status;
+	uint8_t			reply[8];
+	uint8_t			id = data[1];
+
+	switch (data[0])
+	{
+		case svc_cmd_param_read:
+
+			status = (id < param_count) ? param_status_ok : param_status_unknown;
+			param_send_value (data[0], id, status);
+
+			break;
+
+		case svc_cmd_param_write:
+
+			status = param_set (id, (uint16_t)(data[2] << 8) | data[3]);
+			param_send_value (data[0], id, status);
+
+			break;
+
+		case svc_cmd_param_info:
+
+			status = param_get_entry (id, &entry);
+
+			if (status != param_status_ok)
+				entry.type = entry.min = entry.max = 0;
+
+			reply[0] = data[0];
+			reply[1] = id;
+			reply[2] = status;
+			reply[3] = entry.type;
+			reply[4] = (uint8_t)(entry.min >> 8);
+			reply[5] = (uint8_t)(entry.min);
+			reply[6] = (uint8_t)(entry.max >> 8);
+			reply[7] = (uint8_t)(entry.max);
+
+			service_send_reply (reply, 8);
+
+			break;
+	}
+}
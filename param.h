@@ -0,0 +1,138 @@
+//
+//	param.h
+//	Runtime-tunable parameters, persisted in the eeprom.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#ifndef _PARAM_H
+#define _PARAM_H
+
+#include <inttypes.h>
+
+//
+//	Parameters are identified on the bus by their index in this list. New
+//	parameters go on the end so existing ids and eeprom slots don't move.
+//
+
+typedef enum param_id_t
+{
+	param_pressure_update_period		= 0x00,		/* ms */
+	param_pressure_broadcast_period		= 0x01,		/* ms */
+	param_pressure_calibration_min_diff	= 0x02,		/* psi */
+	param_pressure_fast_update_period	= 0x03,		/* ms */
+	param_pressure_fast_rate_threshold	= 0x04,		/* psi/s */
+	param_pressure_fast_level_threshold	= 0x05,		/* psi */
+	param_pressure_fast_quiet_period	= 0x06,		/* ms */
+	param_pressure_event_threshold		= 0x07,		/* psi */
+	param_pressure_onset_rate_threshold	= 0x08,		/* psi/s */
+	param_pressure_onset_rise_threshold	= 0x09,		/* psi */
+	param_pressure_rest_drift_threshold	= 0x0A,		/* psi */
+	param_pressure_peak_fade_threshold	= 0x0B,		/* psi */
+	param_pressure_balance_drift_threshold	= 0x0C,	/* 0.1% */
+	param_count
+}
+param_id_t;
+
+typedef enum param_type_t
+{
+	param_type_u8						= 0x00,
+	param_type_u16						= 0x01
+}
+param_type_t;
+
+typedef enum param_status_t
+{
+	param_status_ok						= 0x00,
+	param_status_unknown				= 0x01,		/* no such parameter */
+	param_status_out_of_range			= 0x02		/* value outside limits */
+}
+param_status_t;
+
+typedef struct param_entry_t
+{
+	uint8_t		type;				/* `param_type_t' */
+	uint16_t	min;
+	uint16_t	max;
+	uint16_t	def;				/* default */
+}
+param_entry_t;
+
+//
+//	Each parameter takes two bytes of eeprom, in id order, starting at the
+//	address below. An erased or out-of-range value loads as the default.
+//	There is room for 24 parameters before the pressure curves.
+//
+
+#define	PARAM_EEPROM_ADDR	0x10
+
+//
+//	Current values, indexed by `param_id_t'. Exposed so the periodic
+//	handlers can read them without a call; write them through `param_set'.
+//
+
+extern volatile uint16_t param_values[param_count];
+
+//
+//	Load every parameter from the eeprom, falling back to the default for
+//	any value that doesn't pass its limits.
+//
+
+void
+param_init (void);
+
+//
+//	Return the current value of parameter `id'.
+//
+
+static inline uint16_t
+param_get (param_id_t id)
+{
+	return param_values[id];
+}
+
+//
+//	Set parameter `id' to `value' if it passes the parameter's limits. The
+//	value takes effect immediately and is written to the eeprom later by
+//	`param_flush'. Safe to call from an interrupt.
+//
+
+param_status_t
+param_set
+(
+	param_id_t	id,
+	uint16_t	value
+);
+
+//
+//	Copy the table entry for parameter `id' into `entry'.
+//
+
+param_status_t
+param_get_entry
+(
+	param_id_t		id,
+	param_entry_t	*entry
+);
+
+//
+//	Write back at most one byte of the parameters changed since they were
+//	last stored, if the eeprom is ready (see `flush.h'). Never waits.
+//	Called from the idle state.
+//
+
+void
+param_flush (void);
+
+//
+//	Handle the parameter service request in `data' and send the reply.
+//	See `service.h' for the packet layout.
+//
+
+void
+param_service_request
+(
+	uint8_t	*data
+);
+
+#endif
@@ -5,6 +5,8 @@
 //
 
 #include <avr/io.h>
+#include <string.h>
+#include <util/atomic.h>
 
 #include "can.h"
 #include "can_config.h"
@@ -12,181 +14,1004 @@
 #include "eeprom.h"
 
 #include "adc.h"
+#include "diagnostic.h"
 #include "error.h"
+#include "flush.h"
+#include "param.h"
 #include "pressure.h"
+#include "startup.h"
 #include "state.h"
+#include "subscription.h"
+#include "timer.h"
 
-static volatile uint16_t front_pressure;
-static volatile uint16_t rear_pressure;
+//
+//	Per-channel state: the latest reading in psi, the sample it came from,
+//	the sensor curve, the calibration values, the rate filter and a new
+//	curve waiting to be stored.
+//
 
-static uint16_t front_min_pressure, front_max_pressure;
-static uint16_t rear_min_pressure, rear_max_pressure;
+#define	PRESSURE_CHANNEL_STATE(name, adc, convert, curve_addr, min_addr, max_addr, filter, mob, msg, tx) \
+	static volatile uint16_t name##_pressure;									\
+	static volatile uint16_t name##_sample;										\
+	static pressure_curve_t name##_curve;										\
+	static uint16_t name##_min_pressure, name##_max_pressure;					\
+	static uint16_t name##_filtered;											\
+	static uint8_t name##_curve_bytes[1 + 4 * PRESSURE_CURVE_MAX_POINTS];		\
+	static uint8_t name##_curve_length;		/* bytes waiting to be stored */	\
+	enum { name##_filter_shift = (filter) };
+
+PRESSURE_CHANNELS (PRESSURE_CHANNEL_STATE)
+
+#undef	PRESSURE_CHANNEL_STATE
+
+static uint8_t tmp_curve_points;
+static uint16_t tmp_front_curve_sample[PRESSURE_CURVE_MAX_POINTS];
+static uint16_t tmp_front_curve_psi[PRESSURE_CURVE_MAX_POINTS];
+static uint16_t tmp_rear_curve_sample[PRESSURE_CURVE_MAX_POINTS];
+static uint16_t tmp_rear_curve_psi[PRESSURE_CURVE_MAX_POINTS];
+static volatile uint16_t tmp_front_point_psi, tmp_rear_point_psi;
+
+static uint16_t tmp_front_min_pressure, tmp_front_max_pressure;
+static uint16_t tmp_rear_min_pressure, tmp_rear_max_pressure;
+
+static volatile uint8_t calibrated;
+static volatile uint8_t fast_mode;
+static volatile uint16_t update_period;
+
+static pressure_stats_t rest_stats[2], peak_stats[2], balance_stats;
+static uint8_t peak_histogram[2][PRESSURE_STATS_BINS];
+static uint8_t stats_alarms;
+
+static uint8_t event_active;
+static uint16_t event_peak_front, event_peak_rear, event_peak_level;
+static uint32_t event_duration, event_time_to_peak, event_integral;
+
+static uint8_t onset_armed = 1, onset_valid, onset_side;
+static uint16_t onset_rest[2], onset_last[2], onset_tick[2];	/* 1/16 psi, ms */
+static uint16_t onset_rate;
+static uint8_t onset_delay, onset_delay_max;
+
+static volatile uint8_t onset_pending;
+static pressure_event_frame_t event_frames[PRESSURE_EVENT_QUEUE_SIZE];
+static volatile uint8_t event_frame_head, event_frame_count;
+static uint32_t onset_time;
+static uint8_t onset_count;
+static uint16_t onset_latency, onset_latency_max;
+
+#define	PRESSURE_CHANNEL_BOOT(name, adc, convert, curve_addr, min_addr, max_addr, filter, mob, msg, tx) \
+	pressure_build_nominal_curve (&name##_curve);								\
+	name##_pressure = pressure_sample_##name##_sensor ();
 
-static volatile uint16_t tmp_front_min_pressure, tmp_front_max_pressure;
-static volatile uint16_t tmp_rear_min_pressure, tmp_rear_max_pressure;
+void
+pressure_boot (void)
+{
+	PRESSURE_CHANNELS (PRESSURE_CHANNEL_BOOT)
+
+	pressure_broadcast_pressure_readings ();
+}
+
+#undef	PRESSURE_CHANNEL_BOOT
+
+#define	PRESSURE_CHANNEL_INIT(name, adc, convert, curve_addr, min_addr, max_addr, filter, mob, msg, tx) \
+	pressure_load_##name##_calibration (&min, &max);							\
+	pressure_load_curve (curve_addr, &curve);									\
+																				\
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)											\
+	{																			\
+		name##_min_pressure = min;												\
+		name##_max_pressure = max;												\
+		memcpy (&name##_curve, &curve, sizeof (curve));							\
+	}
 
 void
 pressure_init (void)
 {
-	pressure_load_front_calibration
-		((uint16_t *)&front_min_pressure, (uint16_t *)&front_max_pressure);
+	static pressure_curve_t curve;		/* 1 */
+
+	uint16_t min, max;
+
+	PRESSURE_CHANNELS (PRESSURE_CHANNEL_INIT)
 
-	pressure_load_rear_calibration
-		((uint16_t *)&rear_min_pressure, (uint16_t *)&rear_max_pressure);
+	calibrated = 1;
 }
 
-uint16_t
-pressure_sample_front_sensor (void)
+#undef	PRESSURE_CHANNEL_INIT
+
+//
+//	1.	The curves are built on the side and copied in with interrupts off,
+//		since the periodic handler is already sampling through them.
+//
+
+#define	PRESSURE_CHANNEL_SELF_TEST(name, adc, convert, curve_addr, min_addr, max_addr, filter, mob, msg, tx) \
+	if (name##_sample >= max_sample)											\
+		failed |= PRESSURE_CHANNEL_BIT (name);
+
+uint8_t
+pressure_self_test (uint16_t max_sample)
 {
-	uint16_t sample, psi;
+	uint8_t failed = 0;
+
+	PRESSURE_CHANNELS (PRESSURE_CHANNEL_SELF_TEST)
 
-	sample = adc_get_sample (adc_chan_front_pressure);
-	psi = pressure_convert_sample_to_psi (sample);
+	return failed;
+}
 
-	return psi;
+#undef	PRESSURE_CHANNEL_SELF_TEST
+
+#define	PRESSURE_CHANNEL_FUNCTIONS(name, adc, convert, curve_addr, min_addr, max_addr, filter, mob, msg, tx) \
+																				\
+uint16_t																		\
+pressure_sample_##name##_sensor (void)											\
+{																				\
+	uint16_t fine, psi;															\
+																				\
+	fine = adc_range_get_sample (adc);											\
+	psi = convert (&name##_curve, fine);										\
+																				\
+	name##_sample = (fine + (1 << (ADC_FINE_SHIFT - 1))) >> ADC_FINE_SHIFT;		\
+																				\
+	return psi;																	\
+}																				\
+																				\
+void																			\
+pressure_load_##name##_calibration (uint16_t *min, uint16_t *max)				\
+{																				\
+	uint8_t	min_bytes[2], max_bytes[2];											\
+																				\
+	eeprom_read_many (min_addr, min_bytes, 2);									\
+	eeprom_read_many (max_addr, max_bytes, 2);									\
+																				\
+	*min = (uint16_t)(min_bytes[0] << 8) | min_bytes[1];						\
+	*max = (uint16_t)(max_bytes[0] << 8) | max_bytes[1];						\
+}																				\
+																				\
+void																			\
+pressure_store_##name##_calibration (uint16_t min, uint16_t max)				\
+{																				\
+	uint8_t	min_bytes[2], max_bytes[2];											\
+																				\
+	min_bytes[0] = (uint8_t)(min >> 8);											\
+	min_bytes[1] = (uint8_t)(min);												\
+																				\
+	max_bytes[0] = (uint8_t)(max >> 8);											\
+	max_bytes[1] = (uint8_t)(max);												\
+																				\
+	eeprom_write_many (min_addr, min_bytes, 2);									\
+	eeprom_write_many (max_addr, max_bytes, 2);									\
 }
 
-uint16_t
-pressure_sample_rear_sensor (void)
+PRESSURE_CHANNELS (PRESSURE_CHANNEL_FUNCTIONS)
+
+#undef	PRESSURE_CHANNEL_FUNCTIONS
+
+void
+pressure_load_curve (pressure_eeprom_addr_t addr, pressure_curve_t *curve)
 {
-	uint16_t sample, psi;
+	uint8_t		bytes[1 + 4 * PRESSURE_CURVE_MAX_POINTS];
+	uint16_t	sample[PRESSURE_CURVE_MAX_POINTS], psi[PRESSURE_CURVE_MAX_POINTS];
+	uint8_t		i, points;
+
+	eeprom_read_many (addr, bytes, sizeof (bytes));
+	points = bytes[0];
 
-	sample = adc_get_sample (adc_chan_rear_pressure);
-	psi = pressure_convert_sample_to_psi (sample);
+	for (i = 0; i < points && i < PRESSURE_CURVE_MAX_POINTS; i++)
+	{
+		sample[i] = (uint16_t)(bytes[1 + 4 * i] << 8) | bytes[2 + 4 * i];
+		psi[i] = (uint16_t)(bytes[3 + 4 * i] << 8) | bytes[4 + 4 * i];
+	}
 
-	return psi;
+	if (!pressure_build_curve (curve, points, sample, psi))
+		pressure_build_nominal_curve (curve);
 }
 
-uint16_t
-pressure_convert_sample_to_psi (uint16_t sample)
+uint8_t
+pressure_pack_curve (uint8_t *bytes, uint8_t points, const uint16_t *sample,
+	const uint16_t *psi)
 {
-	uint32_t converted;
+	uint8_t i;
+
+	bytes[0] = points;
+
+	for (i = 0; i < points; i++)
+	{
+		bytes[1 + 4 * i] = (uint8_t)(sample[i] >> 8);
+		bytes[2 + 4 * i] = (uint8_t)(sample[i]);
+		bytes[3 + 4 * i] = (uint8_t)(psi[i] >> 8);
+		bytes[4 + 4 * i] = (uint8_t)(psi[i]);
+	}
 
-	converted = (uint32_t)sample * PSI_PER_VOLT * 5 / 1024; /* 1 */
-	return (uint16_t)converted;
+	return 1 + 4 * points;
 }
 
-//
-//	1.	The full-scale voltage is 5V, and the range of the ADC is 2^10.
-//
+#define	PRESSURE_CHANNEL_FLUSH(name, adc, convert, curve_addr, min_addr, max_addr, filter, mob, msg, tx) \
+	if (name##_curve_length)													\
+	{																			\
+		if (flush_bytes (curve_addr, name##_curve_bytes, name##_curve_length))	\
+			return;																\
+																				\
+		name##_curve_length = 0;												\
+	}
 
 void
-pressure_load_front_calibration (uint16_t *min, uint16_t *max)
+pressure_flush (void)
 {
-	uint8_t	min_bytes[2], max_bytes[2];
+	PRESSURE_CHANNELS (PRESSURE_CHANNEL_FLUSH)
+}
 
-	eeprom_read_many (front_min_pressure_addr, min_bytes, 2);
-	eeprom_read_many (front_max_pressure_addr, max_bytes, 2);
+#undef	PRESSURE_CHANNEL_FLUSH
 
-	front_min_pressure = (uint16_t)(min_bytes[0] << 8) | min_bytes[1];
-	front_max_pressure = (uint16_t)(max_bytes[0] << 8) | max_bytes[1];
+void
+pressure_broadcast_pressure_readings (void)
+{
+	pressure_send_pressure_readings (PRESSURE_CHANNEL_ALL);
 }
 
+#define	PRESSURE_CHANNEL_SEND(name, adc, convert, curve_addr, min_addr, max_addr, filter, mob, msg, tx) \
+	if (channels & PRESSURE_CHANNEL_BIT (name))									\
+	{																			\
+		data[0] = (uint8_t)(name##_pressure >> 8);								\
+		data[1] = (uint8_t)(name##_pressure);									\
+		data[2] = (uint8_t)(name##_min_pressure >> 8);							\
+		data[3] = (uint8_t)(name##_min_pressure);								\
+		data[4] = (uint8_t)(name##_max_pressure >> 8);							\
+		data[5] = (uint8_t)(name##_max_pressure);								\
+		data[6] = status;														\
+																				\
+		can_load_data (mob, data, 7);											\
+		can_ready_to_send (mob);												\
+	}
+
 void
-pressure_load_rear_calibration (uint16_t *min, uint16_t *max)
+pressure_send_pressure_readings (uint8_t channels)
+{
+	uint8_t data[7];
+	uint8_t status;
+
+	status = (update_period > PRESSURE_STATUS_PERIOD_MASK) ?
+		PRESSURE_STATUS_PERIOD_MASK : update_period;
+
+	if (fast_mode)
+		status |= PRESSURE_STATUS_FAST_MODE;
+
+	if (!calibrated)
+		status |= PRESSURE_STATUS_UNCALIBRATED;
+
+	PRESSURE_CHANNELS (PRESSURE_CHANNEL_SEND)
+}
+
+#undef	PRESSURE_CHANNEL_SEND
+
+//
+//	Run `psi' through the first-order filter at `filtered' (in 1/16 psi),
+//	moving 1/2^`shift' of the way, and return how far the filtered value
+//	moved. The shift is always a channel's constant.
+//
+
+static inline uint16_t
+pressure_filter (uint16_t *filtered, uint16_t psi, uint8_t shift)
+{
+	uint16_t previous = *filtered;
+
+	*filtered += (int16_t)((psi << 4) - previous) >> shift;
+	return (*filtered > previous) ? *filtered - previous : previous - *filtered;
+}
+
+//
+//	Choose the sample rate from the latest readings, taken `period' ms
+//	after the previous ones. Fast mode is entered as soon as the filtered
+//	rate of change or the level crosses its threshold, and left once both
+//	have stayed under half of their thresholds for the quiet period.
+//
+
+static void
+pressure_update_rate (uint16_t front, uint16_t rear, uint16_t period)
+{
+	static uint16_t quiet_ticks = 0;
+
+	uint16_t	front_delta, rear_delta, level;
+	uint32_t	rate, rate_threshold;
+	uint16_t	level_threshold;
+
+	front_delta = pressure_filter (&front_filtered, front, front_filter_shift);
+	rear_delta = pressure_filter (&rear_filtered, rear, rear_filter_shift);
+
+	rate = (uint32_t)((front_delta > rear_delta) ? front_delta : rear_delta) * 1000;	/* 1 */
+	rate_threshold = (uint32_t)param_values[param_pressure_fast_rate_threshold] * 16 * period;
+
+	level = (front > rear) ? front : rear;
+	level_threshold = param_values[param_pressure_fast_level_threshold];
+
+	if (rate > rate_threshold || level > level_threshold)
+	{
+		fast_mode = 1;
+		quiet_ticks = 0;
+	}
+	else if (rate > rate_threshold / 2 || level > level_threshold / 2)
+	{
+		quiet_ticks = 0;
+	}
+	else if (fast_mode)
+	{
+		quiet_ticks += period;
+
+		if (quiet_ticks >= param_values[param_pressure_fast_quiet_period])
+			fast_mode = 0;
+	}
+}
+
+//
+//	1.	Both sides are scaled by 16 * `period' / 1000 to compare psi/s
+//		against the filter's 1/16 psi per sample without dividing.
+//
+
+//
+//	Divide `a' by `n', rounding to the nearest.
+//
+
+static int32_t
+pressure_stats_divide (int32_t a, uint16_t n)
+{
+	return ((a < 0) ? a - n / 2 : a + n / 2) / n;
+}
+
+//
+//	Add `x' to the running mean and variance at `stats', whose count stops
+//	at `window'.
+//
+
+static void
+pressure_stats_add (pressure_stats_t *stats, uint16_t x, uint16_t window)
+{
+	int32_t delta, delta2;
+
+	if (stats->count < window)
+		stats->count++;
+
+	delta = ((int32_t)x << 8) - stats->mean;
+	stats->mean += pressure_stats_divide (delta, stats->count);
+	delta2 = ((int32_t)x << 8) - stats->mean;
+
+	stats->var += pressure_stats_divide ((delta >> 4) * (delta2 >> 4) - stats->var, stats->count);	/* 1 */
+
+	if (!stats->baselined && stats->count == window)
+	{
+		stats->baseline = stats->mean;
+		stats->baselined = 1;
+	}
+}
+
+//
+//	1.	The deviations are taken down to 4 fractional bits so the product
+//		fits, for anything up to 2048. Both have the same sign, so the
+//		product is never negative.
+//
+
+//
+//	Return the standard deviation at `stats', with 4 fractional bits.
+//
+
+static uint16_t
+pressure_stats_deviation (const pressure_stats_t *stats)
+{
+	uint32_t	var = stats->var;
+	uint32_t	root = 0, bit = 1UL << 30;
+
+	while (bit > var)
+		bit >>= 2;
+
+	while (bit)
+	{
+		if (var >= root + bit)
+		{
+			var -= root + bit;
+			root = (root >> 1) + bit;
+		}
+		else
+		{
+			root >>= 1;
+		}
+
+		bit >>= 2;
+	}
+
+	return (root > UINT16_MAX) ? UINT16_MAX : root;
+}
+
+//
+//	Add the readings to the resting level, once the brakes have been
+//	quiet long enough to leave fast mode.
+//
+
+static void
+pressure_update_rest_stats (uint16_t front, uint16_t rear)
+{
+	if (event_active || fast_mode)
+		return;
+
+	pressure_stats_add (&rest_stats[0], front, PRESSURE_STATS_REST_WINDOW);
+	pressure_stats_add (&rest_stats[1], rear, PRESSURE_STATS_REST_WINDOW);
+}
+
+//
+//	Count the peak `psi' in the histogram `histogram'.
+//
+
+static void
+pressure_histogram_add (uint8_t *histogram, uint16_t psi)
+{
+	uint8_t bin = psi / PRESSURE_STATS_BIN_WIDTH;
+	uint8_t i;
+
+	if (bin >= PRESSURE_STATS_BINS)
+		bin = PRESSURE_STATS_BINS - 1;
+
+	if (histogram[bin] == UINT8_MAX)
+	{
+		for (i = 0; i < PRESSURE_STATS_BINS; i++)
+			histogram[i] >>= 1;
+	}
+
+	histogram[bin]++;
+}
+
+//
+//	Add the peaks of the application that just ended to the statistics.
+//
+
+static void
+pressure_update_peak_stats (void)
 {
-	uint8_t	min_bytes[2], max_bytes[2];
+	uint16_t total = event_peak_front + event_peak_rear;
+
+	pressure_stats_add (&peak_stats[0], event_peak_front, PRESSURE_STATS_PEAK_WINDOW);
+	pressure_stats_add (&peak_stats[1], event_peak_rear, PRESSURE_STATS_PEAK_WINDOW);
+
+	pressure_histogram_add (peak_histogram[0], event_peak_front);
+	pressure_histogram_add (peak_histogram[1], event_peak_rear);
+
+	if (total)
+	{
+		pressure_stats_add (&balance_stats, (uint32_t)event_peak_front * 1000 / total,
+			PRESSURE_STATS_PEAK_WINDOW);
+	}
+}
+
+//
+//	Raise error `error_code' once `drift' (24.8) reaches `threshold', and
+//	re-arm alarm bit `alarm' once it is back under half of it.
+//
+
+static void
+pressure_check_stats_alarm (uint8_t alarm, int32_t drift, uint16_t threshold, err_code_t error_code)
+{
+	if (!threshold || drift < ((int32_t)threshold << 7))
+	{
+		stats_alarms &= ~alarm;
+	}
+	else if (drift >= ((int32_t)threshold << 8) && !(stats_alarms & alarm))
+	{
+		stats_alarms |= alarm;
+
+		error_set_error_code (error_code);
+		error_broadcast_error_code (err_sev_recoverable, error_code);
+	}
+}
+
+//
+//	Check each statistic against its baseline.
+//
+
+static void
+pressure_check_stats_alarms (void)
+{
+	uint8_t	i;
+	int32_t	drift;
+
+	for (i = 0; i < 2; i++)
+	{
+		if (rest_stats[i].baselined)
+		{
+			drift = rest_stats[i].mean - rest_stats[i].baseline;
+
+			pressure_check_stats_alarm (0x01 << i, (drift < 0) ? -drift : drift,
+				param_values[param_pressure_rest_drift_threshold], err_stats_rest_drift);
+		}
+
+		if (peak_stats[i].baselined)
+		{
+			pressure_check_stats_alarm (0x04 << i, peak_stats[i].baseline - peak_stats[i].mean,
+				param_values[param_pressure_peak_fade_threshold], err_stats_fade);
+		}
+	}
 
-	eeprom_read_many (rear_min_pressure_addr, min_bytes, 2);
-	eeprom_read_many (rear_max_pressure_addr, max_bytes, 2);
+	if (balance_stats.baselined)
+	{
+		drift = balance_stats.mean - balance_stats.baseline;
 
-	rear_min_pressure = (uint16_t)(min_bytes[0] << 8) | min_bytes[1];
-	rear_max_pressure = (uint16_t)(max_bytes[0] << 8) | max_bytes[1];
+		pressure_check_stats_alarm (0x10, (drift < 0) ? -drift : drift,
+			param_values[param_pressure_balance_drift_threshold], err_stats_balance_drift);
+	}
+}
+
+//
+//	Return `value' saturated to 8 bits.
+//
+
+static uint8_t
+pressure_saturate (uint16_t value)
+{
+	return (value > UINT8_MAX) ? UINT8_MAX : value;
 }
 
 void
-pressure_store_front_calibration (uint16_t min, uint16_t max)
+pressure_broadcast_stats_report (pressure_stats_frame_t frame)
+{
+	uint8_t		data[8];
+	uint8_t		side = (frame == stats_frame_rear || frame == stats_frame_rear_histogram);
+	uint16_t	value;
+	uint8_t		i;
+
+	data[0] = diag_id_stats_report;
+	data[1] = frame;
+
+	switch (frame)
+	{
+		case stats_frame_front:
+		case stats_frame_rear:
+
+			value = (rest_stats[side].mean + 8) >> 4;
+			data[2] = (uint8_t)(value >> 8);
+			data[3] = (uint8_t)(value);
+			data[4] = pressure_saturate (pressure_stats_deviation (&rest_stats[side]));
+
+			value = (peak_stats[side].mean + 128) >> 8;
+			data[5] = (uint8_t)(value >> 8);
+			data[6] = (uint8_t)(value);
+			data[7] = pressure_saturate ((pressure_stats_deviation (&peak_stats[side]) + 8) >> 4);
+
+			break;
+
+		case stats_frame_balance:
+
+			value = (balance_stats.mean + 128) >> 8;
+			data[2] = (uint8_t)(value >> 8);
+			data[3] = (uint8_t)(value);
+
+			value = balance_stats.baselined ? (balance_stats.baseline + 128) >> 8 : 0xFFFF;
+			data[4] = (uint8_t)(value >> 8);
+			data[5] = (uint8_t)(value);
+
+			data[6] = pressure_saturate ((pressure_stats_deviation (&balance_stats) + 8) >> 4);
+			data[7] = stats_alarms;
+
+			break;
+
+		default:
+
+			for (i = 0; i < PRESSURE_STATS_BINS; i++)
+				data[2 + i] = peak_histogram[side][i];
+
+			break;
+	}
+
+	diagnostic_send (data, 8);
+}
+
+//
+//	Track a brake application from the latest readings, taken `period' ms
+//	after the previous ones. The event starts when either side crosses the
+//	threshold and ends when both fall below half of it. The summary packet
+//	is sent at the end.
+//
+
+static void
+pressure_update_event (uint16_t front, uint16_t rear, uint16_t period)
 {
-	uint8_t	min_bytes[2], max_bytes[2];
+	uint16_t level = (front > rear) ? front : rear;
+	uint16_t threshold = param_values[param_pressure_event_threshold];
+
+	if (!event_active)
+	{
+		if (level <= threshold)
+			return;
+
+		event_active = 1;
+		event_duration = 0;
+		event_time_to_peak = 0;
+		event_integral = 0;
+		event_peak_front = front;
+		event_peak_rear = rear;
+		event_peak_level = level;
+
+		return;
+	}
+
+	event_duration += period;
+	event_integral += (uint32_t)(front + rear) * period;
 
-	min_bytes[0] = (uint8_t)(front_min_pressure >> 8);
-	min_bytes[1] = (uint8_t)(front_min_pressure);
+	if (front > event_peak_front)
+		event_peak_front = front;
 
-	max_bytes[0] = (uint8_t)(front_max_pressure >> 8);
-	max_bytes[1] = (uint8_t)(front_max_pressure);
+	if (rear > event_peak_rear)
+		event_peak_rear = rear;
 
-	eeprom_write_many (front_min_pressure_addr, min_bytes, 2);
-	eeprom_write_many (front_max_pressure_addr, max_bytes, 2);
+	if (level > event_peak_level)
+	{
+		event_peak_level = level;
+		event_time_to_peak = event_duration;
+	}
+
+	if (level < threshold / 2)
+	{
+		event_active = 0;
+		pressure_broadcast_brake_summary ();
+		pressure_update_peak_stats ();
+	}
 }
 
+//
+//	Feed the latest reading `psi' from side `side' (0 front, 1 rear) to the
+//	onset detector. Return 1 if it marks the onset of braking.
+//
+
+static uint8_t
+pressure_update_onset (uint8_t side, uint16_t psi)
+{
+	uint16_t	value = psi << 4;
+	uint16_t	now = (uint16_t)timer_get_ticks ();
+	uint16_t	dt, rate_threshold, rise_threshold;
+	int32_t		rise, excess;
+
+	dt = now - onset_tick[side];
+	onset_tick[side] = now;
+
+	if (dt == 0)
+		dt = 1;		/* 1 */
+
+	if (!(onset_valid & _BV (side)))
+	{
+		onset_valid |= _BV (side);
+		onset_rest[side] = onset_last[side] = value;
+
+		return 0;
+	}
+
+	rise = (int32_t)value - onset_last[side];
+	excess = (int32_t)value - onset_rest[side];
+	onset_last[side] = value;
+
+	if (!onset_armed)
+		return 0;
+
+	rate_threshold = param_values[param_pressure_onset_rate_threshold];
+	rise_threshold = param_values[param_pressure_onset_rise_threshold] << 4;
+
+	if
+	(
+		rate_threshold && rise > 0 && excess > rise_threshold &&
+		(uint32_t)rise * 1000 > (uint32_t)rate_threshold * 16 * dt		/* 2 */
+	)
+	{
+		rise = rise * 1000 / (16L * dt);
+		onset_rate = (rise > 0xFFFF) ? 0xFFFF : rise;
+
+		excess = excess * 1000 / 16 / onset_rate;					/* 3 */
+		onset_delay = (excess > 0xFF) ? 0xFF : excess;
+
+		return 1;
+	}
+
+	if (rise <= 0)
+		onset_rest[side] += (int16_t)(value - onset_rest[side]) >> PRESSURE_ONSET_REST_SHIFT;
+
+	return 0;
+}
+
+//
+//	1.	Two readings in the same tick, or a whole wrap of the 16 bit tick
+//		count apart, would otherwise divide by zero below.
+//
+//	2.	Scaled the same way as in `pressure_update_rate'.
+//
+//	3.	Assume the rise started from rest at the rate just measured.
+//
+
+//
+//	Set the brake event message object up with the ID of the packet at the
+//	head of the queue, and send it. Interrupts must be off.
+//
+
+static void
+pressure_send_brake_event_head (void)
+{
+	pressure_event_frame_t	*frame = &event_frames[event_frame_head];
+	mob_config_t			mob_config;
+
+	mob_config.id_type = standard;
+	mob_config.id = frame->id;
+	mob_config.mask = 0x7FF;
+	mob_config.rx_callback_ptr = 0;
+	mob_config.tx_callback_ptr = pressure_brake_event_tx_callback;
+
+	can_config_mob (mob_out_brake_event, &mob_config);
+	can_load_data (mob_out_brake_event, frame->data, frame->length);
+	can_ready_to_send (mob_out_brake_event);
+}
+
+//
+//	Send `length' bytes in `data' on the brake event message object, with
+//	message id `id'. The onset and summary packets use different IDs on the
+//	one message object, so it is only set up again once the packet before
+//	has gone out (1).
+//
+
+static void
+pressure_send_brake_event (uint16_t id, uint8_t *data, uint8_t length)
+{
+	pressure_event_frame_t *frame;
+
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+	{
+		if (event_frame_count == PRESSURE_EVENT_QUEUE_SIZE)
+			return;
+
+		frame = &event_frames[(event_frame_head + event_frame_count) % PRESSURE_EVENT_QUEUE_SIZE];
+		frame->id = id;
+		frame->length = length;
+		memcpy (frame->data, data, length);
+
+		if (event_frame_count++ == 0)
+			pressure_send_brake_event_head ();
+	}
+}
+
+//
+//	1.	A short application can end before its onset packet has won the
+//		bus, so the summary waits behind it in the queue. Setting the
+//		message object up again while a packet was waiting would drop the
+//		packet or send it with the wrong ID.
+//
+
 void
-pressure_store_rear_calibration (uint16_t min, uint16_t max)
+pressure_restart_brake_events (void)
 {
-	uint8_t	min_bytes[2], max_bytes[2];
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+	{
+		if (event_frame_count)
+			pressure_send_brake_event_head ();
+	}
+}
 
-	min_bytes[0] = (uint8_t)(rear_min_pressure >> 8);
-	min_bytes[1] = (uint8_t)(rear_min_pressure);
+void
+pressure_broadcast_brake_onset (void)
+{
+	uint8_t		data[7];
+	uint16_t	front = onset_last[0] >> 4;
+	uint16_t	rear = onset_last[1] >> 4;
+
+	data[0] = (uint8_t)(front >> 8);
+	data[1] = (uint8_t)(front);
+	data[2] = (uint8_t)(rear >> 8);
+	data[3] = (uint8_t)(rear);
+	data[4] = (uint8_t)(onset_rate >> 8);
+	data[5] = (uint8_t)(onset_rate);
+	data[6] = onset_delay;
+
+	onset_time = timer_get_timestamp ();
+	onset_pending = 1;
+
+	pressure_send_brake_event (EVENT_ID (event_id_brake_onset), data, 7);
+}
 
-	max_bytes[0] = (uint8_t)(rear_max_pressure >> 8);
-	max_bytes[1] = (uint8_t)(rear_max_pressure);
+void
+pressure_broadcast_onset_report (void)
+{
+	uint8_t data[8];
+
+	data[0] = diag_id_onset_report;
+	data[1] = onset_count;
+	data[2] = (uint8_t)(onset_latency >> 8);
+	data[3] = (uint8_t)(onset_latency);
+	data[4] = (uint8_t)(onset_latency_max >> 8);
+	data[5] = (uint8_t)(onset_latency_max);
+	data[6] = onset_delay;
+	data[7] = onset_delay_max;
+
+	diagnostic_send (data, 8);
+}
 
-	eeprom_write_many (rear_min_pressure_addr, min_bytes, 2);
-	eeprom_write_many (rear_max_pressure_addr, max_bytes, 2);
+void
+pressure_readings_tx_callback (uint8_t mob_index, uint32_t id, packet_type_t type)
+{
+	startup_frame_sent ();
 }
 
 void
-pressure_broadcast_pressure_readings (void)
+pressure_brake_event_tx_callback (uint8_t mob_index, uint32_t id, packet_type_t type)
 {
-	uint8_t front_data[6], rear_data[6];
+	uint32_t	latency;
+	uint16_t	sent_id;
+
+	if (!event_frame_count)
+		return;
+
+	sent_id = event_frames[event_frame_head].id;
+	event_frame_head = (event_frame_head + 1) % PRESSURE_EVENT_QUEUE_SIZE;
+
+	if (--event_frame_count)
+		pressure_send_brake_event_head ();
+
+	if (!onset_pending || sent_id != EVENT_ID (event_id_brake_onset))
+		return;
+
+	onset_pending = 0;
+	latency = timer_get_timestamp () - onset_time;
 
-	front_data[0] = (uint8_t)(front_pressure >> 8);
-	front_data[1] = (uint8_t)(front_pressure);
-	front_data[2] = (uint8_t)(front_min_pressure >> 8);
-	front_data[3] = (uint8_t)(front_min_pressure);
-	front_data[4] = (uint8_t)(front_max_pressure >> 8);
-	front_data[5] = (uint8_t)(front_max_pressure);
+	onset_latency = (latency > 0xFFFF) ? 0xFFFF : latency;
 
-	rear_data[0] = (uint8_t)(rear_pressure >> 8);
-	rear_data[1] = (uint8_t)(rear_pressure);
-	rear_data[2] = (uint8_t)(rear_min_pressure >> 8);
-	rear_data[3] = (uint8_t)(rear_min_pressure);
-	rear_data[4] = (uint8_t)(rear_max_pressure >> 8);
-	rear_data[5] = (uint8_t)(rear_max_pressure);
+	if (onset_latency > onset_latency_max)
+		onset_latency_max = onset_latency;
 
-	can_load_data (mob_out_pressure_front, front_data, 6);
-	can_ready_to_send (mob_out_pressure_front);
+	if (onset_count < 0xFF)
+		onset_count++;
 
-	can_load_data (mob_out_pressure_rear, rear_data, 6);
-	can_ready_to_send (mob_out_pressure_rear);
+	pressure_broadcast_onset_report ();
 }
 
+void
+pressure_broadcast_brake_summary (void)
+{
+	uint8_t		data[8];
+	uint32_t	integral;
+	uint16_t	duration, time_to_peak;
+
+	duration = (event_duration > 0xFFFF) ? 0xFFFF : event_duration;
+	time_to_peak = event_time_to_peak / 4;
+	time_to_peak = (time_to_peak > 0xFF) ? 0xFF : time_to_peak;
+
+	integral = (event_integral + 500) / 1000;
+	integral = (integral > 0xFFFF) ? 0xFFFF : integral;
+
+	data[0] = (uint8_t)(duration >> 8);
+	data[1] = (uint8_t)(duration);
+	data[2] = (uint8_t)(integral >> 8);
+	data[3] = (uint8_t)(integral);
+	data[4] = (uint8_t)(event_peak_front >> 4);
+	data[5] = (uint8_t)(event_peak_front << 4) | ((event_peak_rear >> 8) & 0x0F);
+	data[6] = (uint8_t)(event_peak_rear);
+	data[7] = (uint8_t)(time_to_peak);
+
+	pressure_send_brake_event ((MODULE_ID << 8) | msg_id_brake_summary, data, 8);
+}
+
+#define	PRESSURE_CHANNEL_SAMPLE(name, adc, convert, curve_addr, min_addr, max_addr, filter, mob, msg, tx) \
+	psi[pressure_channel_##name] = name##_pressure = pressure_sample_##name##_sensor ();
+
 void
 pressure_periodic_interrupt_handler (void)
 {
 	static uint16_t update_ticks = 0;
 	static uint16_t broadcast_ticks = 0;
+	static uint16_t stats_ticks = PRESSURE_STATS_PERIOD;
+	static uint8_t stats_frame = 0;
+
+	uint16_t	psi[pressure_channel_count];
+	uint16_t	rise_threshold, subscription_period;
+	uint8_t		onset = 0;
+
+	if (!update_ticks || !--update_ticks)	/* 1 */
+	{
+		if (param_values[param_pressure_update_period])
+		{
+			PRESSURE_CHANNELS (PRESSURE_CHANNEL_SAMPLE)
+
+			onset = pressure_update_onset (0, front_pressure);
+			onset |= pressure_update_onset (1, rear_pressure);
+
+			if (update_period)
+			{
+				pressure_update_rate (front_pressure, rear_pressure, update_period);
+				pressure_update_event (front_pressure, rear_pressure, update_period);
+				pressure_update_rest_stats (front_pressure, rear_pressure);
+			}
+
+			subscription_update (psi);
+		}
+
+		update_period = fast_mode ?
+			param_values[param_pressure_fast_update_period] :
+			param_values[param_pressure_update_period];
+
+		subscription_period = subscription_get_period ();
+
+		if (subscription_period && subscription_period < update_period)	/* 3 */
+			update_period = subscription_period;
+
+		update_ticks = update_period;
+	}
+	else if (param_values[param_pressure_onset_rate_threshold] && onset_armed)	/* 2 */
+	{
+		onset_side ^= 1;
+
+		onset = pressure_update_onset (onset_side, onset_side ?
+			pressure_sample_rear_sensor () : pressure_sample_front_sensor ());
+	}
 
-	if (PRESSURE_UPDATE_PERIOD && (++update_ticks == PRESSURE_UPDATE_PERIOD))
+	if (onset)
+	{
+		onset_armed = 0;
+		fast_mode = 1;
+
+		if (onset_delay > onset_delay_max)
+			onset_delay_max = onset_delay;
+
+		pressure_broadcast_brake_onset ();
+	}
+	else if (!onset_armed)
 	{
-		front_pressure = pressure_sample_front_sensor ();
-		rear_pressure = pressure_sample_rear_sensor ();
-		update_ticks = 0;
+		rise_threshold = param_values[param_pressure_onset_rise_threshold] << 3;
+
+		if
+		(
+			(int16_t)(onset_last[0] - onset_rest[0]) < (int16_t)rise_threshold &&
+			(int16_t)(onset_last[1] - onset_rest[1]) < (int16_t)rise_threshold
+		)
+			onset_armed = 1;
 	}
 
-	if (PRESSURE_BROADCAST_PERIOD && (++broadcast_ticks == PRESSURE_BROADCAST_PERIOD))
+	if (!broadcast_ticks || !--broadcast_ticks)
 	{
-		pressure_broadcast_pressure_readings ();
-		broadcast_ticks = 0;
+		broadcast_ticks = param_values[param_pressure_broadcast_period];
+
+		if (broadcast_ticks)
+			pressure_broadcast_pressure_readings ();
+	}
+
+	if (!--stats_ticks)
+	{
+		stats_ticks = PRESSURE_STATS_PERIOD;
+
+		pressure_check_stats_alarms ();
+		pressure_broadcast_stats_report (stats_frame);
+
+		if (++stats_frame == stats_frame_count)
+			stats_frame = 0;
 	}
 }
 
+//
+//	1.	The counters run down and are only reloaded from the parameter table
+//		when they expire, so a new period takes effect at the end of the
+//		current one. A zero period leaves the counter at zero, which just
+//		rereads the parameter each tick until it's turned back on.
+//
+//	2.	Between regular updates, one sensor is sampled per tick for the
+//		onset detector while it is armed. That is one more conversion (about
+//		100 us) per tick, and only until braking starts; by then fast mode
+//		samples both sides every tick anyway.
+//
+//	3.	Sampling is never slower than the fastest subscriber wants, so each
+//		of its frames carries a new reading.
+//
+
+#undef	PRESSURE_CHANNEL_SAMPLE
+
 void
 pressure_calibration_rx_callback (uint8_t mob_index, uint32_t id, packet_type_t type)
 {
-	pcal_msg_t 	message;
+	uint8_t 	data[8];
 	state_t		current_state;
 
-	can_read_data (mob_index, (uint8_t *)&message, 1);
+	can_read_data (mob_index, data, 8);
 	current_state = state_get_current_state ();
 
-	switch (command)
+	switch (data[0])
 	{
 		case pcal_msg_begin_calibration:
 
 			if (current_state != state_idle)
 			{
-				error_set_error_code (err_cmd_unexpected);
-				state_isr_transition (state_error_recoverable);
+				error_raise_from_isr (err_cmd_unexpected);
 			}
 			else
 			{
@@ -203,15 +1028,17 @@ pressure_calibration_rx_callback (uint8_t mob_index, uint32_t id, packet_type_t
 				current_state != state_pcal_wait_min 		&&
 				current_state != state_pcal_sample_min 		&&
 				current_state != state_pcal_request_max 	&&
-				current_state != state_pcal_wait_max
+				current_state != state_pcal_wait_max 		&&
+				current_state != state_pcal_request_point 	&&
+				current_state != state_pcal_wait_point 		&&
+				current_state != state_pcal_sample_point
 			)
 			{
-				error_set_error_code (err_cmd_unexpected);
-				state_isr_request_new_state (state_error_recoverable);
+				error_raise_from_isr (err_cmd_unexpected);
 			}
 			else
 			{
-				state_isr_request_new_state (state_pcal_abort);
+				state_isr_transition (state_pcal_abort);
 			}
 
 			break;
@@ -220,12 +1047,11 @@ pressure_calibration_rx_callback (uint8_t mob_index, uint32_t id, packet_type_t
 
 			if (current_state != state_pcal_wait_min)
 			{
-				error_set_error_code (err_cmd_unexpected);
-				state_isr_request_new_state (state_error_recoverable);
+				error_raise_from_isr (err_cmd_unexpected);
 			}
 			else
 			{
-				state_isr_request_new_state (state_pcal_sample_min);
+				state_isr_transition (state_pcal_sample_min);
 			}
 
 			break;
@@ -234,20 +1060,60 @@ pressure_calibration_rx_callback (uint8_t mob_index, uint32_t id, packet_type_t
 
 			if (current_state != state_pcal_wait_max)
 			{
-				error_set_error_code (err_cmd_unexpected);
-				state_isr_request_new_state (state_error_recoverable);
+				error_raise_from_isr (err_cmd_unexpected);
 			}
 			else
 			{
-				state_isr_request_new_state (state_pcal_sample_max);
+				state_isr_transition (state_pcal_sample_max);
+			}
+
+			break;
+
+		case pcal_msg_begin_curve:
+
+			if (current_state != state_idle)
+			{
+				error_raise_from_isr (err_cmd_unexpected);
+			}
+			else
+			{
+				tmp_curve_points = 0;
+				state_isr_transition (state_pcal_request_point);
+			}
+
+			break;
+
+		case pcal_msg_point_applied:
+
+			if (current_state != state_pcal_wait_point)
+			{
+				error_raise_from_isr (err_cmd_unexpected);
+			}
+			else
+			{
+				tmp_front_point_psi = (uint16_t)(data[1] << 8) | data[2];
+				tmp_rear_point_psi = (uint16_t)(data[3] << 8) | data[4];
+				state_isr_transition (state_pcal_sample_point);
+			}
+
+			break;
+
+		case pcal_msg_end_curve:
+
+			if (current_state != state_pcal_wait_point)
+			{
+				error_raise_from_isr (err_cmd_unexpected);
+			}
+			else
+			{
+				state_isr_transition (state_pcal_update_curve);
 			}
 
 			break;
 
 		default:
 
-			error_set_error_code (err_cmd_unknown);
-			state_isr_request_new_state (state_error_recoverable);
+			error_raise_from_isr (err_cmd_unknown);
 
 			break;
 	}
@@ -255,14 +1121,39 @@ pressure_calibration_rx_callback (uint8_t mob_index, uint32_t id, packet_type_t
 	can_ready_to_receive (mob_in_pressure_calibration);
 }
 
-void
-pressure_calibration_request_min (void)
+//
+//	Send the single byte calibration message `message' to the driver.
+//
+
+static void
+pressure_calibration_send (pcal_msg_t message)
 {
-	pcal_msg_t message = pcal_msg_apply_min_pressure;
+	uint8_t data = message;
 
-	can_load_data (mob_out_pressure_calibration, &message, 1);
-	can_ready_to_send (mob_out_pressure_);
+	can_load_data (mob_out_pressure_calibration, &data, 1);
+	can_ready_to_send (mob_out_pressure_calibration);
+}
 
+//
+//	Copy the most recent readings taken by the periodic interrupt handler.
+//	The sensors are not sampled directly since the handler could interrupt
+//	a conversion in progress and switch the multiplexer under it.
+//
+
+static void
+pressure_get_readings (uint16_t *front, uint16_t *rear)
+{
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+	{
+		*front = front_pressure;
+		*rear = rear_pressure;
+	}
+}
+
+void
+pressure_calibration_request_min (void)
+{
+	pressure_calibration_send (pcal_msg_apply_min_pressure);
 	state_transition (state_pcal_wait_min);
 }
 
@@ -275,7 +1166,147 @@ pressure_calibration_wait_min (void)
 void
 pressure_calibration_sample_min (void)
 {
+	pressure_get_readings (&tmp_front_min_pressure, &tmp_rear_min_pressure);
+	state_transition (state_pcal_request_max);
+}
+
+void
+pressure_calibration_request_max (void)
+{
+	pressure_calibration_send (pcal_msg_apply_max_pressure);
+	state_transition (state_pcal_wait_max);
+}
 
+void
+pressure_calibration_wait_max (void)
+{
+	/* zzz... */
 }
 
+void
+pressure_calibration_sample_max (void)
+{
+	pressure_get_readings (&tmp_front_max_pressure, &tmp_rear_max_pressure);
+	state_transition (state_pcal_update);
+}
 
+void
+pressure_calibration_update (void)
+{
+	err_code_t error_code = 0;
+
+	if (tmp_front_min_pressure >= tmp_front_max_pressure)
+		error_code = err_pcal_minf_gt_maxf;
+	else if (tmp_rear_min_pressure >= tmp_rear_max_pressure)
+		error_code = err_pcal_minr_gt_maxr;
+	else if (tmp_front_max_pressure - tmp_front_min_pressure < param_get (param_pressure_calibration_min_diff))
+		error_code = err_pcal_deltaf_lt_threshf;
+	else if (tmp_rear_max_pressure - tmp_rear_min_pressure < param_get (param_pressure_calibration_min_diff))
+		error_code = err_pcal_deltar_lt_threshr;
+
+	if (error_code)
+	{
+		pressure_calibration_send (pcal_msg_calibration_failed);
+		error_set_error_code (error_code);
+		state_transition (state_error_recoverable);
+
+		return;
+	}
+
+	pressure_store_front_calibration (tmp_front_min_pressure, tmp_front_max_pressure);
+	pressure_store_rear_calibration (tmp_rear_min_pressure, tmp_rear_max_pressure);
+
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+	{
+		front_min_pressure = tmp_front_min_pressure;
+		front_max_pressure = tmp_front_max_pressure;
+		rear_min_pressure = tmp_rear_min_pressure;
+		rear_max_pressure = tmp_rear_max_pressure;
+	}
+
+	pressure_calibration_send (pcal_msg_calibration_ok);
+	state_transition (state_idle);
+}
+
+void
+pressure_calibration_abort (void)
+{
+	pressure_calibration_send (pcal_msg_calibration_failed);
+	state_transition (state_idle);
+}
+
+void
+pressure_calibration_request_point (void)
+{
+	uint8_t data[2] = { pcal_msg_apply_point, tmp_curve_points };
+
+	can_load_data (mob_out_pressure_calibration, data, 2);
+	can_ready_to_send (mob_out_pressure_calibration);
+
+	state_transition (state_pcal_wait_point);
+}
+
+void
+pressure_calibration_wait_point (void)
+{
+	/* zzz... */
+}
+
+void
+pressure_calibration_sample_point (void)
+{
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+	{
+		tmp_front_curve_sample[tmp_curve_points] = front_sample;
+		tmp_rear_curve_sample[tmp_curve_points] = rear_sample;
+	}
+
+	tmp_front_curve_psi[tmp_curve_points] = tmp_front_point_psi;
+	tmp_rear_curve_psi[tmp_curve_points] = tmp_rear_point_psi;
+
+	if (++tmp_curve_points == PRESSURE_CURVE_MAX_POINTS)
+		state_transition (state_pcal_update_curve);
+	else
+		state_transition (state_pcal_request_point);
+}
+
+void
+pressure_calibration_update_curve (void)
+{
+	static pressure_curve_t new_front_curve, new_rear_curve;
+
+	if
+	(
+		!pressure_build_curve (&new_front_curve, tmp_curve_points,
+			tmp_front_curve_sample, tmp_front_curve_psi) ||
+		!pressure_build_curve (&new_rear_curve, tmp_curve_points,
+			tmp_rear_curve_sample, tmp_rear_curve_psi)
+	)
+	{
+		pressure_calibration_send (pcal_msg_calibration_failed);
+		error_set_error_code (err_pcal_curve_invalid);
+		state_transition (state_error_recoverable);
+
+		return;
+	}
+
+	front_curve_length = pressure_pack_curve (front_curve_bytes, tmp_curve_points,	/* 1 */
+		tmp_front_curve_sample, tmp_front_curve_psi);
+	rear_curve_length = pressure_pack_curve (rear_curve_bytes, tmp_curve_points,
+		tmp_rear_curve_sample, tmp_rear_curve_psi);
+
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+	{
+		memcpy (&front_curve, &new_front_curve, sizeof (front_curve));
+		memcpy (&rear_curve, &new_rear_curve, sizeof (rear_curve));
+	}
+
+	pressure_calibration_send (pcal_msg_calibration_ok);
+	state_transition (state_idle);
+}
+
+//
+//	1.	Each curve takes up to 33 bytes of eeprom, which is over 100 ms of
+//		writing, so the curves are stored a byte at a time from the idle
+//		state by `pressure_flush'.
+//
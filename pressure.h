@@ -9,12 +9,17 @@
 
 #include <inttypes.h>
 
+#include "can.h"
+
+#include "pressure_channels.h"
+
 //
 //	The general-purpose timer runs at 1 ms and calls the periodic interrupt
 //	handler. This handler updates the current pressure readings and broadcasts
-//	them. The rate at which each occurs is tuneable below.
+//	them. The rates below are the defaults; both can be tuned at runtime
+//	through the parameter service (see `param.h').
 //
-//	N.B. You can set any of these to zero to stop it from occuring.
+//	N.B. You can set the update period to zero to stop it from occuring.
 //
 
 #define	PRESSURE_UPDATE_PERIOD 		10 		/* ms */
@@ -23,11 +28,165 @@
 //
 //	Pressure calibration must pass several validation rules. There must
 //	be a minimum difference between the minimum and maximum applied
-//	pressures.
+//	pressures. This is the default, and is also a runtime parameter.
 //
 
 #define PRESSURE_CALIBRATION_MIN_DIFF	100		/* psi */
 
+//
+//	Sampling switches to the fast update period while the brakes are being
+//	worked: when the rate of change of pressure (after a first-order filter)
+//	or the pressure level crosses its threshold. It drops back once both
+//	have been under half their thresholds for the quiet period. These are
+//	the defaults for the runtime parameters of the same names.
+//
+
+#define	PRESSURE_FAST_UPDATE_PERIOD		1		/* ms */
+#define	PRESSURE_FAST_RATE_THRESHOLD	2000	/* psi/s */
+#define	PRESSURE_FAST_LEVEL_THRESHOLD	50		/* psi */
+#define	PRESSURE_FAST_QUIET_PERIOD		500		/* ms */
+
+#define	PRESSURE_FILTER_SHIFT			2		/* 1 */
+
+//
+//	1.	The filter moves 1/2^n of the way to each new sample, so the time
+//		constant is about 2^n update periods.
+//
+
+//
+//	A brake application starts when either side rises above the event
+//	threshold, and ends when both drop below half of it. A summary of the
+//	application is broadcast when it ends. This is the default for the
+//	runtime parameter of the same name.
+//
+
+#define	PRESSURE_EVENT_THRESHOLD		50		/* psi */
+
+//
+//	Brake onset is caught ahead of the event threshold, from the rate of
+//	rise. Between regular updates the periodic handler samples one sensor
+//	per tick, alternating, so each side is looked at every 2 ms or better.
+//	Onset is flagged as soon as a side is rising faster than the rate
+//	threshold and has already risen the rise threshold above its resting
+//	level. It re-arms once both sides are back within half of the rise
+//	threshold of rest. These are the defaults for the runtime parameters of
+//	the same names; a rate threshold of zero turns the detector off.
+//
+
+#define	PRESSURE_ONSET_RATE_THRESHOLD	1000	/* psi/s */
+#define	PRESSURE_ONSET_RISE_THRESHOLD	10		/* psi */
+#define	PRESSURE_ONSET_REST_SHIFT		6		/* 1 */
+
+//
+//	1.	The resting level follows the pressure by 1/2^n of the difference
+//		per sample, while the detector is armed and the side isn't rising.
+//
+
+//
+//	The onset and summary packets share the brake event message object,
+//	each with its own ID. They are queued, and sent one at a time.
+//
+
+#define	PRESSURE_EVENT_QUEUE_SIZE		2		/* packets */
+
+typedef struct pressure_event_frame_t
+{
+	uint16_t	id;
+	uint8_t		data[8];
+	uint8_t		length;
+}
+pressure_event_frame_t;
+
+//
+//	Session statistics are kept for each side, to catch slow changes over a
+//	session without logging: the resting pressure creeping up, the peaks of
+//	the applications fading and the front/rear balance drifting. Each is a
+//	running mean and variance (Welford's method, in fixed point) whose count
+//	stops at a window size, after which it behaves like a moving average
+//	over about that many samples. The mean when the window first fills is
+//	kept as the baseline that drift is measured against.
+//
+//	The resting level is updated on every sample pass once the brakes have
+//	been quiet long enough to leave fast mode. The peaks and the balance
+//	(front share of the two peaks) are updated at the end of each
+//	application, from the peaks the event tracker takes at the full sample
+//	rate. The peaks are also counted in a histogram per side, and all its
+//	counts are halved when one fills up, so it follows the recent
+//	applications.
+//
+//	A drift past its threshold raises an error once (`err_stats_rest_drift',
+//	`err_stats_fade' or `err_stats_balance_drift'), and re-arms when the
+//	drift is back under half the threshold. The thresholds are the defaults
+//	for the runtime parameters of the same names; zero turns an alarm off.
+//
+
+#define	PRESSURE_STATS_REST_WINDOW		256		/* samples */
+#define	PRESSURE_STATS_PEAK_WINDOW		16		/* applications */
+#define	PRESSURE_STATS_BINS				6
+#define	PRESSURE_STATS_BIN_WIDTH		250		/* psi */
+#define	PRESSURE_STATS_PERIOD			1000	/* ms, 1 */
+#define	PRESSURE_STATS_REST_DRIFT		20		/* psi */
+#define	PRESSURE_STATS_PEAK_FADE		100		/* psi */
+#define	PRESSURE_STATS_BALANCE_DRIFT	30		/* 0.1% */
+
+//
+//	1.	One statistics packet is sent each period, going through the
+//		`pressure_stats_frame_t' packets in turn.
+//
+
+typedef struct pressure_stats_t
+{
+	uint16_t	count;			/* saturates at the window */
+	int32_t		mean;			/* 24.8 */
+	int32_t		var;			/* 24.8 */
+	int32_t		baseline;		/* 24.8, the mean when the window first filled */
+	uint8_t		baselined;
+}
+pressure_stats_t;
+
+typedef enum pressure_stats_frame_t
+{
+	stats_frame_front				= 0x00,
+	stats_frame_rear				= 0x01,
+	stats_frame_balance				= 0x02,
+	stats_frame_front_histogram		= 0x03,
+	stats_frame_rear_histogram		= 0x04,
+	stats_frame_count				= 0x05
+}
+pressure_stats_frame_t;
+
+//
+//	The last byte of each pressure packet is a status byte describing the
+//	sample rate the reading was taken at.
+//
+
+#define	PRESSURE_STATUS_FAST_MODE		0x80	/* fast update period in use */
+#define	PRESSURE_STATUS_UNCALIBRATED	0x40	/* nominal curve, calibration not loaded yet */
+#define	PRESSURE_STATUS_PERIOD_MASK		0x3F	/* update period in ms, saturated */
+
+//
+//	Channels are numbered in the order of `PRESSURE_CHANNELS'. The bits
+//	are for sending the readings of some channels on their own (see
+//	`subscription.h').
+//
+
+#define	PRESSURE_CHANNEL_INDEX(name, adc, convert, curve_addr, min_addr, max_addr, filter, mob, msg, tx) \
+	pressure_channel_##name,
+
+typedef enum pressure_channel_t
+{
+	PRESSURE_CHANNELS (PRESSURE_CHANNEL_INDEX)
+	pressure_channel_count
+}
+pressure_channel_t;
+
+#undef	PRESSURE_CHANNEL_INDEX
+
+#define	PRESSURE_CHANNEL_BIT(name)		(1 << pressure_channel_##name)
+#define	PRESSURE_CHANNEL_ALL			((1 << pressure_channel_count) - 1)
+#define	PRESSURE_CHANNEL_FRONT			PRESSURE_CHANNEL_BIT (front)
+#define	PRESSURE_CHANNEL_REAR			PRESSURE_CHANNEL_BIT (rear)
+
 //
 //	The pressure samples come in from a +5V range sensor through the onboard
 //	10-bit DAC. Pressure is reported and tracked throughout the program in psi.
@@ -39,20 +198,58 @@
 //	Pressure calibration values are stored in the eeprom at fixed addresses.
 //	Since each value is 16-bits long, two bytes are required per parameter.
 //
+//	Each sensor curve is stored as a point count followed by that many
+//	pairs of 16-bit sample and psi values, MSB first.
+//
 
 typedef enum pressure_eeprom_addr_t
 {
 	front_min_pressure_addr	= 0x00,
 	front_max_pressure_addr	= 0x02,
 	rear_min_pressure_addr	= 0x04,
-	rear_max_pressure_addr	= 0x06
+	rear_max_pressure_addr	= 0x06,
+	front_curve_addr		= 0x40,
+	rear_curve_addr			= 0x70
 }
 pressure_eeprom_addr_t;
 
+//
+//	Samples are converted to psi through a piecewise-linear curve per
+//	sensor, captured at up to `PRESSURE_CURVE_MAX_POINTS' applied reference
+//	pressures. Without a valid curve in the eeprom, a sensor uses the
+//	nominal straight line given by `PSI_PER_VOLT'.
+//
+//	The conversion is constant-time: the top bits of the sample index a
+//	table of buckets, each holding the curve segment its first sample falls
+//	in, and each segment has a precomputed slope. Captured points have to
+//	be at least one bucket apart for this to work.
+//
+
+#define	PRESSURE_CURVE_MAX_POINTS		8
+#define	PRESSURE_CURVE_MAX_SAMPLE		1023
+#define	PRESSURE_CURVE_BUCKET_SHIFT		4
+#define	PRESSURE_CURVE_BUCKET_SIZE		(1 << PRESSURE_CURVE_BUCKET_SHIFT)
+#define	PRESSURE_CURVE_BUCKETS			((PRESSURE_CURVE_MAX_SAMPLE + 1) >> PRESSURE_CURVE_BUCKET_SHIFT)
+
+typedef struct pressure_curve_t
+{
+	uint8_t		points;										/* 1 */
+	uint16_t	sample[PRESSURE_CURVE_MAX_POINTS + 2];
+	uint16_t	psi[PRESSURE_CURVE_MAX_POINTS + 2];
+	uint16_t	slope[PRESSURE_CURVE_MAX_POINTS + 1];		/* psi per sample, 8.8 */
+	uint8_t		bucket[PRESSURE_CURVE_BUCKETS];				/* segment index */
+}
+pressure_curve_t;
+
+//
+//	1.	Besides the captured points, the curve holds the first segment
+//		extended down to a sample of zero and the last one extended past
+//		`PRESSURE_CURVE_MAX_SAMPLE', so every sample lands in a segment.
+//
 //
 //	Below are the pressure calibration messages. All pressure calibration
 //	commands, incoming and outgoing, use a single byte message to coordinate
-//	the calibration process.
+//	the calibration process. A few carry extra bytes after it.
 //
 
 typedef enum pcal_msg_t
@@ -64,33 +261,92 @@ typedef enum pcal_msg_t
 	pcal_msg_apply_max_pressure		= 0x04,		/* driver <- brake module */
 	pcal_msg_max_pressure_applied	= 0x05,		/* driver -> brake module */
 	pcal_msg_calibration_ok			= 0x06,		/* driver <- brake module */
-	pcal_msg_calibration_failed		= 0x07		/* driver <- brake module */
+	pcal_msg_calibration_failed		= 0x07,		/* driver <- brake module */
+	pcal_msg_begin_curve			= 0x08,		/* driver -> brake module */
+	pcal_msg_apply_point			= 0x09,		/* driver <- brake module, 1 */
+	pcal_msg_point_applied			= 0x0A,		/* driver -> brake module, 2 */
+	pcal_msg_end_curve				= 0x0B		/* driver -> brake module */
 }
 pcal_msg_t;
 
+//
+//	The sensor curve is captured by a longer sequence. After `begin curve',
+//	the module asks for each point in turn, and the driver applies it and
+//	replies with the reference pressures read off a gauge. The driver ends
+//	the sequence with `end curve' (or it ends on its own after the last
+//	point), and the module replies with `calibration ok' or `failed'.
+//
+//	1.	Followed by the index of the point to apply.
+//
+//	2.	Followed by the MSB and LSB of the applied front pressure, then of
+//		the applied rear pressure (in psi).
+//
+
+//
+//	First stage of start-up (see `startup.h'). Sample every channel
+//	through the nominal curve and broadcast the readings, flagged
+//	`PRESSURE_STATUS_UNCALIBRATED'. This must run with interrupts off.
+//
+
+void
+pressure_boot (void);
+
 //
 //	Initialize pressure subsystem of the controller. Read the pressure
-//	calibration values from the eeprom.
+//	calibration values from the eeprom, and start using them.
 //
 
 void
 pressure_init (void);
 
 //
-//	Take a reading from the front pressure sensor. Return the reading.
-//	Reading is output in psi.
+//	Return the channels, as `PRESSURE_CHANNEL_FRONT' and so on, whose latest
+//	sample is at or above `max_sample'.
 //
 
-uint16_t
-pressure_sample_front_sensor (void);
+uint8_t
+pressure_self_test
+(
+	uint16_t max_sample
+);
 
 //
-//	Take a reading from the rear pressure sensor. Return the reading.
-//	Reading is output in psi.
+//	Each channel in `PRESSURE_CHANNELS' has its own set of the functions
+//	below, e.g. `pressure_sample_front_sensor':
+//
+//	pressure_sample_<name>_sensor: Take a reading from the sensor. Return
+//	the reading, in psi.
+//
+//	pressure_load_<name>_calibration: Load the channel's calibration values
+//	from eeprom into the variables pointed to by `min' and `max'.
+//	Calibration values are in psi.
+//
+//	pressure_store_<name>_calibration: Store the channel's calibration
+//	values `min' and `max' into eeprom.
 //
 
-uint16_t
-pressure_sample_rear_sensor (void);
+#define	PRESSURE_CHANNEL_PROTOTYPES(name, adc, convert, curve_addr, min_addr, max_addr, filter, mob, msg, tx) \
+																				\
+	uint16_t																	\
+	pressure_sample_##name##_sensor (void);										\
+																				\
+	void																		\
+	pressure_load_##name##_calibration											\
+	(																			\
+		uint16_t	*min,														\
+		uint16_t	*max														\
+	);																			\
+																				\
+	void																		\
+	pressure_store_##name##_calibration											\
+	(																			\
+		uint16_t	min,														\
+		uint16_t	max															\
+	);
+
+PRESSURE_CHANNELS (PRESSURE_CHANNEL_PROTOTYPES)
+
+#undef	PRESSURE_CHANNEL_PROTOTYPES
 
 //
 //	Convert a sampled sensor voltage reading `sample' into psi. Use the
@@ -104,54 +360,89 @@ pressure_convert_sample_to_psi
 );
 
 //
-//	Load front pressure calibration values from eeprom into the variables
-//	pointed to by `min' and `max'. Calibration values are in psi.
+//	Convert sample `sample' into psi through the sensor curve `curve'.
 //
 
-void
-pressure_load_front_calibration
+uint16_t
+pressure_convert_sample
 (
-	uint16_t	*min,
-	uint16_t	*max
+	const pressure_curve_t	*curve,
+	uint16_t				sample
 );
 
 //
-//	Load rear pressure calibration values from eeprom into the variables
-//	pointed to by `min' and `max'. Calibration values are in psi.
+//	Convert fine sample `fine' (see `adc_range_get_sample') into psi
+//	through the sensor curve `curve'.
 //
 
-void
-pressure_load_rear_calibration
+uint16_t
+pressure_convert_fine_sample
 (
-	uint16_t	*min,
-	uint16_t	*max
+	const pressure_curve_t	*curve,
+	uint16_t				fine
 );
 
 //
-//	Store front pressure calibration values into eeprom from the variables
-//	pointed to by `min' and `max'. Calibration values are in psi.
+//	Build the sensor curve `curve' from `points' captured samples in
+//	`sample' and the psi applied at each in `psi'. Return 0 and leave the
+//	curve untouched if the points aren't far enough apart or don't
+//	strictly increase.
 //
 
+uint8_t
+pressure_build_curve
+(
+	pressure_curve_t	*curve,
+	uint8_t				points,
+	const uint16_t		*sample,
+	const uint16_t		*psi
+);
+
+//
+//	Build the nominal straight-line curve given by `PSI_PER_VOLT'.
+//
 
 void
-pressure_store_front_calibration
+pressure_build_nominal_curve
 (
-	uint16_t	min,
-	uint16_t	max
+	pressure_curve_t *curve
 );
 
 //
-//	Store rear pressure calibration values into eeprom from the variables
-//	pointed to by `min' and `max'. Calibration values are in psi.
+//	Load the sensor curve at eeprom address `addr' into `curve', falling
+//	back to the nominal curve if it isn't valid.
 //
 
 void
-pressure_store_rear_calibration
+pressure_load_curve
 (
-	uint16_t	min,
-	uint16_t	max
+	pressure_eeprom_addr_t	addr,
+	pressure_curve_t		*curve
 );
 
+//
+//	Pack `points' captured samples in `sample' and the psi applied at each
+//	in `psi' into `bytes', as a sensor curve is laid out in the eeprom.
+//	Returns the number of bytes used.
+//
+
+uint8_t
+pressure_pack_curve
+(
+	uint8_t					*bytes,
+	uint8_t					points,
+	const uint16_t			*sample,
+	const uint16_t			*psi
+);
+
+//
+//	Write back at most one byte of a new sensor curve (see `flush.h').
+//	Never waits. Called from the idle state.
+//
+
+void
+pressure_flush (void);
+
 //
 //	Broadcast pressure readings over the CAN bus to the other modules.
 //
@@ -159,16 +450,149 @@ pressure_store_rear_calibration
 //	right pressure. Separate IDs are used for each packet, and they are
 //	defined in `can_config.h'.
 //
-//	Each packet contains six bytes:
+//	Each packet contains seven bytes:
 //
 //	0+1: The MSB and LSB of the 16-bit pressure reading (in psi)
 //	2+3: The MSB and LSB of the 16-bit calibrated minimum pressure (in psi)
 //	4+5: The MSB and LSB of the 16-bit calibrated maximum pressure (in psi)
+//	6:   The status byte, see `PRESSURE_STATUS_FAST_MODE' above
 //
 
 void
 pressure_broadcast_pressure_readings (void);
 
+//
+//	Send the pressure packets for just the channels in `channels', in the
+//	same format as the broadcast above.
+//
+
+void
+pressure_send_pressure_readings
+(
+	uint8_t channels
+);
+
+//
+//	Broadcast the summary of the brake application that just ended over
+//	the CAN bus. Peaks and the integral are taken at the full sample rate.
+//
+//	The packet contains eight bytes:
+//
+//	0+1: The MSB and LSB of the duration (in ms, saturated)
+//	2+3: The MSB and LSB of the front plus rear pressure integrated over
+//		 the application (in psi s, saturated)
+//	4+5+6: The 12-bit peak front pressure followed by the 12-bit peak rear
+//		 pressure, MSB first (in psi)
+//	7:   The time from the start of the application to the highest pressure
+//		 on either side (in units of 4 ms, saturated)
+//
+
+void
+pressure_broadcast_brake_summary (void);
+
+//
+//	Broadcast a brake onset event on `EVENT_ID (event_id_brake_onset)'. The
+//	event shares the brake event message object with the summary, which
+//	is reconfigured for each packet.
+//
+//	The packet contains seven bytes:
+//
+//	0+1: The MSB and LSB of the front pressure at detection (in psi)
+//	2+3: The MSB and LSB of the rear pressure at detection (in psi)
+//	4+5: The MSB and LSB of the rate of rise that tripped the detector
+//		 (in psi/s, saturated)
+//	6:   How long before detection the rise started, extrapolated back from
+//		 the rate (in ms, saturated)
+//
+
+void
+pressure_broadcast_brake_onset (void);
+
+//
+//	Broadcast the onset latency counters as a diagnostic packet. This is
+//	sent after each onset event has gone out.
+//
+//	The packet contains eight bytes:
+//
+//	0:   `diag_id_onset_report'
+//	1:   The number of onsets detected (saturated)
+//	2+3: The MSB and LSB of the time from detection to the event packet
+//		 leaving the bus, for the last onset (in us, saturated)
+//	4+5: The MSB and LSB of the same, worst case
+//	6:   The extrapolated time from the start of the rise to detection, for
+//		 the last onset (in ms, saturated)
+//	7:   The same, worst case
+//
+
+void
+pressure_broadcast_onset_report (void);
+
+//
+//	Send the brake event packet at the head of the queue again. Called
+//	after the message objects have been set up anew (see `bus.h').
+//
+
+void
+pressure_restart_brake_events (void);
+
+//
+//	Pressure readings sent callback function. Times the first frame after
+//	start-up.
+//
+
+void
+pressure_readings_tx_callback
+(
+	uint8_t 		mob_index,
+	uint32_t 		id,
+	packet_type_t 	type
+);
+
+//
+//	Broadcast statistics packet `frame' on the diagnostic channel. The
+//	first two bytes are always `diag_id_stats_report' and the frame.
+//
+//	Side (`stats_frame_front' and `stats_frame_rear'):
+//
+//	2+3: The MSB and LSB of the mean resting pressure (in 1/16 psi)
+//	4:   Its standard deviation (in 1/16 psi, saturated)
+//	5+6: The MSB and LSB of the mean peak pressure (in psi)
+//	7:   Its standard deviation (in psi, saturated)
+//
+//	Balance (`stats_frame_balance'):
+//
+//	2+3: The MSB and LSB of the mean front share of the peaks (in 0.1%)
+//	4+5: The MSB and LSB of the baseline front share (in 0.1%, 0xFFFF until
+//		 there is one)
+//	6:   The standard deviation of the front share (in 0.1%, saturated)
+//	7:   The alarms that are raised, one bit each for the front and rear
+//		 rest drift, front and rear peak fade and balance drift
+//
+//	Histogram (`stats_frame_front_histogram' and `..._rear_histogram'):
+//
+//	2-7: The count of peaks in each `PRESSURE_STATS_BIN_WIDTH' bin, lowest
+//		 first, with the last bin taking everything above
+//
+
+void
+pressure_broadcast_stats_report
+(
+	pressure_stats_frame_t frame
+);
+
+//
+//	Brake event sent callback function. Sends the next queued packet, and
+//	timestamps the onset event.
+//
+
+void
+pressure_brake_event_tx_callback
+(
+	uint8_t 		mob_index,
+	uint32_t 		id,
+	packet_type_t 	type
+);
+
 //
 //	This function is fired every millisecond by the general-purpose timer.
 //	It is used to periodically broadcast the pressure over the CAN bus.
@@ -214,27 +638,78 @@ void
 pressure_calibration_sample_min (void);
 
 //
-//	Broadcast a request to apply minimum braking pressure over the CAN
-//	channel. Transition into waiting for minimum pressure.
+//	Broadcast a request to apply maximum braking pressure over the CAN
+//	channel. Transition into waiting for maximum pressure.
 //
 
 void
-pressure_calibration_request_min (void);
+pressure_calibration_request_max (void);
 
 //
-//	Wait for minimum braking pressure to be applied. Just a `nop' style
+//	Wait for maximum braking pressure to be applied. Just a `nop' style
 //	function like the idle state.
 //
 
 void
-pressure_calibration_wait_min (void);
+pressure_calibration_wait_max (void);
 
 //
-//	Sample the minimum braking pressure and record the values in temporary
-//	variables for later use. Transition into requesting maximum pressure.
+//	Sample the maximum braking pressure and record the values in temporary
+//	variables for later use. Transition into updating the calibration.
 //
 
 void
-pressure_calibration_sample_min (void);
+pressure_calibration_sample_max (void);
+
+//
+//	Validate the sampled calibration values. If they pass, store them in
+//	the eeprom, start using them and report success to the driver. If not,
+//	report failure and transition into the recoverable error state.
+//
+
+void
+pressure_calibration_update (void);
+
+//
+//	Report the aborted calibration to the driver and return to idle. The
+//	previous calibration values are left untouched.
+//
+
+void
+pressure_calibration_abort (void);
+
+//
+//	Broadcast a request to apply the next curve point over the CAN channel.
+//	Transition into waiting for the point.
+//
+
+void
+pressure_calibration_request_point (void);
+
+//
+//	Wait for the curve point to be applied. Just a `nop' style function
+//	like the idle state.
+//
+
+void
+pressure_calibration_wait_point (void);
+
+//
+//	Record the latest samples against the reference pressures sent by the
+//	driver. Transition into requesting the next point, or into updating the
+//	curve once every point has been captured.
+//
+
+void
+pressure_calibration_sample_point (void);
+
+//
+//	Validate the captured points. If they pass, store the curves in the
+//	eeprom, start using them and report success to the driver. If not,
+//	report failure and transition into the recoverable error state.
+//
+
+void
+pressure_calibration_update_curve (void);
 
 #endif
@@ -0,0 +1,55 @@
+//
+//	pressure_channels.h
+//	The sensor channel table.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#ifndef _PRESSURE_CHANNELS_H
+#define _PRESSURE_CHANNELS_H
+
+//
+//	Each sensor channel is one line of the table below. The per-channel
+//	plumbing is expanded from it at compile time: the readings, curves and
+//	calibration values kept for it, the sample and calibration load and
+//	store functions, the self-test, the regular sample pass, the broadcast
+//	packing, the message object set-up and the subscription table. Each
+//	expansion is straight-line code with the channel's constants folded
+//	in, so nothing walks the table at run time.
+//
+//	The columns are:
+//
+//	name:		Makes up the names, e.g. `pressure_sample_front_sensor' and
+//				`front_curve'
+//	adc:		The ADC channel, from `adc_chan_t', read through
+//				`adc_range_get_sample'
+//	convert:	Turns a fine sample into psi through the channel's curve,
+//				like `pressure_convert_fine_sample'
+//	curve_addr:	The eeprom address of the sensor curve
+//	min_addr:	The eeprom address of the calibrated minimum
+//	max_addr:	The eeprom address of the calibrated maximum
+//	filter:		The shift of the rate filter, see `PRESSURE_FILTER_SHIFT'
+//	mob:		The message object the readings are broadcast on
+//	msg:		Its message ID
+//	tx:			Its transmit callback, or 0
+//
+//	The table is not the whole story. Everything that compares or combines
+//	channels is written for front and rear: the calibration procedure and
+//	its messages, the rate and onset detectors, the brake event and its
+//	summary, and the statistics with their balance check. A channel beyond
+//	those two is sampled, broadcast and can be subscribed to, but is never
+//	calibrated and takes no part in any of the rest.
+//	It also needs its own message object and ID in `can_config.h', and
+//	all 15 message objects are already taken, as well as eeprom slots in
+//	`pressure_eeprom_addr_t'.
+//
+
+#define	PRESSURE_CHANNELS(X)																			\
+	X (front,	adc_chan_front_pressure,	pressure_convert_fine_sample,	front_curve_addr,				\
+		front_min_pressure_addr,	front_max_pressure_addr,	PRESSURE_FILTER_SHIFT,						\
+		mob_out_pressure_front,		msg_id_pressure_front,		pressure_readings_tx_callback)					\
+	X (rear,	adc_chan_rear_pressure,		pressure_convert_fine_sample,	rear_curve_addr,				\
+		rear_min_pressure_addr,		rear_max_pressure_addr,		PRESSURE_FILTER_SHIFT,						\
+		mob_out_pressure_rear,		msg_id_pressure_rear,		0)
+
+#endif
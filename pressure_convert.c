@@ -0,0 +1,148 @@
+//
+//	pressure_convert.c
+//	Sample to psi conversion. Kept apart from the rest of `pressure.c' so
+//	the benchmarks can build it on its own.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#include "adc.h"
+#include "pressure.h"
+
+uint16_t
+pressure_convert_sample_to_psi (uint16_t sample)
+{
+	uint32_t converted;
+
+	converted = (uint32_t)sample * PSI_PER_VOLT * 5 / 1024; /* 1 */
+	return (uint16_t)converted;
+}
+
+//
+//	1.	The full-scale voltage is 5V, and the range of the ADC is 2^10.
+//
+
+uint16_t
+pressure_convert_sample (const pressure_curve_t *curve, uint16_t sample)
+{
+	uint8_t segment;
+
+	segment = curve->bucket[sample >> PRESSURE_CURVE_BUCKET_SHIFT];
+
+	if (sample >= curve->sample[segment + 1])	/* 1 */
+		segment++;
+
+	return curve->psi[segment] +
+		(uint16_t)(((uint32_t)(sample - curve->sample[segment]) * curve->slope[segment]) >> 8);
+}
+
+//
+//	1.	Points are at least one bucket apart, so a bucket holds at most one
+//		segment boundary. The bucket's segment is the one its first sample
+//		falls in, which leaves at most one step forward to take. The last
+//		segment ends on `PRESSURE_CURVE_MAX_SAMPLE' + 1, so this never steps
+//		past it.
+//
+
+uint16_t
+pressure_convert_fine_sample (const pressure_curve_t *curve, uint16_t fine)
+{
+	uint16_t	sample = fine >> ADC_FINE_SHIFT;
+	uint8_t		segment;
+
+	segment = curve->bucket[sample >> PRESSURE_CURVE_BUCKET_SHIFT];
+
+	if (sample >= curve->sample[segment + 1])
+		segment++;
+
+	return curve->psi[segment] +
+		(uint16_t)(((uint32_t)(fine - (curve->sample[segment] << ADC_FINE_SHIFT)) *
+		curve->slope[segment]) >> (8 + ADC_FINE_SHIFT));	/* 1 */
+}
+
+//
+//	1.	The same as `pressure_convert_sample', with the fraction of a code
+//		carried into the interpolation. Segments start at or below code
+//		1023, so the shifted start still fits in 16 bits.
+//
+
+uint8_t
+pressure_build_curve (pressure_curve_t *curve, uint8_t points,
+	const uint16_t *sample, const uint16_t *psi)
+{
+	uint8_t		i, n = 0, segment;
+	int32_t		extended;
+	uint32_t	slope;
+
+	if (points < 2 || points > PRESSURE_CURVE_MAX_POINTS)
+		return 0;
+
+	for (i = 1; i < points; i++)
+	{
+		if (sample[i] < sample[i - 1] + PRESSURE_CURVE_BUCKET_SIZE || psi[i] <= psi[i - 1])
+			return 0;
+	}
+
+	if (sample[points - 1] > PRESSURE_CURVE_MAX_SAMPLE)
+		return 0;
+
+	if (sample[0] > 0)		/* 2 */
+	{
+		extended = (int32_t)psi[0] -
+			(int32_t)sample[0] * (psi[1] - psi[0]) / (sample[1] - sample[0]);
+
+		curve->sample[n] = 0;
+		curve->psi[n++] = (extended < 0) ? 0 : extended;
+	}
+
+	for (i = 0; i < points; i++)
+	{
+		curve->sample[n] = sample[i];
+		curve->psi[n++] = psi[i];
+	}
+
+	extended = (int32_t)psi[points - 1] +
+		(int32_t)(PRESSURE_CURVE_MAX_SAMPLE + 1 - sample[points - 1]) *
+		(psi[points - 1] - psi[points - 2]) / (sample[points - 1] - sample[points - 2]);
+
+	curve->sample[n] = PRESSURE_CURVE_MAX_SAMPLE + 1;
+	curve->psi[n++] = (extended > 0xFFFF) ? 0xFFFF : extended;
+
+	curve->points = n;
+
+	for (i = 0; i < n - 1; i++)
+	{
+		slope = (((uint32_t)(curve->psi[i + 1] - curve->psi[i]) << 8) +
+			(curve->sample[i + 1] - curve->sample[i]) / 2) /
+			(curve->sample[i + 1] - curve->sample[i]);
+
+		curve->slope[i] = (slope > 0xFFFF) ? 0xFFFF : slope;
+	}
+
+	for (i = 0, segment = 0; i < PRESSURE_CURVE_BUCKETS; i++)
+	{
+		while (curve->sample[segment + 1] <= (uint16_t)i << PRESSURE_CURVE_BUCKET_SHIFT)
+			segment++;
+
+		curve->bucket[i] = segment;
+	}
+
+	return 1;
+}
+
+//
+//	2.	The end segments are extended out to cover every sample the ADC can
+//		produce, so the conversion never has to check the range.
+//
+
+void
+pressure_build_nominal_curve (pressure_curve_t *curve)
+{
+	uint16_t sample[2] = { 0, PRESSURE_CURVE_MAX_SAMPLE };
+	uint16_t psi[2];
+
+	psi[0] = pressure_convert_sample_to_psi (sample[0]);
+	psi[1] = pressure_convert_sample_to_psi (sample[1]);
+
+	pressure_build_curve (curve, 2, sample, psi);
+}
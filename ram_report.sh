@@ -0,0 +1,47 @@
+#!/bin/sh
+#
+#	ram_report.sh
+#	Static RAM used by each module, against the AT90CAN128's 4 KB.
+#
+#	Michael Jean <michael.jean@shaw.ca>
+#
+#	Runs as the post-build step, from the build directory:
+#
+#		sh ../ram_report.sh pbr_brake.elf
+#
+#	Each object file's .data, .rodata (1), .bss and .noinit are added up
+#	and listed, largest first. The totals come from the linked image, and
+#	whatever is left over is all the stack has; compare it with the most
+#	the stack has really used, from the stack report (`diag_id_stack_report').
+#
+#	1.	Constants that aren't in PROGMEM are copied into RAM at start-up.
+#
+
+SIZE=${SIZE:-avr-size}
+RAM_SIZE=4096
+STACK_MARGIN=512
+
+if [ $# -ne 1 ]; then
+	echo "usage: $0 <image.elf>" >&2
+	exit 2
+fi
+
+ram_sections ()
+{
+	$SIZE -A "$1" | awk '$1 ~ /^\.(data|rodata|bss|noinit)/ { total += $2 } END { print total + 0 }'
+}
+
+echo "Static RAM by module:"
+
+find . -name '*.o' | sort | while read object; do
+	printf "%6d  %s\n" "$(ram_sections "$object")" "${object#./}"
+done | sort -rn
+
+total=$(ram_sections "$1")
+left=$((RAM_SIZE - total))
+
+printf "%6d  total, %d bytes left for the stack\n" "$total" "$left"
+
+if [ $left -lt $STACK_MARGIN ]; then
+	echo "warning: less than $STACK_MARGIN bytes left for the stack" >&2
+fi
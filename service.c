@@ -0,0 +1,166 @@
+//
+//	service.c
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#include <util/atomic.h>
+#include <util/delay.h>
+
+#include "can.h"
+#include "can_config.h"
+#include "eeprom.h"
+
+#include "boot/boot.h"
+#include "error.h"
+#include "param.h"
+#include "service.h"
+#include "subscription.h"
+#include "watchdog.h"
+
+static service_fill_t	reply_fill;
+static uint8_t			reply_index;
+
+static volatile uint8_t	boot_requested;
+
+void
+service_rx_callback (uint8_t mob_index, uint32_t id, packet_type_t type)
+{
+	uint8_t data[8];
+
+	can_read_data (mob_index, data, 8);
+
+	if (reply_fill)		/* 1 */
+	{
+		error_set_error_code (err_svc_busy);
+		error_broadcast_error_code (err_sev_recoverable, err_svc_busy);
+
+		can_ready_to_receive (mob_in_service);
+		return;
+	}
+
+	switch (data[0])
+	{
+		case svc_cmd_param_read:
+		case svc_cmd_param_write:
+		case svc_cmd_param_info:
+
+			param_service_request (data);
+			break;
+
+		case svc_cmd_error_journal:
+		case svc_cmd_error_counts:
+		case svc_cmd_error_clear:
+
+			error_service_request (data);
+			break;
+
+		case svc_cmd_subscribe:
+
+			subscription_service_request (data);
+			break;
+
+		case svc_cmd_enter_bootloader:
+
+			if (data[1] == 'B' && data[2] == 'O' && data[3] == 'O' && data[4] == 'T')
+			{
+				service_send_reply (data, 1);
+				boot_requested = 1;
+			}
+			else
+			{
+				error_set_error_code (err_boot_bad_key);
+				error_broadcast_error_code (err_sev_recoverable, err_boot_bad_key);
+			}
+
+			break;
+
+		default:
+
+			error_set_error_code (err_cmd_unknown);
+			error_broadcast_error_code (err_sev_recoverable, err_cmd_unknown);
+
+			break;
+	}
+
+	can_ready_to_receive (mob_in_service);
+}
+
+//
+//	1.	A multi-packet reply is still going out on the service message
+//		object, and another reply would overwrite the packet waiting there.
+//		The requester has to wait for the reply to finish and ask again.
+//
+
+//
+//	Leave a request for the bootloader in the eeprom and reset into it, once
+//	one has been received.
+//
+
+void
+service_service (void)
+{
+	uint8_t magic = BOOT_REQUEST_MAGIC;
+
+	if (!boot_requested)
+		return;
+
+	eeprom_write_many (BOOT_EEPROM_REQUEST, &magic, 1);
+	_delay_ms (1.0);	/* 1 */
+
+	watchdog_reset_system (watchdog_task_bootloader);
+}
+
+//
+//	1.	Give the CAN controller time to get the reply out before the reset
+//		takes it off the bus. The bootloader announces itself anyway.
+//
+
+void
+service_send_reply (uint8_t *data, uint8_t length)
+{
+	can_load_data (mob_out_service, data, length);
+	can_ready_to_send (mob_out_service);
+}
+
+//
+//	Send the next packet of the multi-packet reply, or finish it.
+//
+
+static void
+service_send_next_reply (void)
+{
+	uint8_t data[8];
+	uint8_t length;
+
+	if (!reply_fill)
+		return;
+
+	length = reply_fill (reply_index++, data);
+
+	if (length)
+		service_send_reply (data, length);
+	else
+		reply_fill = 0;
+}
+
+void
+service_tx_callback (uint8_t mob_index, uint32_t id, packet_type_t type)
+{
+	service_send_next_reply ();
+}
+
+void
+service_send_replies (service_fill_t fill)
+{
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+	{
+		if (reply_fill)
+			return;
+
+		reply_fill = fill;
+		reply_index = 0;
+
+		service_send_next_reply ();
+	}
+}
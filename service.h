@@ -0,0 +1,124 @@
+//
+//	service.h
+//	Request/reply services on the service message ID.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#ifndef _SERVICE_H
+#define _SERVICE_H
+
+#include <inttypes.h>
+
+#include "can.h"
+
+//
+//	Every request is read as a full eight byte packet; bytes past the end
+//	of a shorter request are ignored. The first byte is always the command
+//	from `can_svc_cmd_t', and the reply always starts with it too.
+//
+//	Parameter read:		0: `svc_cmd_param_read'
+//						1: parameter id
+//
+//	Parameter write:	0: `svc_cmd_param_write'
+//						1: parameter id
+//						2+3: The MSB and LSB of the new value
+//
+//	Parameter info:		0: `svc_cmd_param_info'
+//						1: parameter id
+//
+//	Enter bootloader:	0: `svc_cmd_enter_bootloader'
+//						1-4: The key, "BOOT"
+//
+//	Read and write both reply with the value now in effect:
+//
+//	0: The command
+//	1: The parameter id
+//	2: The `param_status_t' of the request
+//	3+4: The MSB and LSB of the current value
+//
+//	Info replies with the parameter's type and limits:
+//
+//	0: The command
+//	1: The parameter id
+//	2: The `param_status_t' of the request
+//	3: The `param_type_t' of the parameter
+//	4+5: The MSB and LSB of the minimum value
+//	6+7: The MSB and LSB of the maximum value
+//
+//	Enter bootloader replies with just the command, then resets into the
+//	bootloader from the main loop (see `service_service'). A request with
+//	the wrong key is refused with `err_boot_bad_key'.
+//
+//	Only one reply can be going out at a time. Any request that arrives
+//	while a multi-packet reply is still being sent is dropped, and
+//	`err_svc_busy' is broadcast as a recoverable error.
+//
+
+//
+//	Service request received callback function. Dispatches the request to
+//	the subsystem that owns the command.
+//
+
+void
+service_rx_callback
+(
+	uint8_t 		mob_index,
+	uint32_t 		id,
+	packet_type_t 	type
+);
+
+//
+//	Service reply sent callback function. Sends the next packet of a
+//	multi-packet reply, if there is one going.
+//
+
+void
+service_tx_callback
+(
+	uint8_t 		mob_index,
+	uint32_t 		id,
+	packet_type_t 	type
+);
+
+//
+//	Carry out a request to enter the bootloader, if one has been received.
+//	The eeprom write and the reset take too long for the receive interrupt,
+//	so they are done from here. Called from the main loop.
+//
+
+void
+service_service (void);
+
+//
+//	Fill in packet number `index' of a multi-packet reply at `data', and
+//	return its length, or zero once there are no more packets.
+//
+
+typedef uint8_t (*service_fill_t)(uint8_t index, uint8_t *data);
+
+//
+//	Send a multi-packet reply, produced by `fill'. Each packet is filled
+//	in and sent once the one before it has gone out, so this returns
+//	straight away. Requests are refused until the last packet has gone (see
+//	above), and a second reply started while one is still going is ignored.
+//
+
+void
+service_send_replies
+(
+	service_fill_t fill
+);
+
+//
+//	Send `length' bytes in `data' as a service reply.
+//
+
+void
+service_send_reply
+(
+	uint8_t	*data,
+	uint8_t	length
+);
+
+#endif
@@ -0,0 +1,24 @@
+//
+//	avr/eeprom.h
+//	Host simulator stand-in for the avr-libc eeprom byte access, sharing
+//	the array behind the libeeprom stand-in.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#ifndef _SIM_AVR_EEPROM_H
+#define _SIM_AVR_EEPROM_H
+
+#include <inttypes.h>
+
+//
+//	A byte write starts the write and returns; the eeprom then stays busy
+//	for `SIM_EEPROM_WRITE_US'. Reads and writes started while it is busy
+//	wait for it first, like the real thing.
+//
+
+uint8_t	eeprom_is_ready (void);
+uint8_t	eeprom_read_byte (const uint8_t *addr);
+void	eeprom_write_byte (uint8_t *addr, uint8_t value);
+
+#endif
@@ -0,0 +1,17 @@
+//
+//	avr/interrupt.h
+//	Host simulator stand-in. Interrupts are delivered by the simulator
+//	between main loop iterations, so masking them is a no-op.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#ifndef _SIM_AVR_INTERRUPT_H
+#define _SIM_AVR_INTERRUPT_H
+
+#define	ISR(vector)		void vector (void); void vector (void)
+
+#define	sei()
+#define	cli()
+
+#endif
@@ -0,0 +1,79 @@
+//
+//	avr/io.h
+//	Host simulator stand-in for the AT90CAN128 register definitions.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#ifndef _SIM_AVR_IO_H
+#define _SIM_AVR_IO_H
+
+#include <inttypes.h>
+
+#define	_BV(bit)						(1 << (bit))
+#define	bit_is_set(reg, bit)			((reg) & _BV (bit))
+#define	bit_is_clear(reg, bit)			(!((reg) & _BV (bit)))
+#define	loop_until_bit_is_set(reg, bit)	do { } while (bit_is_clear (reg, bit))
+
+//
+//	The registers are plain variables defined in `sim.c'. Writes are simply
+//	remembered; peripherals with behaviour (ADC, CAN, timer, watchdog) are
+//	modelled one level up, at the driver API.
+//
+
+extern volatile uint8_t		ADCSRA, ADMUX, DDRB, PORTB, DDRG, PORTG;
+extern volatile uint8_t		TCCR0A, OCR0A, TIMSK0, MCUSR, GPIOR0;
+extern volatile uint8_t		TCCR1A, TCCR1B, TIMSK1;
+extern volatile uint8_t		CANGCON, CANGSTA, CANGIT, CANTEC, CANREC, CANPAGE;
+
+//
+//	Timer 0 is modelled from the simulator clock, so reads of its count and
+//	flags see where the current millisecond tick has got to.
+//
+
+uint8_t	sim_timer0_count (void);
+uint8_t	sim_timer0_flags (void);
+
+#define	TCNT0	(sim_timer0_count ())
+#define	TIFR0	(sim_timer0_flags ())
+extern volatile uint16_t	ADC, OCR1A, TCNT1;
+
+#define	ADEN	7
+#define	ADSC	6
+#define	ADIF	4
+#define	ADPS2	2
+#define	ADPS1	1
+#define	ADPS0	0
+
+#define	PB1		1
+#define	PB2		2
+#define	PB3		3
+#define	PB4		4
+#define	PB5		5
+#define	PB6		6
+#define	PB7		7
+#define	PG3		3
+
+#define	WGM01	3
+#define	CS01	1
+#define	CS00	0
+#define	OCIE0A	1
+#define	OCF0A	1
+
+#define	WGM12	3
+#define	CS11	1
+#define	OCIE1A	1
+
+#define	ENASTB	1
+#define	ENFG	2
+#define	BOFF	1
+#define	ERRP	0
+#define	CANIT	7
+
+#define	JTRF	4
+#define	WDRF	3
+#define	BORF	2
+#define	EXTRF	1
+#define	PORF	0
+
+#endif
@@ -0,0 +1,19 @@
+//
+//	avr/pgmspace.h
+//	Host simulator stand-in. Program memory is ordinary memory on the host.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#ifndef _SIM_AVR_PGMSPACE_H
+#define _SIM_AVR_PGMSPACE_H
+
+#include <inttypes.h>
+
+#define	PROGMEM
+
+#define	pgm_read_byte(addr)		(*(const uint8_t *)(addr))
+#define	pgm_read_word(addr)		(*(const uint16_t *)(addr))
+#define	pgm_read_dword(addr)	(*(const uint32_t *)(addr))
+
+#endif
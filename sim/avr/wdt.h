@@ -0,0 +1,30 @@
+//
+//	avr/wdt.h
+//	Host simulator stand-in for the hardware watchdog.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#ifndef _SIM_AVR_WDT_H
+#define _SIM_AVR_WDT_H
+
+#include <inttypes.h>
+
+#define	WDTO_15MS	0
+#define	WDTO_30MS	1
+#define	WDTO_60MS	2
+#define	WDTO_120MS	3
+#define	WDTO_250MS	4
+#define	WDTO_500MS	5
+#define	WDTO_1S		6
+#define	WDTO_2S		7
+
+void	sim_wdt_enable (uint8_t timeout);
+void	sim_wdt_disable (void);
+void	sim_wdt_reset (void);
+
+#define	wdt_enable(timeout)	sim_wdt_enable (timeout)
+#define	wdt_disable()		sim_wdt_disable ()
+#define	wdt_reset()			sim_wdt_reset ()
+
+#endif
@@ -0,0 +1,422 @@
+//
+//	boot_sim.c
+//	Runs the bootloader core against the host uploader on a virtual-time
+//	bus, with flash that takes as long to program as the real part's.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+//	Usage: boot_sim [image size] [loss rate] [seed]
+//
+//	This stands on its own rather than on `sim.c', since the bootloader
+//	has its own hardware layer. From the top of the tree:
+//
+//		cc -std=gnu99 -O2 -Wall -I. -Iboot -o boot_sim
+//			sim/boot_sim.c boot/boot.c boot/boot_host.c
+//
+//	Each scenario runs in its own process, so the bootloader starts from
+//	a clean reset every time, like it would on the hardware.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "boot.h"
+#include "boot_host.h"
+
+#define	POLL_US				20		/* one pass of the bootloader loop */
+#define	CAN_BIT_US			2		/* 500 kbit/s */
+#define	FLASH_ERASE_US		4000
+#define	FLASH_WRITE_US		4500
+#define	FLASH_READ_US		2		/* per byte, including the CRC */
+#define	EEPROM_WRITE_US		3300
+#define	QUEUE_SIZE			64
+#define	RX_MOBS				2
+
+#define	FLASH_SIZE			(BOOT_APP_MAX_SIZE)
+#define	EEPROM_SIZE			4096
+
+typedef struct queued_frame_t
+{
+	boot_frame_t	frame;
+	uint64_t		arrival;
+}
+queued_frame_t;
+
+typedef struct queue_t
+{
+	queued_frame_t	frames[QUEUE_SIZE];
+	unsigned		head, tail;
+}
+queue_t;
+
+static uint64_t		now, bus_free;
+static queue_t		to_node, to_host;
+
+static boot_frame_t	rx_mobs[RX_MOBS];
+static unsigned		rx_head, rx_count;
+static unsigned		overruns;
+
+static uint8_t		flash[FLASH_SIZE];
+static uint8_t		page_buffer[BOOT_PAGE_SIZE];
+static uint64_t		flash_busy_until;
+static uint8_t		flash_readable = 1;
+
+static uint8_t		eeprom[EEPROM_SIZE];
+
+static double		loss_rate;
+
+static void
+fail (const char *message)
+{
+	fprintf (stderr, "%.3f ms: %s\n", now / 1000.0, message);
+	exit (1);
+}
+
+//
+//	Frames are serialised on the bus in the order they are sent, with a
+//	worst-case allowance for bit stuffing.
+//
+
+static void
+bus_send (queue_t *queue, const boot_frame_t *frame)
+{
+	queued_frame_t *entry;
+
+	if (queue->tail - queue->head == QUEUE_SIZE)
+		fail ("bus queue overflow");
+
+	if (bus_free < now)
+		bus_free = now;
+
+	bus_free += (47 + 8 * frame->length) * 6 / 5 * CAN_BIT_US;
+
+	entry = &queue->frames[queue->tail++ % QUEUE_SIZE];
+	entry->frame = *frame;
+	entry->arrival = bus_free;
+}
+
+static int
+bus_pop (queue_t *queue, boot_frame_t *frame)
+{
+	queued_frame_t *entry = &queue->frames[queue->head % QUEUE_SIZE];
+
+	if (queue->head == queue->tail || entry->arrival > now)
+		return 0;
+
+	*frame = entry->frame;
+	queue->head++;
+
+	return 1;
+}
+
+//
+//	The bootloader has two receive MObs, read back in the order their frames
+//	arrived; a frame that arrives while both are still full is lost.
+//
+
+static void
+node_step (void)
+{
+	boot_frame_t frame;
+
+	while (bus_pop (&to_node, &frame))
+	{
+		if (rx_count == RX_MOBS)
+		{
+			overruns++;
+			continue;
+		}
+
+		rx_mobs[(rx_head + rx_count++) % RX_MOBS] = frame;
+	}
+
+	boot_poll ();
+	now += POLL_US;
+}
+
+uint8_t
+boot_hal_can_receive (boot_frame_t *frame)
+{
+	if (!rx_count)
+		return 0;
+
+	*frame = rx_mobs[rx_head];
+	rx_head = (rx_head + 1) % RX_MOBS;
+	rx_count--;
+
+	return 1;
+}
+
+uint8_t
+boot_hal_can_send (const boot_frame_t *frame)
+{
+	bus_send (&to_host, frame);
+
+	return 1;
+}
+
+void
+boot_hal_flash_erase (uint32_t addr)
+{
+	if (now < flash_busy_until)
+		fail ("erase while flash busy");
+
+	if (addr % BOOT_PAGE_SIZE || addr >= FLASH_SIZE)
+		fail ("erase of a bad page address");
+
+	memset (&flash[addr], 0xFF, BOOT_PAGE_SIZE);
+	flash_busy_until = now + FLASH_ERASE_US;
+	flash_readable = 0;
+}
+
+void
+boot_hal_flash_fill (uint32_t addr, const uint8_t *data)
+{
+	if (now < flash_busy_until)
+		fail ("fill while flash busy");
+
+	memcpy (page_buffer, data, BOOT_PAGE_SIZE);
+}
+
+void
+boot_hal_flash_write (uint32_t addr)
+{
+	if (now < flash_busy_until)
+		fail ("write while flash busy");
+
+	memcpy (&flash[addr], page_buffer, BOOT_PAGE_SIZE);
+	flash_busy_until = now + FLASH_WRITE_US;
+	flash_readable = 0;
+}
+
+uint8_t
+boot_hal_flash_busy (void)
+{
+	return now < flash_busy_until;
+}
+
+void
+boot_hal_flash_release (void)
+{
+	if (now < flash_busy_until)
+		fail ("release while flash busy");
+
+	flash_readable = 1;
+}
+
+uint8_t
+boot_hal_flash_read (uint32_t addr)
+{
+	if (!flash_readable)
+		fail ("flash read before release");
+
+	now += FLASH_READ_US;
+	return flash[addr];
+}
+
+uint8_t
+boot_hal_eeprom_read (uint16_t addr)
+{
+	return eeprom[addr];
+}
+
+void
+boot_hal_eeprom_write (uint16_t addr, uint8_t data)
+{
+	eeprom[addr] = data;
+	now += EEPROM_WRITE_US;
+}
+
+uint16_t
+boot_hal_millis (void)
+{
+	return (uint16_t)(now / 1000);
+}
+
+//
+//	Host side. Lost frames are dropped before they reach the bus, and
+//	replies are only seen once the bootloader has run long enough to send
+//	them.
+//
+
+static void
+host_send (void *context, const boot_frame_t *frame)
+{
+	boot_frame_t copy = *frame;
+
+	if (rand () < loss_rate * RAND_MAX)
+	{
+		if (rand () & 1)
+			return;
+
+		copy.data[rand () % copy.length] ^= 0x10;	/* 1 */
+	}
+
+	bus_send (&to_node, &copy);
+}
+
+//
+//	1.	Half of the faults get onto the bus corrupted instead, which only
+//		the page CRC catches. Real CAN would catch these too, but it is the
+//		bootloader's own check being tested here.
+//
+
+static uint8_t
+host_receive (void *context, boot_frame_t *frame, uint32_t timeout)
+{
+	uint64_t deadline = now + timeout * 1000ULL;
+
+	while (now < deadline)
+	{
+		if (bus_pop (&to_host, frame))
+			return 1;
+
+		node_step ();
+	}
+
+	return 0;
+}
+
+static int
+scenario_upload (uint32_t size)
+{
+	static uint8_t		image[FLASH_SIZE];
+	boot_host_link_t	link = { host_send, host_receive, NULL };
+	boot_host_stats_t	stats;
+	uint64_t			start;
+	uint64_t			ideal;
+	uint32_t			i;
+
+	for (i = 0; i < size; i++)
+		image[i] = rand ();
+
+	if (!boot_init ())
+		fail ("bootloader did not stay with no application");
+
+	start = now;
+
+	if (boot_host_upload (&link, image, size, &stats) < 0)
+		fail ("upload failed");
+
+	while (!boot_poll ())
+		now += POLL_US;
+
+	if (memcmp (flash, image, size))
+		fail ("flash does not match the image");
+
+	for (i = size; i % BOOT_PAGE_SIZE; i++)
+	{
+		if (flash[i] != 0xFF)
+			fail ("padding past the end of the image is not erased");
+	}
+
+	if (eeprom[BOOT_EEPROM_VALID] != BOOT_VALID_MAGIC)
+		fail ("application not marked valid");
+
+	ideal = (uint64_t)stats.pages * (BOOT_FRAMES_PER_PAGE * (47 + 64) + 47 + 40) * 6 / 5 * CAN_BIT_US;
+
+	printf ("%u bytes, %u pages in %.1f ms: %.1f kB/s, %.0f%% of the bus\n",
+		size, stats.pages, (now - start) / 1000.0,
+		size / ((now - start) / 1000.0), 100.0 * ideal / (now - start));
+	printf ("%u naks, %u timeouts, %u receive overruns\n", stats.naks, stats.timeouts, overruns);
+
+	return 0;
+}
+
+static int
+scenario_boot (uint8_t request, uint8_t valid, uint8_t expect_stay, uint8_t expect_run)
+{
+	eeprom[BOOT_EEPROM_REQUEST] = request ? BOOT_REQUEST_MAGIC : 0xFF;
+	eeprom[BOOT_EEPROM_VALID] = valid ? BOOT_VALID_MAGIC : 0xFF;
+
+	if (boot_init () != expect_stay)
+		fail ("wrong decision to stay in the bootloader");
+
+	if (eeprom[BOOT_EEPROM_REQUEST] != 0xFF)
+		fail ("request not cleared");
+
+	if (!expect_stay)
+		return 0;
+
+	while (now < (BOOT_REQUEST_TIMEOUT + 1000) * 1000ULL)
+	{
+		if (boot_poll ())
+			break;
+
+		now += POLL_US;
+	}
+
+	if ((now < (BOOT_REQUEST_TIMEOUT + 1000) * 1000ULL) != expect_run)
+		fail ("wrong decision to run the application after the timeout");
+
+	return 0;
+}
+
+static int
+run (const char *name, int (*scenario)(void))
+{
+	pid_t	pid;
+	int		status;
+
+	fflush (stdout);
+
+	if ((pid = fork ()) == 0)
+		exit (scenario ());
+
+	waitpid (pid, &status, 0);
+
+	if (!WIFEXITED (status) || WEXITSTATUS (status))
+	{
+		printf ("%-32s FAILED\n", name);
+		return 1;
+	}
+
+	printf ("%-32s ok\n\n", name);
+	return 0;
+}
+
+static uint32_t	image_size = 60000;
+
+static int	clean_upload (void)				{ loss_rate = 0; return scenario_upload (image_size); }
+static int	lossy_upload (void)				{ return scenario_upload (image_size); }
+static int	boot_no_application (void)		{ return scenario_boot (0, 0, 1, 0); }
+static int	boot_application (void)			{ return scenario_boot (0, 1, 0, 0); }
+static int	boot_requested (void)			{ return scenario_boot (1, 1, 1, 1); }
+
+int
+main (int argc, char **argv)
+{
+	double	rate = 0.002;
+	int		failures = 0;
+
+	if (argc > 1)
+		image_size = strtoul (argv[1], NULL, 0);
+
+	if (argc > 2)
+		rate = atof (argv[2]);
+
+	srand (argc > 3 ? atoi (argv[3]) : 1);
+
+	if (image_size == 0 || image_size > BOOT_APP_MAX_SIZE)
+	{
+		fprintf (stderr, "image size must be 1 to %d bytes\n", BOOT_APP_MAX_SIZE);
+		return 2;
+	}
+
+	memset (flash, 0xFF, sizeof (flash));
+	memset (eeprom, 0xFF, sizeof (eeprom));
+
+	failures += run ("clean upload", clean_upload);
+
+	loss_rate = rate;
+	failures += run ("lossy upload", lossy_upload);
+
+	failures += run ("boot, no application", boot_no_application);
+	failures += run ("boot, valid application", boot_application);
+	failures += run ("boot, requested, timed out", boot_requested);
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,269 @@
+//
+//	can.c
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#include <string.h>
+
+#include <avr/io.h>
+
+#include "can.h"
+#include "sim.h"
+
+#define	SIM_CAN_QUEUE_LENGTH	64
+
+typedef struct sim_mob_t
+{
+	mob_config_t	config;
+	uint8_t			data[8];
+	uint8_t			length;
+	uint8_t			rx_ready;
+	uint8_t			tx_pending;		/* a frame is waiting on the bus */
+}
+sim_mob_t;
+
+typedef struct sim_queued_frame_t
+{
+	sim_frame_t		frame;
+	int8_t			mob_index;		/* sending mob, or -1 for a bus node */
+}
+sim_queued_frame_t;
+
+static sim_mob_t			mobs[SIM_CAN_MOB_COUNT];
+
+static sim_queued_frame_t	queue[SIM_CAN_QUEUE_LENGTH];
+static uint8_t				queue_head, queue_count;
+static uint64_t				bus_free_time;
+
+static uint64_t				noise_until;
+
+static void (*node_hook)(const sim_frame_t *frame);
+
+//
+//	Queue a frame behind everything already on the bus. The frame length
+//	in bits is the standard frame overhead plus the payload, with an
+//	allowance for stuff bits.
+//
+
+static uint64_t
+sim_can_queue_frame (int8_t mob_index, uint16_t id, const uint8_t *data, uint8_t length)
+{
+	sim_queued_frame_t	*queued;
+	uint32_t			bits;
+	uint64_t			start;
+
+	if (queue_count == SIM_CAN_QUEUE_LENGTH)
+		sim_fail ("can bus queue overflow");
+
+	bits = 47 + 8 * length;
+	bits += (34 + 8 * length) / 5;
+
+	start = (bus_free_time > sim_now ()) ? bus_free_time : sim_now ();
+	bus_free_time = start + bits * SIM_CAN_BIT_US;
+
+	queued = &queue[(queue_head + queue_count++) % SIM_CAN_QUEUE_LENGTH];
+	queued->mob_index = mob_index;
+	queued->frame.id = id;
+	queued->frame.length = length;
+	queued->frame.time = bus_free_time;
+	memcpy (queued->frame.data, data, length);
+
+	return bus_free_time;
+}
+
+void
+can_init (void)
+{
+	memset (mobs, 0, sizeof (mobs));
+
+	CANGCON = _BV (ENASTB);
+	CANGSTA = _BV (ENFG);
+	CANTEC = CANREC = 0;
+}
+
+void
+can_config_mob (uint8_t mob_index, mob_config_t *mob_config)
+{
+	if (mob_index >= SIM_CAN_MOB_COUNT)
+		sim_fail ("can_config_mob: no mob %u", mob_index);
+
+	mobs[mob_index].config = *mob_config;
+	mobs[mob_index].rx_ready = 0;
+	mobs[mob_index].tx_pending = 0;
+}
+
+void
+can_ready_to_receive (uint8_t mob_index)
+{
+	mobs[mob_index].rx_ready = 1;
+}
+
+void
+can_ready_to_send (uint8_t mob_index)
+{
+	sim_mob_t	*mob = &mobs[mob_index];
+	uint64_t	start = sim_profile_begin ();
+
+	if (!(CANGSTA & _BV (ENFG)) || mob->tx_pending)
+		return;
+
+	mob->tx_pending = 1;
+	sim_can_queue_frame (mob_index, mob->config.id, mob->data, mob->length);
+
+	sim_profile_end (start, &sim_profile_get ()->can_ns);
+	sim_profile_get ()->frames++;
+}
+
+void
+can_load_data (uint8_t mob_index, uint8_t *data, uint8_t length)
+{
+	uint64_t start = sim_profile_begin ();
+
+	if (length > 8)
+		sim_fail ("can_load_data: %u bytes on mob %u", length, mob_index);
+
+	memcpy (mobs[mob_index].data, data, length);
+	mobs[mob_index].length = length;
+
+	sim_profile_end (start, &sim_profile_get ()->can_ns);
+}
+
+void
+can_read_data (uint8_t mob_index, uint8_t *data, uint8_t length)
+{
+	memcpy (data, mobs[mob_index].data, length);
+}
+
+uint64_t
+sim_can_send (uint16_t id, const uint8_t *data, uint8_t length)
+{
+	return sim_can_queue_frame (-1, id, data, length);
+}
+
+void
+sim_can_set_node_hook (void (*hook)(const sim_frame_t *frame))
+{
+	node_hook = hook;
+}
+
+uint64_t
+sim_can_next_delivery (void)
+{
+	return queue_count ? queue[queue_head].frame.time : UINT64_MAX;
+}
+
+//
+//	A frame from a bus node goes to the first armed mob whose masked ID
+//	matches, like the hardware acceptance filter. The mob is disarmed until
+//	the firmware calls `can_ready_to_receive' again; if nothing is armed
+//	the frame is lost.
+//
+
+static void
+sim_can_deliver_to_firmware (const sim_frame_t *frame)
+{
+	uint8_t i;
+
+	for (i = 0; i < SIM_CAN_MOB_COUNT; i++)
+	{
+		sim_mob_t *mob = &mobs[i];
+
+		if (!mob->rx_ready || (frame->id & mob->config.mask) != (mob->config.id & mob->config.mask))
+			continue;
+
+		memcpy (mob->data, frame->data, frame->length);
+		mob->length = frame->length;
+		mob->rx_ready = 0;
+
+		if (mob->config.rx_callback_ptr)
+			mob->config.rx_callback_ptr (i, frame->id, data);
+
+		return;
+	}
+}
+
+int
+sim_can_deliver (uint64_t now)
+{
+	int delivered = 0;
+
+	while (queue_count && queue[queue_head].frame.time <= now)
+	{
+		sim_queued_frame_t queued = queue[queue_head];
+
+		queue_head = (queue_head + 1) % SIM_CAN_QUEUE_LENGTH;
+		queue_count--;
+
+		if (queued.mob_index < 0)
+		{
+			if (CANGSTA & _BV (ENFG))
+				sim_can_deliver_to_firmware (&queued.frame);
+
+			continue;
+		}
+
+		if (!mobs[queued.mob_index].tx_pending)
+			continue;		/* 1 */
+
+		queued.frame.id = mobs[queued.mob_index].config.id;
+		queued.frame.length = mobs[queued.mob_index].length;
+		memcpy (queued.frame.data, mobs[queued.mob_index].data, queued.frame.length);
+		mobs[queued.mob_index].tx_pending = 0;
+
+		if (mobs[queued.mob_index].config.tx_callback_ptr)
+			mobs[queued.mob_index].config.tx_callback_ptr (queued.mob_index, queued.frame.id, data);
+
+		if (node_hook)
+			node_hook (&queued.frame);
+
+		delivered = 1;
+	}
+
+	return delivered;
+}
+
+//
+//	1.	The message object was set up again, or went bus-off, before the
+//		frame got out, so it was dropped. Its slot on the bus goes unused.
+//
+
+void
+sim_can_reset (void)
+{
+	queue_head = queue_count = 0;
+	bus_free_time = 0;
+	can_init ();
+}
+
+void
+sim_can_bus_off (uint64_t duration)
+{
+	uint8_t i;
+
+	for (i = 0; i < SIM_CAN_MOB_COUNT; i++)
+		mobs[i].rx_ready = mobs[i].tx_pending = 0;
+
+	CANGCON &= ~_BV (ENASTB);
+	CANGSTA = _BV (BOFF);
+	CANTEC = 255;
+
+	noise_until = sim_now () + duration;
+}
+
+void
+sim_can_update_status (void)
+{
+	uint64_t quiet;
+
+	if (!(CANGSTA & _BV (BOFF)) || !(CANGCON & _BV (ENASTB)))
+		return;
+
+	quiet = (noise_until > bus_free_time) ? noise_until : bus_free_time;
+
+	if (sim_now () >= quiet + 128 * 11 * SIM_CAN_BIT_US)
+	{
+		CANGSTA = _BV (ENFG);
+		CANTEC = CANREC = 0;
+	}
+}
@@ -0,0 +1,80 @@
+//
+//	can.h
+//	Host simulator stand-in for libcan. The message objects are attached
+//	to a simulated bus shared with the scripted nodes in the simulator.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#ifndef _SIM_CAN_H
+#define _SIM_CAN_H
+
+#include <inttypes.h>
+
+#define	SIM_CAN_MOB_COUNT	15
+
+typedef enum packet_type_t
+{
+	data,
+	remote
+}
+packet_type_t;
+
+typedef enum id_type_t
+{
+	standard,
+	extended
+}
+id_type_t;
+
+typedef void (*can_callback_t)(uint8_t mob_index, uint32_t id, packet_type_t type);
+
+typedef struct mob_config_t
+{
+	id_type_t		id_type;
+	uint32_t		id;
+	uint32_t		mask;
+	can_callback_t	rx_callback_ptr;
+	can_callback_t	tx_callback_ptr;
+}
+mob_config_t;
+
+void
+can_init (void);
+
+void
+can_config_mob
+(
+	uint8_t			mob_index,
+	mob_config_t	*mob_config
+);
+
+void
+can_ready_to_receive
+(
+	uint8_t	mob_index
+);
+
+void
+can_ready_to_send
+(
+	uint8_t	mob_index
+);
+
+void
+can_load_data
+(
+	uint8_t	mob_index,
+	uint8_t	*data,
+	uint8_t	length
+);
+
+void
+can_read_data
+(
+	uint8_t	mob_index,
+	uint8_t	*data,
+	uint8_t	length
+);
+
+#endif
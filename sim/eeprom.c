@@ -0,0 +1,76 @@
+//
+//	eeprom.c
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#include <string.h>
+
+#include <avr/eeprom.h>
+
+#include "eeprom.h"
+#include "sim.h"
+
+uint8_t sim_eeprom[SIM_EEPROM_SIZE] = { [0 ... SIM_EEPROM_SIZE - 1] = 0xFF };	/* erased */
+
+static uint64_t busy_until;
+
+static void
+sim_eeprom_wait (void)
+{
+	if (sim_now () < busy_until)
+		sim_advance (busy_until - sim_now ());
+}
+
+void
+eeprom_read_many (uint16_t addr, uint8_t *data, uint16_t length)
+{
+	if ((uint32_t)addr + length > SIM_EEPROM_SIZE)
+		sim_fail ("eeprom read past end at 0x%04x", addr);
+
+	sim_eeprom_wait ();
+	memcpy (data, &sim_eeprom[addr], length);
+	sim_advance (SIM_EEPROM_READ_US * length);
+}
+
+void
+eeprom_write_many (uint16_t addr, uint8_t *data, uint16_t length)
+{
+	if ((uint32_t)addr + length > SIM_EEPROM_SIZE)
+		sim_fail ("eeprom write past end at 0x%04x", addr);
+
+	sim_eeprom_wait ();
+	memcpy (&sim_eeprom[addr], data, length);
+	sim_advance (SIM_EEPROM_WRITE_US * length);
+}
+
+uint8_t
+eeprom_is_ready (void)
+{
+	return sim_now () >= busy_until;
+}
+
+uint8_t
+eeprom_read_byte (const uint8_t *addr)
+{
+	uint16_t index = (uint16_t)(uintptr_t)addr;
+
+	if (index >= SIM_EEPROM_SIZE)
+		sim_fail ("eeprom read past end at 0x%04x", index);
+
+	sim_eeprom_wait ();
+	return sim_eeprom[index];
+}
+
+void
+eeprom_write_byte (uint8_t *addr, uint8_t value)
+{
+	uint16_t index = (uint16_t)(uintptr_t)addr;
+
+	if (index >= SIM_EEPROM_SIZE)
+		sim_fail ("eeprom write past end at 0x%04x", index);
+
+	sim_eeprom_wait ();
+	sim_eeprom[index] = value;
+	busy_until = sim_now () + SIM_EEPROM_WRITE_US;
+}
@@ -0,0 +1,31 @@
+//
+//	eeprom.h
+//	Host simulator stand-in for libeeprom, backed by a RAM array.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#ifndef _SIM_EEPROM_H
+#define _SIM_EEPROM_H
+
+#include <inttypes.h>
+
+#define	SIM_EEPROM_SIZE		4096
+
+void
+eeprom_read_many
+(
+	uint16_t	addr,
+	uint8_t		*data,
+	uint16_t	length
+);
+
+void
+eeprom_write_many
+(
+	uint16_t	addr,
+	uint8_t		*data,
+	uint16_t	length
+);
+
+#endif
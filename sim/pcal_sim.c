@@ -0,0 +1,311 @@
+//
+//	pcal_sim.c
+//	Runs the pressure calibration handshake against a scripted driver node
+//	and reports message-to-state-change latency for each step.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+//	Usage: pcal_sim [runs] [seed]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#undef	main	/* renamed for the firmware only, see `sim.h' */
+
+#include "can_config.h"
+
+#include "adc.h"
+#include "error.h"
+#include "pressure.h"
+#include "sim.h"
+#include "state.h"
+
+#define	PCAL_ID				((MODULE_ID << 8) | msg_id_pressure_calibration)
+#define	ERROR_ID			((MODULE_ID << 8) | msg_id_error)
+
+#define	PLANT_TAU_MS		40.0	/* hydraulic response */
+#define	PLANT_NOISE_PSI		1.0
+#define	DRIVER_REACTION_MS	150		/* request seen -> pedal moved */
+#define	DRIVER_SETTLE_MS	300		/* pedal moved -> reply sent */
+#define	DRIVER_REST_MS		100		/* between runs */
+#define	FAIL_RATE			0.1		/* fraction of runs with too little delta */
+#define	PSI_TOLERANCE		4		/* stored vs. applied pressure */
+
+extern uint8_t sim_eeprom[];
+
+typedef enum step_t
+{
+	step_begin,					/* begin -> state_pcal_request_min */
+	step_min_applied,			/* min applied -> state_pcal_sample_min */
+	step_max_applied,			/* max applied -> state_pcal_sample_max */
+	step_apply_min_reply,		/* begin -> apply min frame */
+	step_apply_max_reply,		/* min applied -> apply max frame */
+	step_result_reply,			/* max applied -> ok/failed frame */
+	step_count
+}
+step_t;
+
+static const char *step_names[step_count] =
+{
+	"begin -> request_min",
+	"min_applied -> sample_min",
+	"max_applied -> sample_max",
+	"begin -> apply_min frame",
+	"min_applied -> apply_max frame",
+	"max_applied -> result frame"
+};
+
+typedef struct latency_t
+{
+	uint32_t	count;
+	uint64_t	total, min, max;
+}
+latency_t;
+
+static latency_t	latencies[step_count];
+
+typedef enum driver_action_t
+{
+	action_none,
+	action_begin,
+	action_send_min_applied,
+	action_send_max_applied
+}
+driver_action_t;
+
+static driver_action_t	next_action;
+static uint64_t			next_action_time;
+
+static uint64_t		begin_time, min_applied_time, max_applied_time;
+
+static double		front_min, front_max, rear_min, rear_max;
+static int			expect_failure;
+
+static uint32_t		runs_done, runs_ok, runs_failed, mismatches, error_frames;
+
+static void
+latency_record (step_t step, uint64_t from, uint64_t to)
+{
+	latency_t	*latency = &latencies[step];
+	uint64_t	us = to - from;
+
+	if (!latency->count || us < latency->min)
+		latency->min = us;
+
+	if (us > latency->max)
+		latency->max = us;
+
+	latency->total += us;
+	latency->count++;
+}
+
+static void
+driver_schedule (driver_action_t action, uint64_t delay_us)
+{
+	next_action = action;
+	next_action_time = sim_now () + delay_us;
+}
+
+static void
+driver_send (pcal_msg_t message)
+{
+	uint8_t		data = message;
+	uint64_t	arrival;
+
+	arrival = sim_can_send (PCAL_ID, &data, 1);
+
+	if (message == pcal_msg_begin_calibration)			begin_time = arrival;
+	else if (message == pcal_msg_min_pressure_applied)	min_applied_time = arrival;
+	else if (message == pcal_msg_max_pressure_applied)	max_applied_time = arrival;
+}
+
+static void
+driver_apply (double front, double rear)
+{
+	sim_plant_set_target (adc_chan_front_pressure, front, PLANT_TAU_MS);
+	sim_plant_set_target (adc_chan_rear_pressure, rear, PLANT_TAU_MS);
+}
+
+static uint16_t
+eeprom_word (uint16_t addr)
+{
+	return (uint16_t)(sim_eeprom[addr] << 8) | sim_eeprom[addr + 1];
+}
+
+static int
+within_tolerance (uint16_t stored, double applied)
+{
+	return stored >= applied - PSI_TOLERANCE && stored <= applied + PSI_TOLERANCE;
+}
+
+static void
+driver_check_result (pcal_msg_t result)
+{
+	int ok = 1;
+
+	if (result == pcal_msg_calibration_ok)
+	{
+		runs_ok++;
+
+		ok = !expect_failure &&
+			within_tolerance (eeprom_word (front_min_pressure_addr), front_min) &&
+			within_tolerance (eeprom_word (front_max_pressure_addr), front_max) &&
+			within_tolerance (eeprom_word (rear_min_pressure_addr), rear_min) &&
+			within_tolerance (eeprom_word (rear_max_pressure_addr), rear_max);
+	}
+	else
+	{
+		runs_failed++;
+		ok = expect_failure;
+	}
+
+	if (!ok)
+	{
+		mismatches++;
+		fprintf (stderr, "run %u: unexpected %s (front %.1f..%.1f, rear %.1f..%.1f psi)\n",
+			runs_done, (result == pcal_msg_calibration_ok) ? "ok" : "failure",
+			front_min, front_max, rear_min, rear_max);
+	}
+
+	runs_done++;
+}
+
+static void
+driver_rx_hook (const sim_frame_t *frame)
+{
+	if (frame->id == ERROR_ID)
+	{
+		error_frames++;
+		return;
+	}
+
+	if (frame->id != PCAL_ID || frame->length < 1)
+		return;
+
+	switch (frame->data[0])
+	{
+		case pcal_msg_apply_min_pressure:
+
+			latency_record (step_apply_min_reply, begin_time, frame->time);
+			driver_apply (front_min, rear_min);
+			driver_schedule (action_send_min_applied, (DRIVER_REACTION_MS + DRIVER_SETTLE_MS) * 1000ULL);
+
+			break;
+
+		case pcal_msg_apply_max_pressure:
+
+			latency_record (step_apply_max_reply, min_applied_time, frame->time);
+			driver_apply (front_max, rear_max);
+			driver_schedule (action_send_max_applied, (DRIVER_REACTION_MS + DRIVER_SETTLE_MS) * 1000ULL);
+
+			break;
+
+		case pcal_msg_calibration_ok:
+		case pcal_msg_calibration_failed:
+
+			latency_record (step_result_reply, max_applied_time, frame->time);
+			driver_check_result (frame->data[0]);
+			driver_apply (0.0, 0.0);
+			driver_schedule (action_begin, DRIVER_REST_MS * 1000ULL);
+
+			break;
+	}
+}
+
+static void
+state_hook (state_t from, state_t to, uint64_t time)
+{
+	switch (to)
+	{
+		case state_pcal_request_min:	latency_record (step_begin, begin_time, time); 				break;
+		case state_pcal_sample_min:		latency_record (step_min_applied, min_applied_time, time); 	break;
+		case state_pcal_sample_max:		latency_record (step_max_applied, max_applied_time, time); 	break;
+		default:																					break;
+	}
+}
+
+static void
+driver_begin (void)
+{
+	front_min = 10.0 + 60.0 * sim_random ();
+	rear_min = front_min * (0.6 + 0.3 * sim_random ());
+
+	expect_failure = sim_random () < FAIL_RATE;
+
+	if (expect_failure)
+	{
+		front_max = front_min + 0.5 * PRESSURE_CALIBRATION_MIN_DIFF;
+		rear_max = rear_min + 0.5 * PRESSURE_CALIBRATION_MIN_DIFF;
+	}
+	else
+	{
+		front_max = 600.0 + 800.0 * sim_random ();
+		rear_max = front_max * (0.6 + 0.3 * sim_random ());
+	}
+
+	driver_send (pcal_msg_begin_calibration);
+	next_action = action_none;
+}
+
+int
+main (int argc, char **argv)
+{
+	uint32_t	runs = (argc > 1) ? strtoul (argv[1], 0, 0) : 1000;
+	uint32_t	seed = (argc > 2) ? strtoul (argv[2], 0, 0) : 1;
+	clock_t		wall_start, wall;
+	step_t		step;
+
+	sim_seed (seed);
+	sim_plant_set_noise (PLANT_NOISE_PSI);
+	sim_can_set_node_hook (driver_rx_hook);
+	sim_set_state_hook (state_hook);
+
+	wall_start = clock ();
+	sim_boot ();
+
+	driver_schedule (action_begin, DRIVER_REST_MS * 1000ULL);
+
+	while (runs_done < runs)
+	{
+		uint64_t until = (next_action == action_none) ? sim_now () + 10000000ULL : next_action_time;
+
+		if (sim_run_until (until))
+			continue;
+
+		switch (next_action)
+		{
+			case action_begin:				driver_begin (); 								break;
+			case action_send_min_applied:	driver_send (pcal_msg_min_pressure_applied); 	break;
+			case action_send_max_applied:	driver_send (pcal_msg_max_pressure_applied); 	break;
+			case action_none:				sim_fail ("driver stalled in state %d", state_get_current_state ());
+		}
+
+		if (next_action != action_begin)
+			next_action = action_none;
+	}
+
+	wall = clock () - wall_start;
+
+	printf ("%u runs: %u ok, %u failed, %u error frames, %u mismatches\n",
+		runs_done, runs_ok, runs_failed, error_frames, mismatches);
+
+	printf ("%.1f s virtual in %.3f s host (%.0fx real time)\n\n",
+		sim_now () / 1e6, (double)wall / CLOCKS_PER_SEC,
+		(sim_now () / 1e6) / ((double)(wall ? wall : 1) / CLOCKS_PER_SEC));
+
+	printf ("%-32s %8s %10s %10s %10s\n", "step", "count", "min us", "mean us", "max us");
+
+	for (step = 0; step < step_count; step++)
+	{
+		latency_t *latency = &latencies[step];
+
+		printf ("%-32s %8u %10llu %10.1f %10llu\n", step_names[step], latency->count,
+			(unsigned long long)latency->min,
+			latency->count ? (double)latency->total / latency->count : 0.0,
+			(unsigned long long)latency->max);
+	}
+
+	return mismatches ? 1 : 0;
+}
@@ -0,0 +1,302 @@
+//
+//	replay_sim.c
+//	Replays a recorded pressure trace through the firmware's sampling,
+//	conversion and broadcast path, captures the frames it sends and reports
+//	how fast the host got through it, stage by stage.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+//	Usage: replay_sim <trace> <frames.log>
+//
+//	Built like `pcal_sim', with `sim/replay_sim.c' in its place.
+//
+//	A trace is either text or binary, told apart by its first byte. Text
+//	traces have one sample per line, as comma-separated time (ms) and
+//	front and rear pressure (psi):
+//
+//		# time_ms,front_psi,rear_psi
+//		0.0,12.5,9.0
+//		1.0,12.8,9.1
+//
+//	Binary traces are the raw ADC codes, as little-endian records of
+//	{ uint32_t time_us; uint16_t front; uint16_t rear; }, starting with
+//	the magic "PTRC". Either way the times have to be increasing, and each
+//	sample holds until the next one. Pressures are turned into codes with
+//	the nominal sensor scaling, so calibrate nothing and the firmware reads
+//	them back as they were logged.
+//
+//	The frames are written in the `candump -l' format, with the virtual
+//	time as the time stamp, so they can be fed straight to the usual tools.
+//
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#undef	main	/* renamed for the firmware only, see `sim.h' */
+
+#include "adc.h"
+#include "pressure.h"
+#include "sim.h"
+
+#define	BINARY_MAGIC		"PTRC"
+#define	BINARY_RECORD_SIZE	8
+#define	TRACE_GROW			4096		/* samples */
+#define	CLOCK_READINGS		100000		/* for the clock overhead */
+
+typedef struct trace_sample_t
+{
+	uint64_t	time;		/* us */
+	uint16_t	front;		/* ADC codes */
+	uint16_t	rear;
+}
+trace_sample_t;
+
+static trace_sample_t	*trace;
+static size_t			trace_length, trace_size;
+static size_t			trace_index;
+
+static FILE				*frames_file;
+static uint64_t			frames_captured;
+
+static void
+trace_append (uint64_t time, uint16_t front, uint16_t rear)
+{
+	if (trace_length && time <= trace[trace_length - 1].time)
+		sim_fail ("trace sample %zu is out of order", trace_length);
+
+	if (trace_length == trace_size)
+	{
+		trace_size += TRACE_GROW;
+
+		if (!(trace = realloc (trace, trace_size * sizeof (*trace))))
+			sim_fail ("out of memory for the trace");
+	}
+
+	trace[trace_length].time = time;
+	trace[trace_length].front = front;
+	trace[trace_length].rear = rear;
+	trace_length++;
+}
+
+//
+//	The nominal sensor scaling, the same as the plant model's.
+//
+
+static uint16_t
+psi_to_code (double psi)
+{
+	long code = lround (psi / PSI_PER_VOLT * 1024.0 / SIM_ADC_VREF);
+
+	return (code < 0) ? 0 : (code > 1023) ? 1023 : code;
+}
+
+static void
+trace_load_text (FILE *file)
+{
+	char	line[256];
+	double	time, front, rear;
+	char	*p;
+
+	while (fgets (line, sizeof (line), file))
+	{
+		for (p = line; isspace ((unsigned char)*p); p++)
+			;
+
+		if (*p == '#' || *p == 0)
+			continue;
+
+		if (sscanf (p, "%lf ,%lf ,%lf", &time, &front, &rear) != 3)
+		{
+			if (!trace_length && isalpha ((unsigned char)*p))
+				continue;		/* 1 */
+
+			sim_fail ("can't read trace line: %s", line);
+		}
+
+		trace_append ((uint64_t)llround (time * 1000.0), psi_to_code (front), psi_to_code (rear));
+	}
+}
+
+//
+//	1.	A header line, as spreadsheets write them.
+//
+
+static void
+trace_load_binary (FILE *file)
+{
+	uint8_t record[BINARY_RECORD_SIZE];
+
+	while (fread (record, 1, BINARY_RECORD_SIZE, file) == BINARY_RECORD_SIZE)
+	{
+		trace_append
+		(
+			record[0] | (record[1] << 8) | ((uint32_t)record[2] << 16) | ((uint32_t)record[3] << 24),
+			record[4] | (record[5] << 8),
+			record[6] | (record[7] << 8)
+		);
+	}
+}
+
+static void
+trace_load (const char *path)
+{
+	char	magic[4];
+	FILE	*file;
+
+	if (!(file = fopen (path, "rb")))
+		sim_fail ("can't open %s", path);
+
+	if (fread (magic, 1, 4, file) == 4 && !memcmp (magic, BINARY_MAGIC, 4))
+	{
+		trace_load_binary (file);
+	}
+	else
+	{
+		rewind (file);
+		trace_load_text (file);
+	}
+
+	fclose (file);
+
+	if (!trace_length)
+		sim_fail ("%s has no samples", path);
+}
+
+//
+//	ADC source. Moves through the trace as the virtual clock does.
+//
+
+static uint16_t
+trace_source (uint8_t channel)
+{
+	while (trace_index + 1 < trace_length && trace[trace_index + 1].time <= sim_now ())
+		trace_index++;
+
+	switch (channel)
+	{
+		case adc_chan_front_pressure:	return trace[trace_index].front;
+		case adc_chan_rear_pressure:	return trace[trace_index].rear;
+		default:						return 0;
+	}
+}
+
+static void
+capture_hook (const sim_frame_t *frame)
+{
+	uint8_t i;
+
+	fprintf (frames_file, "(%llu.%06llu) sim %03X#",
+		(unsigned long long)(frame->time / 1000000), (unsigned long long)(frame->time % 1000000),
+		frame->id);
+
+	for (i = 0; i < frame->length; i++)
+		fprintf (frames_file, "%02X", frame->data[i]);
+
+	fputc ('\n', frames_file);
+	frames_captured++;
+}
+
+//
+//	Host cost of reading the clock, once at the start and once at the end
+//	of a stage. Every stage figure below includes it.
+//
+
+static double
+clock_overhead_ns (void)
+{
+	uint64_t	total = 0, start;
+	uint32_t	i;
+
+	sim_profile_start ();
+
+	for (i = 0; i < CLOCK_READINGS; i++)
+	{
+		start = sim_profile_begin ();
+		sim_profile_end (start, &total);
+	}
+
+	return (double)total / CLOCK_READINGS;
+}
+
+static double
+per_op (uint64_t ns, uint64_t count)
+{
+	return count ? (double)ns / count : 0.0;
+}
+
+int
+main (int argc, char **argv)
+{
+	sim_profile_t	*profile;
+	struct timespec	start, end;
+	uint64_t		until, other_ns;
+	double			host, overhead;
+
+	if (argc != 3)
+	{
+		fprintf (stderr, "usage: %s <trace> <frames.log>\n", argv[0]);
+		return 2;
+	}
+
+	trace_load (argv[1]);
+
+	if (!strcmp (argv[2], "-"))
+		frames_file = stdout;
+	else if (!(frames_file = fopen (argv[2], "w")))
+		sim_fail ("can't write %s", argv[2]);
+
+	overhead = clock_overhead_ns ();
+
+	sim_adc_set_source (trace_source);
+	sim_can_set_node_hook (capture_hook);
+	sim_boot ();
+
+	until = trace[trace_length - 1].time + SIM_TICK_US;
+
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	sim_profile_start ();
+
+	while (sim_now () < until)		/* 1 */
+		sim_run_until (until);
+
+	clock_gettime (CLOCK_MONOTONIC, &end);
+
+	if (frames_file != stdout)
+		fclose (frames_file);
+
+	profile = sim_profile_get ();
+	host = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	other_ns = profile->tick_ns - profile->sample_ns - profile->can_ns;
+
+	if (profile->sample_ns + profile->can_ns > profile->tick_ns)
+		other_ns = 0;
+
+	fprintf (stderr, "%zu trace samples, %.3f s virtual in %.3f s host (%.0fx real time)\n",
+		trace_length, sim_now () / 1e6, host, (sim_now () / 1e6) / host);
+
+	fprintf (stderr, "%llu ADC samples at %.0f per second, %llu frames captured\n\n",
+		(unsigned long long)profile->samples, profile->samples / host,
+		(unsigned long long)frames_captured);
+
+	fprintf (stderr, "%-28s %12s %12s\n", "stage", "count", "ns each");
+	fprintf (stderr, "%-28s %12llu %12.1f\n", "timer interrupt", (unsigned long long)profile->ticks,
+		per_op (profile->tick_ns, profile->ticks));
+	fprintf (stderr, "%-28s %12llu %12.1f\n", "  ADC sample", (unsigned long long)profile->samples,
+		per_op (profile->sample_ns, profile->samples));
+	fprintf (stderr, "%-28s %12llu %12.1f\n", "  CAN frame", (unsigned long long)profile->frames,
+		per_op (profile->can_ns, profile->frames));
+	fprintf (stderr, "%-28s %12llu %12.1f\n", "  conversion and the rest", (unsigned long long)profile->ticks,
+		per_op (other_ns, profile->ticks));
+	fprintf (stderr, "\n%.1f ns of each figure is reading the clock\n", overhead);
+
+	return 0;
+}
+
+//
+//	1.	`sim_run_until' stops early for every frame delivered, which here
+//		means every broadcast.
+//
@@ -0,0 +1,470 @@
+//
+//	sim.c
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <avr/io.h>
+#include <avr/wdt.h>
+
+#include "can_config.h"
+
+#include "adc.h"
+#include "bus.h"
+#include "error.h"
+#include "param.h"
+#include "pressure.h"
+#include "service.h"
+#include "sim.h"
+#include "startup.h"
+#include "state.h"
+#include "stepper.h"
+#include "timer.h"
+#include "watchdog.h"
+
+//
+//	Register file. See `avr/io.h'.
+//
+
+volatile uint8_t	ADCSRA, ADMUX, DDRB, PORTB, DDRG, PORTG;
+volatile uint8_t	TCCR0A, OCR0A, TIMSK0, MCUSR, GPIOR0;
+volatile uint8_t	TCCR1A, TCCR1B, TIMSK1;
+volatile uint8_t	CANGCON, CANGSTA, CANGIT, CANTEC, CANREC, CANPAGE;
+volatile uint16_t	ADC, OCR1A, TCNT1;
+
+//
+//	Firmware entry points from `main.c' that have no header.
+//
+
+void	io_init (void);
+void	TIMER0_COMP_vect (void);
+
+static uint64_t		now;
+static uint64_t		next_tick;
+static uint8_t		in_interrupt;
+
+static uint32_t		random_state = 1;
+
+static uint8_t		wdt_enabled;
+static uint64_t		wdt_timeout;
+static uint64_t		wdt_last_reset;
+
+static void (*state_hook)(state_t from, state_t to, uint64_t time);
+
+typedef struct sim_channel_t
+{
+	double		pressure;		/* psi at `updated' */
+	double		target;			/* psi */
+	double		tau_ms;
+	uint64_t	updated;		/* us */
+}
+sim_channel_t;
+
+static sim_channel_t	channels[SIM_ADC_CHANNELS];
+static double			noise_psi;
+
+static uint16_t (*adc_source)(uint8_t channel);
+
+static uint8_t			profiling;
+static sim_profile_t	profile;
+
+uint64_t
+sim_now (void)
+{
+	return now;
+}
+
+//
+//	Fire every timer tick that is due. Ticks don't nest, so time spent
+//	inside the handler is simply added to the clock.
+//
+
+static void
+sim_fire_ticks (void)
+{
+	if (in_interrupt)
+		return;
+
+	in_interrupt = 1;
+
+	while (now >= next_tick)
+	{
+		uint64_t start = sim_profile_begin ();
+
+		next_tick += SIM_TICK_US;	/* 1 */
+		sim_can_update_status ();
+		TIMER0_COMP_vect ();
+
+		sim_profile_end (start, &profile.tick_ns);
+		profile.ticks++;
+	}
+
+	in_interrupt = 0;
+}
+
+//
+//	1.	The compare flag is cleared on entry to the handler, so the next
+//		tick is what `TIFR0' reports on from inside it.
+//
+
+uint8_t
+sim_timer0_count (void)
+{
+	uint64_t since = now - (next_tick - SIM_TICK_US);
+
+	if (now >= next_tick)
+		since = now - next_tick;
+
+	return (since / 4 > OCR0A) ? OCR0A : since / 4;
+}
+
+uint8_t
+sim_timer0_flags (void)
+{
+	return (now >= next_tick) ? _BV (OCF0A) : 0;
+}
+
+void
+sim_advance (uint64_t us)
+{
+	now += us;
+	sim_fire_ticks ();
+}
+
+void
+sim_fail (const char *format, ...)
+{
+	va_list args;
+
+	fprintf (stderr, "sim: %.3f ms: ", now / 1000.0);
+
+	va_start (args, format);
+	vfprintf (stderr, format, args);
+	va_end (args);
+
+	fputc ('\n', stderr);
+	exit (2);
+}
+
+//
+//	Host time profile.
+//
+
+void
+sim_profile_start (void)
+{
+	memset (&profile, 0, sizeof (profile));
+	profiling = 1;
+}
+
+sim_profile_t *
+sim_profile_get (void)
+{
+	return &profile;
+}
+
+uint64_t
+sim_profile_begin (void)
+{
+	struct timespec ts;
+
+	if (!profiling)
+		return 0;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void
+sim_profile_end (uint64_t start, uint64_t *total)
+{
+	if (start)
+		*total += sim_profile_begin () - start;
+}
+
+void
+sim_seed (uint32_t seed)
+{
+	random_state = seed ? seed : 1;
+}
+
+double
+sim_random (void)
+{
+	random_state ^= random_state << 13;		/* xorshift32 */
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+
+	return random_state / 4294967296.0;
+}
+
+//
+//	Busy waits.
+//
+
+void
+_delay_ms (double ms)
+{
+	sim_advance ((uint64_t)(ms * 1000.0));
+}
+
+void
+_delay_us (double us)
+{
+	sim_advance ((uint64_t)us);
+}
+
+//
+//	Stack instrumentation. `stack.c' measures the AVR's own RAM, which has
+//	nothing to do with the host's stack, so it isn't built here.
+//
+
+void
+stack_scan (void)
+{
+}
+
+//
+//	Hardware watchdog. The supervisor forces a reset by enabling the
+//	shortest timeout and spinning, which would hang the host, so that
+//	case fails the simulation straight away.
+//
+
+void
+sim_wdt_enable (uint8_t timeout)
+{
+	if (timeout == WDTO_15MS)
+		sim_fail ("watchdog reset forced by supervisor");
+
+	wdt_enabled = 1;
+	wdt_timeout = 15000ULL << timeout;
+	wdt_last_reset = now;
+}
+
+void
+sim_wdt_disable (void)
+{
+	wdt_enabled = 0;
+}
+
+void
+sim_wdt_reset (void)
+{
+	wdt_last_reset = now;
+}
+
+//
+//	Pressure plant and ADC.
+//
+
+static void
+sim_plant_update (sim_channel_t *channel)
+{
+	double dt_ms = (now - channel->updated) / 1000.0;
+
+	if (channel->tau_ms > 0.0)
+		channel->pressure += (channel->target - channel->pressure) * (1.0 - exp (-dt_ms / channel->tau_ms));
+	else
+		channel->pressure = channel->target;
+
+	channel->updated = now;
+}
+
+void
+sim_plant_set_target (uint8_t channel, double psi, double tau_ms)
+{
+	sim_plant_update (&channels[channel]);
+
+	channels[channel].target = psi;
+	channels[channel].tau_ms = tau_ms;
+}
+
+void
+sim_plant_set_noise (double psi)
+{
+	noise_psi = psi;
+}
+
+double
+sim_plant_get_pressure (uint8_t channel)
+{
+	sim_plant_update (&channels[channel]);
+	return channels[channel].pressure;
+}
+
+void
+adc_init (void)
+{
+	ADCSRA |= _BV (ADEN) | _BV (ADPS2) | _BV (ADPS1) | _BV (ADPS0);
+}
+
+void
+sim_adc_set_source (uint16_t (*source)(uint8_t channel))
+{
+	adc_source = source;
+}
+
+uint16_t
+adc_get_sample (uint8_t channel)
+{
+	uint64_t	start = sim_profile_begin ();
+	double		volts;
+	long		code;
+
+	if (adc_source)
+	{
+		code = adc_source (channel);
+	}
+	else
+	{
+		volts = sim_plant_get_pressure (channel) / PSI_PER_VOLT;
+		volts += (2.0 * sim_random () - 1.0) * noise_psi / PSI_PER_VOLT;
+
+		code = lround (volts * 1024.0 / SIM_ADC_VREF);
+	}
+
+	code = (code < 0) ? 0 : (code > 1023) ? 1023 : code;
+
+	ADMUX = channel;
+	ADC = (uint16_t)code;
+	now += 104;		/* 13 adc clocks at 125 kHz */
+
+	sim_profile_end (start, &profile.sample_ns);
+	profile.samples++;
+
+	return ADC;
+}
+
+int16_t
+adc_get_differential_sample (uint8_t mux)
+{
+	uint64_t	start = sim_profile_begin ();
+	uint8_t		negative = ((mux >> 2) & 0x01) << 1;
+	uint8_t		positive = negative + (mux & 0x01);
+	double		gain = (mux & 0x02) ? 200.0 : 10.0;
+	double		volts;
+	long		code;
+
+	if (adc_source)
+	{
+		volts = ((double)adc_source (positive) - adc_source (negative)) * SIM_ADC_VREF / 1024.0;
+	}
+	else
+	{
+		volts = (sim_plant_get_pressure (positive) - sim_plant_get_pressure (negative)) / PSI_PER_VOLT;
+
+		if (positive != negative)
+			volts += (2.0 * sim_random () - 1.0) * noise_psi / PSI_PER_VOLT;
+	}
+
+	code = lround (volts * gain * 512.0 / SIM_ADC_VREF);
+	code = (code < -512) ? -512 : (code > 511) ? 511 : code;
+
+	if ((ADMUX & 0x1F) != mux)
+		now += 104;		/* the settling conversion, see `adc.c' */
+
+	ADMUX = mux;
+	ADC = (uint16_t)code & 0x03FF;
+	now += 104;
+
+	sim_profile_end (start, &profile.sample_ns);
+	profile.samples++;
+
+	return (int16_t)code;
+}
+
+//
+//	Main loop.
+//
+
+void
+sim_boot (void)
+{
+	now = 0;
+	next_tick = SIM_TICK_US;
+	in_interrupt = 1;		/* interrupts stay off until `sei' */
+
+#if ADC_LOW_RANGE
+	sim_plant_set_target (adc_chan_front_reference, SIM_ADC_REFERENCE_PSI, 0.0);
+	sim_plant_set_target (adc_chan_rear_reference, SIM_ADC_REFERENCE_PSI, 0.0);
+#endif
+
+	timer_init ();
+	adc_init ();
+	can_init ();
+
+	io_init ();
+	mob_init ();
+	stepper_init ();
+
+	param_init ();
+	error_init ();
+	watchdog_init ();
+
+	pressure_boot ();
+	startup_alive_sent ();
+
+	in_interrupt = 0;
+
+	watchdog_broadcast_reset_report ();
+}
+
+void
+sim_set_state_hook (void (*hook)(state_t from, state_t to, uint64_t time))
+{
+	state_hook = hook;
+}
+
+int
+sim_run_until (uint64_t until)
+{
+	int arrived = 0;
+
+	while (now < until && !arrived)
+	{
+		state_t		from, to;
+		uint64_t	next;
+
+		arrived = sim_can_deliver (now);
+
+		from = state_get_current_state ();
+		watchdog_service ();
+		bus_service ();
+		service_service ();
+		state_execute_current_state ();
+		to = state_get_current_state ();
+
+		now += SIM_LOOP_US;
+
+		if (from != to && state_hook)
+			state_hook (from, to, now);
+
+		sim_fire_ticks ();
+
+		if (wdt_enabled && now - wdt_last_reset > wdt_timeout)
+			sim_fail ("hardware watchdog expired");
+
+		if (from != to)
+			continue;
+
+		next = next_tick;
+
+		if (sim_can_next_delivery () < next)
+			next = sim_can_next_delivery ();
+
+		if (until < next)
+			next = until;
+
+		if (next > now)
+			now = next;
+	}
+
+	return arrived;
+}
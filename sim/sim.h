@@ -0,0 +1,258 @@
+//
+//	sim.h
+//	Virtual-time host simulator for the brake module firmware.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+//	The firmware sources are compiled unmodified for the host, against the
+//	stand-in headers in this directory. `adc.c' is replaced by the pressure
+//	plant model below, and `main' is renamed so the simulator can own the
+//	main loop. For example, from the top of the tree:
+//
+//		cc -std=gnu99 -O2 -Isim -I. -Dmain=firmware_main -o pcal_sim
+//			sim/sim.c sim/can.c sim/eeprom.c sim/pcal_sim.c
+//			adc_range.c bias.c bus.c diagnostic.c error.c flush.c main.c
+//			param.c pressure.c pressure_convert.c service.c startup.c
+//			state.c stepper.c subscription.c timer.c watchdog.c -lm
+//
+//	Add -DADC_LOW_RANGE=1 for the low pressure range board, which the
+//	plant models with the references held at `SIM_ADC_REFERENCE_PSI'.
+//
+//	Time only advances when the firmware spends it: each main loop pass
+//	costs `SIM_LOOP_US', busy waits cost what they ask for, and CAN frames
+//	take `SIM_CAN_BIT_US' per bit on the bus. When a pass leaves the state
+//	unchanged, the clock jumps straight to the next timer tick or frame, so
+//	waiting states cost nothing on the host.
+//
+//	N.B. CAN interrupts are only delivered between main loop passes. Timer
+//	interrupts are too, and also whenever the firmware spends time in a busy
+//	wait or on the eeprom, like they would be on the hardware.
+//
+
+#ifndef _SIM_H
+#define _SIM_H
+
+#include <inttypes.h>
+
+#include "can.h"
+#include "state.h"
+
+#define	SIM_LOOP_US				20		/* one pass of the main loop */
+#define	SIM_TICK_US				1000	/* general-purpose timer period */
+#define	SIM_CAN_BIT_US			2		/* 500 kbit/s */
+#define	SIM_EEPROM_READ_US		2		/* per byte */
+#define	SIM_EEPROM_WRITE_US		3300	/* per byte */
+
+#define	SIM_ADC_CHANNELS		8
+#define	SIM_ADC_VREF			5.0		/* V */
+#define	SIM_ADC_REFERENCE_PSI	75.0	/* low range reference, as psi */
+
+typedef struct sim_frame_t
+{
+	uint16_t	id;
+	uint8_t		length;
+	uint8_t		data[8];
+	uint64_t	time;			/* us, when the frame finished on the bus */
+}
+sim_frame_t;
+
+//
+//	Virtual clock.
+//
+
+uint64_t
+sim_now (void);
+
+void
+sim_advance
+(
+	uint64_t us
+);
+
+//
+//	Report a fatal simulation error and exit.
+//
+
+void
+sim_fail
+(
+	const char *format,
+	...
+)
+__attribute__ ((noreturn, format (printf, 1, 2)));
+
+//
+//	Deterministic pseudo-random numbers, uniform on [0, 1).
+//
+
+void
+sim_seed
+(
+	uint32_t seed
+);
+
+double
+sim_random (void);
+
+//
+//	Brake pressure plant. Each ADC channel follows its target pressure with
+//	a first-order lag of time constant `tau_ms', plus `noise_psi' of uniform
+//	sensor noise, and is converted by the sensor at `PSI_PER_VOLT'.
+//	Differential samples take the noise on the positive input only.
+//
+
+void
+sim_plant_set_target
+(
+	uint8_t	channel,
+	double	psi,
+	double	tau_ms
+);
+
+void
+sim_plant_set_noise
+(
+	double noise_psi
+);
+
+double
+sim_plant_get_pressure
+(
+	uint8_t channel
+);
+
+//
+//	Take ADC samples from `source' instead of the plant, or from the plant
+//	again if it is null. The source returns the 10-bit code for `channel'
+//	at the current time; conversions still cost their 104 us. Differential
+//	samples are made from the difference of the two channels' codes.
+//
+
+void
+sim_adc_set_source
+(
+	uint16_t (*source)(uint8_t channel)
+);
+
+//
+//	Host time profile. Once started, the host time spent in the timer
+//	interrupt, in ADC samples and in the CAN driver is added up, along
+//	with how often each ran. The ADC and CAN time is mostly spent inside
+//	the interrupt, and is counted in both.
+//
+
+typedef struct sim_profile_t
+{
+	uint64_t	ticks, samples, frames;
+	uint64_t	tick_ns, sample_ns, can_ns;
+}
+sim_profile_t;
+
+void
+sim_profile_start (void);
+
+sim_profile_t *
+sim_profile_get (void);
+
+//
+//	Return the host clock in ns if profiling, or zero if not, and add the
+//	time since `start' to `total'. For the simulator's own stand-ins.
+//
+
+uint64_t
+sim_profile_begin (void);
+
+void
+sim_profile_end
+(
+	uint64_t	start,
+	uint64_t	*total
+);
+
+//
+//	Run the firmware start-up sequence from `main'.
+//
+
+void
+sim_boot (void);
+
+//
+//	Run the firmware until the clock reaches `until' or until a frame is
+//	delivered to the simulated bus nodes. Returns 1 if a frame arrived.
+//
+
+int
+sim_run_until
+(
+	uint64_t until
+);
+
+//
+//	Called after every main loop pass that changed the current state.
+//
+
+void
+sim_set_state_hook
+(
+	void (*hook)(state_t from, state_t to, uint64_t time)
+);
+
+//
+//	Simulated bus. `sim_can_send' puts a frame on the bus from an external
+//	node and returns the time it will be delivered. Frames sent by the
+//	firmware are handed to the hook set with `sim_can_set_node_hook'.
+//
+//	Like the hardware, each message object holds one frame. Sending on one
+//	that still has a frame waiting doesn't queue another; the frame that
+//	goes out carries whatever was loaded last, and the earlier one is lost.
+//	Setting up a message object, or going bus-off, drops its frame.
+//
+
+uint64_t
+sim_can_send
+(
+	uint16_t		id,
+	const uint8_t	*data,
+	uint8_t			length
+);
+
+void
+sim_can_set_node_hook
+(
+	void (*hook)(const sim_frame_t *frame)
+);
+
+uint64_t
+sim_can_next_delivery (void);
+
+int
+sim_can_deliver
+(
+	uint64_t now
+);
+
+void
+sim_can_reset (void);
+
+//
+//	Take the controller bus-off, as though the bus were noisy for
+//	`duration' us. Frames are lost both ways until it is back on the bus,
+//	and its message objects are left disabled, the worst case. It comes
+//	back once the firmware re-enables it (`ENASTB') and the bus has been
+//	quiet for 128 runs of 11 recessive bits.
+//
+
+void
+sim_can_bus_off
+(
+	uint64_t duration
+);
+
+//
+//	Update the controller status registers. Called before each timer tick.
+//
+
+void
+sim_can_update_status (void);
+
+#endif
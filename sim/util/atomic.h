@@ -0,0 +1,16 @@
+//
+//	util/atomic.h
+//	Host simulator stand-in. Interrupts never preempt the main loop in the
+//	simulator, so an atomic block is just a block.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#ifndef _SIM_UTIL_ATOMIC_H
+#define _SIM_UTIL_ATOMIC_H
+
+#define	ATOMIC_RESTORESTATE
+#define	ATOMIC_FORCEON
+#define	ATOMIC_BLOCK(type)	for (int _sim_atomic = 1; _sim_atomic; _sim_atomic = 0)
+
+#endif
@@ -0,0 +1,14 @@
+//
+//	util/delay.h
+//	Host simulator stand-in. Busy waits advance the virtual clock.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#ifndef _SIM_UTIL_DELAY_H
+#define _SIM_UTIL_DELAY_H
+
+void	_delay_ms (double ms);
+void	_delay_us (double us);
+
+#endif
@@ -0,0 +1,141 @@
+//
+//	stack.c
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#include <avr/io.h>
+
+#include "can.h"
+#include "can_config.h"
+
+#include "diagnostic.h"
+#include "error.h"
+#include "stack.h"
+#include "timer.h"
+
+extern uint8_t	_end;
+extern uint8_t	__stack;
+
+static uint8_t	*scan = &_end;
+static uint8_t	*high_water = &__stack + 1;		/* lowest byte reached */
+
+static uint8_t	report_pending;
+static uint8_t	low_reported;
+static uint32_t	last_report;
+
+//
+//	Paint the free RAM. Runs before the stack pointer is set up, so this has
+//	to be done without using the stack, or `r1' being zero (1).
+//
+
+void
+stack_paint (void)
+__attribute__ ((naked, used, section (".init1")));
+
+void
+stack_paint (void)
+{
+	__asm__ __volatile__
+	(
+		"	ldi	r30, lo8(_end)		\n"
+		"	ldi	r31, hi8(_end)		\n"
+		"	ldi	r24, %0				\n"
+		"	ldi	r25, hi8(__stack)	\n"
+		"	rjmp 2f					\n"
+		"1:	st	Z+, r24				\n"
+		"2:	cpi	r30, lo8(__stack)	\n"
+		"	cpc	r31, r25			\n"
+		"	brlo 1b					\n"
+		"	breq 1b					\n"
+		:
+		: "M" (STACK_PAINT)
+	);
+}
+
+//
+//	1.	Written in assembly since the compiler may well put a local on
+//		the stack, or use `r1', when optimization is off. Painting all
+//		4 KB takes about 1.5 ms, well inside the shortest watchdog timeout
+//		that might still be running after a watchdog reset.
+//
+
+void
+stack_scan (void)
+{
+	uint8_t i;
+
+	for (i = 0; i < STACK_SCAN_CHUNK; i++)
+	{
+		if (scan >= high_water)
+		{
+			scan = &_end;		/* 1 */
+			break;
+		}
+
+		if (*scan != STACK_PAINT)
+		{
+			high_water = scan;
+			scan = &_end;
+			report_pending = 1;
+
+			break;
+		}
+
+		scan++;
+	}
+
+	if (!low_reported && stack_get_free () < STACK_LOW_MARGIN)
+	{
+		low_reported = 1;
+		error_broadcast_error_code (err_sev_recoverable, err_stack_low);
+	}
+
+	if (report_pending && timer_get_ticks () - last_report >= STACK_REPORT_PERIOD)
+	{
+		report_pending = 0;
+		last_report = timer_get_ticks ();
+
+		stack_broadcast_report ();
+	}
+}
+
+//
+//	1.	Everything below the high-water mark is still paint, so start over.
+//		The stack only ever moves the mark down, so each pass only has to
+//		get as far as the mark.
+//
+
+uint16_t
+stack_get_used (void)
+{
+	return &__stack + 1 - high_water;
+}
+
+uint16_t
+stack_get_free (void)
+{
+	return high_water - &_end;
+}
+
+void
+stack_broadcast_report (void)
+{
+	uint16_t	used, free, bss;
+	uint8_t		data[8];
+
+	bss = &_end - (uint8_t *)RAMSTART;
+	used = stack_get_used ();
+	free = stack_get_free ();
+
+	data[0] = diag_id_stack_report;
+	data[1] = (uint8_t)(bss >> 8);
+	data[2] = (uint8_t)(bss);
+	data[3] = (uint8_t)(used >> 8);
+	data[4] = (uint8_t)(used);
+	data[5] = (uint8_t)(free >> 8);
+	data[6] = (uint8_t)(free);
+	data[7] = diagnostic_get_dropped ();
+
+	diagnostic_send (data, 8);
+}
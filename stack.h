@@ -0,0 +1,72 @@
+//
+//	stack.h
+//	Stack painting and high-water mark.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#ifndef _STACK_H
+#define _STACK_H
+
+#include <inttypes.h>
+
+//
+//	All of the RAM between the end of the static variables (`_end', which
+//	comes after `.noinit') and the top of the stack is painted with
+//	`STACK_PAINT' before anything else runs. There is no heap, so the stack
+//	is the only thing that ever grows into it. The idle state scans up from
+//	`_end' a little at a time for the first byte that isn't paint, which is
+//	the deepest the stack (interrupts included) has been since the reset.
+//
+
+#define	STACK_PAINT				0xC5
+#define	STACK_SCAN_CHUNK		32			/* bytes checked per idle pass */
+#define	STACK_LOW_MARGIN		128			/* bytes, 1 */
+#define	STACK_REPORT_PERIOD		1000		/* ms, 2 */
+
+//
+//	1.	Once fewer bytes than this have never been touched, `err_stack_low'
+//		is broadcast, once.
+//
+//	2.	A stack report is sent whenever the high-water mark moves, but no
+//		more often than this.
+//
+
+//
+//	Check the next `STACK_SCAN_CHUNK' bytes for the high-water mark. Called
+//	from the idle state.
+//
+
+void
+stack_scan (void);
+
+//
+//	Return the most stack used since the reset, in bytes.
+//
+
+uint16_t
+stack_get_used (void);
+
+//
+//	Return the number of bytes the stack has never reached, between the
+//	static variables and the high-water mark.
+//
+
+uint16_t
+stack_get_free (void);
+
+//
+//	Broadcast a stack report on the diagnostic channel:
+//
+//	0: `diag_id_stack_report'
+//	1+2: The MSB and LSB of the static RAM size (.data, .bss and .noinit)
+//	3+4: The MSB and LSB of the most stack used since the reset
+//	5+6: The MSB and LSB of the bytes the stack has never reached
+//	7: The number of diagnostic reports dropped since the reset (see
+//	   `diagnostic.h'), saturating at 255
+//
+
+void
+stack_broadcast_report (void);
+
+#endif
@@ -0,0 +1,126 @@
+//
+//	startup.c
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#include <util/atomic.h>
+
+#include "can.h"
+#include "can_config.h"
+
+#include "adc.h"
+#include "bias.h"
+#include "diagnostic.h"
+#include "error.h"
+#include "pressure.h"
+#include "startup.h"
+#include "state.h"
+#include "stepper.h"
+#include "timer.h"
+
+static uint32_t			alive_time;
+static volatile uint32_t	frame_time;
+static uint32_t			done_time;
+static uint32_t			wake_ticks;
+static uint8_t			failed_channels;
+
+void
+startup_load_calibration (void)
+{
+	pressure_init ();
+	bias_init ();
+	adc_range_calibrate ();
+
+	state_transition (state_boot_wake_stepper);
+}
+
+void
+startup_wake_stepper (void)
+{
+	stepper_wake ();
+	wake_ticks = timer_get_ticks ();
+
+	state_transition (state_boot_wait_stepper);
+}
+
+void
+startup_wait_stepper (void)
+{
+	if (timer_get_ticks () - wake_ticks <= STEPPER_SLEEP_DELAY)	/* 1 */
+		return;
+
+	stepper_enable ();
+	state_transition (state_boot_self_test);
+}
+
+//
+//	1.	The tick count is taken part way through a millisecond, so one
+//		more tick than the delay is waited out.
+//
+
+void
+startup_self_test (void)
+{
+	failed_channels = pressure_self_test (STARTUP_SENSOR_MAX_SAMPLE);
+
+	if (failed_channels)
+	{
+		error_set_error_code (err_sensor_fault);
+		error_broadcast_error_code (err_sev_recoverable, err_sensor_fault);
+	}
+
+	done_time = timer_get_timestamp ();
+	startup_broadcast_report ();
+
+	state_transition (state_idle);
+}
+
+void
+startup_alive_sent (void)
+{
+	alive_time = timer_get_timestamp ();
+}
+
+void
+startup_frame_sent (void)
+{
+	if (!frame_time)
+		frame_time = timer_get_timestamp ();
+}
+
+//
+//	Return `us' saturated to 16 bits.
+//
+
+static uint16_t
+startup_saturate (uint32_t us)
+{
+	return (us > UINT16_MAX) ? UINT16_MAX : us;
+}
+
+void
+startup_broadcast_report (void)
+{
+	uint8_t		data[8];
+	uint16_t	alive, frame, done;
+
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+	{
+		frame = startup_saturate (frame_time);
+	}
+
+	alive = startup_saturate (alive_time);
+	done = startup_saturate (done_time / 1000);
+
+	data[0] = diag_id_boot_report;
+	data[1] = (uint8_t)(alive >> 8);
+	data[2] = (uint8_t)(alive);
+	data[3] = (uint8_t)(frame >> 8);
+	data[4] = (uint8_t)(frame);
+	data[5] = (uint8_t)(done >> 8);
+	data[6] = (uint8_t)(done);
+	data[7] = failed_channels;
+
+	diagnostic_send (data, 8);
+}
@@ -0,0 +1,104 @@
+//
+//	startup.h
+//	Staged start-up.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#ifndef _STARTUP_H
+#define _STARTUP_H
+
+#include <inttypes.h>
+
+//
+//	Start-up runs in two stages, so valid pressure is on the bus as soon
+//	as possible after power-on.
+//
+//	The first stage runs in `main' with interrupts off, and only brings up
+//	what the pressure broadcast needs: the timer, the ADC, CAN, the
+//	parameters, the error journal and the watchdog. Both sensors are then
+//	sampled through the nominal curve and broadcast straight away, flagged
+//	`PRESSURE_STATUS_UNCALIBRATED', and interrupts are turned on.
+//
+//	The rest runs from the main loop as the states below, between timer
+//	ticks, so the regular updates and broadcasts carry on around it: load
+//	the pressure and bias calibration, measure the low pressure range (see
+//	`adc.h'), wake the stepper driver, and run the self-tests. The boot
+//	report is sent at the end, and the state machine goes to idle.
+//
+//	Times are measured from the start of `main' (when the timer starts),
+//	so they don't include the stack painting and C start-up before it.
+//
+
+#define	STARTUP_SENSOR_MAX_SAMPLE	1020	/* 1 */
+
+//
+//	1.	A sensor reading at or above this is taken as shorted or open,
+//		since the sensor never drives its output to the rail.
+//
+
+//
+//	Load the pressure and bias calibration and measure the low pressure
+//	range. Transition into waking the stepper driver.
+//
+
+void
+startup_load_calibration (void);
+
+//
+//	Take the stepper driver out of sleep. Transition into waiting for it.
+//
+
+void
+startup_wake_stepper (void);
+
+//
+//	Wait out the stepper driver's wake-up time, then let it step.
+//	Transition into the self-tests.
+//
+
+void
+startup_wait_stepper (void);
+
+//
+//	Check the sensor readings for the rails, raising `err_sensor_fault' if
+//	either is stuck there. Send the boot report and transition into idle.
+//
+
+void
+startup_self_test (void);
+
+//
+//	Note the time the alive frame was queued. Called from `main' as soon as
+//	it has been sent.
+//
+
+void
+startup_alive_sent (void);
+
+//
+//	Note the time the first pressure frame left the bus. Called from the
+//	pressure transmit callback.
+//
+
+void
+startup_frame_sent (void);
+
+//
+//	Broadcast the boot report on the diagnostic channel:
+//
+//	0:   `diag_id_boot_report'
+//	1+2: The MSB and LSB of the time to the alive frame being queued (in us,
+//		 saturated)
+//	3+4: The MSB and LSB of the time to it leaving the bus (in us,
+//		 saturated)
+//	5+6: The MSB and LSB of the time to the end of start-up (in ms,
+//		 saturated)
+//	7:   The channels that failed the self-test, as `PRESSURE_CHANNEL_FRONT'
+//		 and so on
+//
+
+void
+startup_broadcast_report (void);
+
+#endif
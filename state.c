@@ -8,7 +8,7 @@
 
 #include "state.h"
 
-static volatile state_t current_state = state_idle;
+static volatile state_t current_state = state_boot_load;
 
 static volatile int 	transition_requested;
 static volatile state_t transition_state;
@@ -16,7 +16,7 @@ static volatile state_t transition_state;
 static volatile int		isr_transition_requested;
 static volatile state_t isr_transition_state;
 
-extern static void (*state_handlers[])(void);
+extern void (*state_handlers[])(void);
 
 void
 state_execute_current_state (void)
@@ -39,6 +39,12 @@ state_get_current_state (void)
 	return current_state;
 }
 
+uint8_t
+state_is_booting (void)
+{
+	return current_state >= state_boot_load;
+}
+
 void
 state_transition (state_t new_state)
 {
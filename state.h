@@ -7,6 +7,8 @@
 #ifndef _STATE_H
 #define _STATE_H
 
+#include <inttypes.h>
+
 typedef enum state_t
 {
 	state_idle,					/* idle state */
@@ -19,7 +21,22 @@ typedef enum state_t
 	state_pcal_wait_max,		/* wait for maximum pressure reply */
 	state_pcal_sample_max,		/* sample maximum pressure */
 	state_pcal_update,			/* store new pressure calibration values in eeprom */
-	state_pcal_abort			/* abort calibration routine */
+	state_pcal_abort,			/* abort calibration routine */
+	state_pcal_request_point,	/* request next curve point */
+	state_pcal_wait_point,		/* wait for curve point reply */
+	state_pcal_sample_point,	/* sample curve point */
+	state_pcal_update_curve,	/* store new sensor curves in eeprom */
+	state_bcal_move_start,		/* move the bias adjuster to the start of the sweep */
+	state_bcal_wait_start,		/* wait for it to get there */
+	state_bcal_wait_pressure,	/* wait for pressure applied reply */
+	state_bcal_sweep,			/* start the sweep and sampling */
+	state_bcal_wait_sweep,		/* wait for the sweep to finish */
+	state_bcal_update,			/* store new bias curve in eeprom */
+	state_bcal_abort,			/* abort bias calibration routine */
+	state_boot_load,			/* load calibration, see `startup.h' */
+	state_boot_wake_stepper,	/* take the stepper driver out of sleep */
+	state_boot_wait_stepper,	/* wait for it to wake up */
+	state_boot_self_test		/* check the sensors and send the boot report */
 }
 state_t;
 
@@ -29,6 +46,14 @@ state_execute_current_state (void);
 state_t
 state_get_current_state (void);
 
+//
+//	Return 1 while the start-up states are running (see `startup.h'). They
+//	are the last in `state_t'.
+//
+
+uint8_t
+state_is_booting (void);
+
 void
 state_transition
 (
@@ -5,10 +5,24 @@
 //
 
 #include <avr/io.h>
+#include <util/atomic.h>
 #include <util/delay.h>
 
 #include "stepper.h"
 
+#define	TIMER_RUN		(_BV (WGM12) | _BV (CS11))
+#define	TIMER_STOP		(_BV (WGM12))
+
+static stepper_move_t	queue[STEPPER_QUEUE_SIZE];
+static volatile uint8_t	queue_head, queue_tail;
+
+static volatile int16_t	position;
+static volatile uint8_t	running;
+static volatile uint8_t	enabled;
+
+static uint32_t			speed;			/* steps/s, Q8; zero at rest */
+static stepper_dir_t	direction;
+
 void
 stepper_init (void)
 {
@@ -16,8 +30,50 @@ stepper_init (void)
 			_BV (STEPPER_MS1) | _BV (STEPPER_MS1) | _BV (STEPPER_DIR) |
 			_BV (STEPPER_RESET)	| _BV (STEPPER_STEP);
 
-	PORTB = _BV (STEPPER_RESET) | _BV (STEPPER_SLEEP);
-	_delay_ms (STEPPER_SLEEP_DELAY);
+	PORTB = _BV (STEPPER_RESET);
+
+	TCCR1A = 0;
+	TCCR1B = TIMER_STOP;
+	TIMSK1 = 0;
+}
+
+void
+stepper_wake (void)
+{
+	PORTB |= _BV (STEPPER_SLEEP);
+}
+
+//
+//	Start the timer on the move at the head of the queue. Interrupts must
+//	be off.
+//
+
+static void
+stepper_start (void)
+{
+	running = 1;
+	speed = 0;
+
+	TCNT1 = 0;
+	OCR1A = STEPPER_TIMER_HZ / 10000 - 1;	/* 1 */
+	TCCR1B = TIMER_RUN;
+}
+
+//
+//	1.	The first interrupt, 100 us from now, sets the direction.
+//
+
+void
+stepper_enable (void)
+{
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+	{
+		enabled = 1;
+		TIMSK1 = _BV (OCIE1A);
+
+		if (!running && queue_head != queue_tail)
+			stepper_start ();
+	}
 }
 
 void
@@ -40,3 +96,271 @@ stepper_step (uint16_t steps, stepper_dir_t direction, float step_delay)
 		_delay_ms (step_delay);
 	}
 }
+
+uint8_t
+stepper_queue_move (int16_t steps, uint16_t move_speed, uint16_t accel)
+{
+	stepper_move_t	*last = 0;
+	int32_t			target;
+	uint8_t			next;
+
+	if (steps == 0)
+		return 1;
+
+	if (move_speed == 0)
+		move_speed = STEPPER_DEFAULT_SPEED;
+	else if (move_speed < STEPPER_MIN_SPEED)
+		move_speed = STEPPER_MIN_SPEED;
+	else if (move_speed > STEPPER_MAX_SPEED)
+		move_speed = STEPPER_MAX_SPEED;
+
+	if (accel == 0)
+		accel = STEPPER_DEFAULT_ACCEL;
+	else if (accel > STEPPER_MAX_ACCEL)
+		accel = STEPPER_MAX_ACCEL;
+
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+	{
+		if (queue_head != queue_tail)
+			last = &queue[(queue_tail + STEPPER_QUEUE_SIZE - 1) % STEPPER_QUEUE_SIZE];
+
+		target = (int32_t)(last ? last->target : position) + steps;
+
+		if (target > INT16_MAX)
+			target = INT16_MAX;
+		else if (target < INT16_MIN)
+			target = INT16_MIN;
+
+		if
+		(
+			last && (steps > 0) == (last->target > last->from) &&
+			last->speed == move_speed && last->accel == accel
+		)
+		{
+			last->target = target;		/* 1 */
+			return 1;
+		}
+
+		next = (queue_tail + 1) % STEPPER_QUEUE_SIZE;
+
+		if (next == queue_head)
+			return 0;
+
+		queue[queue_tail].from = last ? last->target : position;
+		queue[queue_tail].target = target;
+		queue[queue_tail].speed = move_speed;
+		queue[queue_tail].accel = accel;
+		queue_tail = next;
+
+		if (enabled && !running)		/* 2 */
+			stepper_start ();
+	}
+
+	return 1;
+}
+
+//
+//	1.	The interrupt handler only looks at the target as it goes, so the
+//		running move simply carries on further. If it was already slowing
+//		down for the old target, it speeds back up.
+//
+//	2.	Until the stepper is enabled, moves only wait in the queue.
+//
+
+int16_t
+stepper_get_position (void)
+{
+	int16_t current;
+
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+	{
+		current = position;
+	}
+
+	return current;
+}
+
+int16_t
+stepper_get_target (void)
+{
+	int16_t target;
+
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+	{
+		target = (queue_head != queue_tail) ?
+			queue[(queue_tail + STEPPER_QUEUE_SIZE - 1) % STEPPER_QUEUE_SIZE].target : position;
+	}
+
+	return target;
+}
+
+uint8_t
+stepper_set_position (int16_t new_position)
+{
+	int16_t	shift;
+	uint8_t	i;
+
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+	{
+		if (running)
+			return 0;
+
+		shift = new_position - position;
+
+		for (i = queue_head; i != queue_tail; i = (i + 1) % STEPPER_QUEUE_SIZE)
+		{
+			queue[i].from += shift;		/* 1 */
+			queue[i].target += shift;
+		}
+
+		position = new_position;
+	}
+
+	return 1;
+}
+
+//
+//	1.	Moves waiting for the stepper to be enabled were queued relative to
+//		the old position, so they move with it.
+//
+
+uint8_t
+stepper_is_moving (void)
+{
+	return running || queue_head != queue_tail;
+}
+
+//
+//	Return the square of the fastest speed the stepper may be going as it
+//	reaches the end of `move', for the move after it. That is zero unless
+//	the next move carries on in the same direction, in which case it is
+//	limited by the next move's speed, and by what it can stop from within
+//	the next move's length (1).
+//
+
+static uint32_t
+stepper_exit_speed_squared (stepper_move_t *move, uint8_t index)
+{
+	stepper_move_t	*next;
+	uint32_t		limit, stop, length;
+
+	index = (index + 1) % STEPPER_QUEUE_SIZE;
+
+	if (index == queue_tail)
+		return 0;
+
+	next = &queue[index];
+
+	if ((next->target > move->target) != (direction == forward) || next->target == move->target)
+		return 0;
+
+	length = (next->target > move->target) ?
+		next->target - move->target : move->target - next->target;
+
+	limit = (uint32_t)next->speed * next->speed;
+	stop = 2UL * next->accel * length;
+
+	if (move->speed < next->speed)
+		limit = (uint32_t)move->speed * move->speed;
+
+	return (stop < limit) ? stop : limit;
+}
+
+//
+//	1.	Only one move ahead is looked at, so a short move followed by
+//		another one in the same direction is treated as if it ended in a
+//		stop. That only costs some speed, and since moves in the same
+//		direction are merged when they're queued it hardly ever happens.
+//
+
+void
+stepper_step_interrupt_handler (void)
+{
+	stepper_move_t	*move;
+	stepper_dir_t	move_direction;
+	uint32_t		v, v_squared, exit_squared, brake, dv;
+	uint16_t		remaining;
+
+	for (;;)
+	{
+		if (queue_head == queue_tail)
+		{
+			TCCR1B = TIMER_STOP;
+			running = 0;
+			speed = 0;
+
+			return;
+		}
+
+		move = &queue[queue_head];
+
+		if (move->target != position)
+			break;
+
+		queue_head = (queue_head + 1) % STEPPER_QUEUE_SIZE;
+	}
+
+	move_direction = (move->target > position) ? forward : reverse;
+
+	if (speed == 0 || move_direction != direction)		/* 1 */
+	{
+		if (move_direction == forward)
+			PORTB &= ~_BV (STEPPER_DIR);
+		else
+			PORTB |= _BV (STEPPER_DIR);
+
+		direction = move_direction;
+		speed = (uint32_t)STEPPER_MIN_SPEED << 8;
+		OCR1A = STEPPER_TIMER_HZ / 10000 - 1;
+
+		return;
+	}
+
+	PORTB |= _BV (STEPPER_STEP);
+	_delay_us (STEPPER_STEP_DELAY);
+	PORTB &= ~_BV (STEPPER_STEP);
+
+	position += (direction == forward) ? 1 : -1;
+
+	remaining = (direction == forward) ?
+		move->target - position : position - move->target;
+
+	//
+	//	Brake if stopping (or slowing for the next move) from here takes all
+	//	of the distance left; otherwise speed up or slow down towards the
+	//	move's own speed. The change in speed over one step is a / v (2).
+	//
+
+	v = speed >> 8;
+	v_squared = v * v;
+	exit_squared = stepper_exit_speed_squared (move, queue_head);
+	brake = 2UL * move->accel * remaining;
+	dv = ((uint32_t)move->accel << 16) / speed;
+
+	if ((v_squared > exit_squared && v_squared - exit_squared >= brake) || v > move->speed)
+	{
+		speed = (speed > dv + ((uint32_t)STEPPER_MIN_SPEED << 8)) ?
+			speed - dv : (uint32_t)STEPPER_MIN_SPEED << 8;
+	}
+	else if (v < move->speed)
+	{
+		speed += dv;
+
+		if (speed > (uint32_t)move->speed << 8)
+			speed = (uint32_t)move->speed << 8;
+	}
+
+	OCR1A = (uint16_t)((STEPPER_TIMER_HZ << 8) / speed) - 1;
+}
+
+//
+//	1.	Starting from rest: set the direction, and take the first step
+//		100 us later, which leaves the driver far more than its 200 ns of
+//		direction setup time. Moves only ever change direction once they
+//		have braked to the minimum speed, so this is the only place the
+//		direction changes.
+//
+//	2.	Over one step dt = 1 / v, so dv = a dt = a / v. In Q8 that is
+//		(a << 16) / speed. The timer period for the next step is then
+//		STEPPER_TIMER_HZ / v.
+//
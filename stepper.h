@@ -36,6 +36,29 @@
 //		nanoseconds. N.B. these are units of microseconds.
 //
 
+//
+//	Queued moves are run by timer 1 in CTC mode, one compare match per step.
+//	Speeds are in steps/s and accelerations in steps/s^2.
+//
+
+#define	STEPPER_TIMER_HZ		2000000UL	/* 16 MHz / 8 */
+#define	STEPPER_QUEUE_SIZE		8			/* 1 */
+#define	STEPPER_MIN_SPEED		50			/* 2 */
+#define	STEPPER_MAX_SPEED		1000
+#define	STEPPER_DEFAULT_SPEED	400
+#define	STEPPER_DEFAULT_ACCEL	2000
+#define	STEPPER_MAX_ACCEL		30000		/* 3 */
+
+//
+//	1.	One slot is always left empty, so this holds one move fewer.
+//
+//	2.	Moves start and stop at this speed, 40000 ticks per step. The timer
+//		itself can count down to about 31 steps/s, at 65536 ticks per step.
+//
+//	3.	The braking distance is worked out as 2 a d, which has to fit in 32
+//		bits for the longest move there can be, 65535 steps.
+//
+
 typedef enum stepper_dir_t
 {
 	forward,
@@ -43,9 +66,45 @@ typedef enum stepper_dir_t
 }
 stepper_dir_t;
 
+typedef struct stepper_move_t
+{
+	int16_t		from;		/* target of the move before, or the start position */
+	int16_t		target;		/* absolute position, in steps */
+	uint16_t	speed;
+	uint16_t	accel;
+}
+stepper_move_t;
+
+//
+//	Set up the driver pins and timer 1, leaving the driver asleep and the
+//	step interrupt off. Moves can be queued straight away, but they don't
+//	start until the driver has been woken and the stepper enabled.
+//
+
 void
 stepper_init (void);
 
+//
+//	Take the driver out of sleep. It needs `STEPPER_SLEEP_DELAY' before
+//	it will step.
+//
+
+void
+stepper_wake (void);
+
+//
+//	Turn the step interrupt on, starting any queued moves. Only call this
+//	once the driver is awake.
+//
+
+void
+stepper_enable (void);
+
+//
+//	Blocking single move. N.B. this must not be used while queued moves are
+//	running.
+//
+
 void
 stepper_step
 (
@@ -54,4 +113,63 @@ stepper_step
 	float			step_delay
 );
 
+//
+//	Queue a relative move of `steps' steps past the end of the last queued
+//	move, at up to `speed' with acceleration `accel'; zero selects the
+//	defaults, and both are clamped to the limits above. A move in the same
+//	direction and at the same speed as the last queued one just extends
+//	it, even if it is already running, so the motor doesn't stop in
+//	between. Return 1 if the move was queued or merged, or 0 if the queue
+//	is full.
+//
+
+uint8_t
+stepper_queue_move
+(
+	int16_t		steps,
+	uint16_t	speed,
+	uint16_t	accel
+);
+
+//
+//	Return the current position, in steps from where the stepper started.
+//
+
+int16_t
+stepper_get_position (void);
+
+//
+//	Return the position the queued moves will leave the stepper at.
+//
+
+int16_t
+stepper_get_target (void);
+
+//
+//	Set the current position to `position', e.g. one saved before a reset.
+//	Moves still waiting for `stepper_enable' are shifted along with it.
+//	Returns 0, and does nothing, if the stepper is running a move.
+//
+
+uint8_t
+stepper_set_position
+(
+	int16_t position
+);
+
+//
+//	Return 1 if there are moves running or queued.
+//
+
+uint8_t
+stepper_is_moving (void);
+
+//
+//	Timer 1 compare interrupt handler. Takes the next step of the move at
+//	the head of the queue, and works out when the step after it is due.
+//
+
+void
+stepper_step_interrupt_handler (void);
+
 #endif
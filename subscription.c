@@ -0,0 +1,195 @@
+//
+//	subscription.c
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#include <string.h>
+
+#include "pressure.h"
+#include "service.h"
+#include "subscription.h"
+#include "timer.h"
+
+static subscription_t	subscriptions[SUBSCRIPTION_MAX];
+static uint16_t			fastest_period;
+
+uint16_t
+subscription_get_period (void)
+{
+	return fastest_period;
+}
+
+//
+//	Return 1 if `subscription' is due to be sent the readings in `psi' at
+//	time `now'.
+//
+
+static uint8_t
+subscription_is_due (subscription_t *subscription, uint16_t *psi, uint32_t now)
+{
+	uint8_t		i;
+	uint16_t	change;
+
+	if (now - subscription->sent < subscription->period)
+		return 0;
+
+	if (!subscription->deadband)
+		return 1;
+
+	for (i = 0; i < pressure_channel_count; i++)
+	{
+		if (!(subscription->channels & (1 << i)))
+			continue;
+
+		change = (psi[i] > subscription->last[i]) ?
+			psi[i] - subscription->last[i] : subscription->last[i] - psi[i];
+
+		if (change >= subscription->deadband)
+			return 1;
+	}
+
+	return 0;
+}
+
+void
+subscription_update (uint16_t *psi)
+{
+	subscription_t	*subscription;
+	uint32_t		now;
+	uint8_t			channels = 0;
+	uint8_t			i;
+
+	if (!fastest_period)
+		return;
+
+	now = timer_get_ticks ();
+
+	for (i = 0; i < SUBSCRIPTION_MAX; i++)
+	{
+		subscription = &subscriptions[i];
+
+		if (subscription->node && subscription_is_due (subscription, psi, now))
+			channels |= subscription->channels;
+	}
+
+	if (!channels)
+		return;
+
+	pressure_send_pressure_readings (channels);
+
+	for (i = 0; i < SUBSCRIPTION_MAX; i++)		/* 1 */
+	{
+		subscription = &subscriptions[i];
+
+		if (subscription->node && !(subscription->channels & ~channels))
+		{
+			subscription->sent = now;
+			memcpy (subscription->last, psi, sizeof (subscription->last));
+		}
+	}
+}
+
+//
+//	1.	Everyone sees the frames, due or not, so a subscriber that got all
+//		of its channels counts them as its own. It is then only due again
+//		a full period later, whoever asked for these ones.
+//
+
+//
+//	Recompute the fastest subscription period.
+//
+
+static void
+subscription_update_period (void)
+{
+	uint8_t i;
+
+	fastest_period = 0;
+
+	for (i = 0; i < SUBSCRIPTION_MAX; i++)
+	{
+		if
+		(
+			subscriptions[i].node &&
+			(!fastest_period || subscriptions[i].period < fastest_period)
+		)
+			fastest_period = subscriptions[i].period;
+	}
+}
+
+//
+//	Add, replace or (with an empty channel set) cancel the subscription
+//	for `node'.
+//
+
+static subscription_status_t
+subscription_set (uint8_t node, uint8_t channels, uint16_t period, uint16_t deadband)
+{
+	subscription_t	*slot = 0;
+	uint8_t			i;
+
+	channels &= PRESSURE_CHANNEL_ALL;
+
+	if (!node || (channels && !period))
+		return subscription_status_invalid;
+
+	for (i = 0; i < SUBSCRIPTION_MAX; i++)
+	{
+		if (subscriptions[i].node == node)
+		{
+			slot = &subscriptions[i];
+			break;
+		}
+
+		if (!slot && !subscriptions[i].node)
+			slot = &subscriptions[i];
+	}
+
+	if (!channels)
+	{
+		if (slot && slot->node == node)
+			slot->node = 0;
+	}
+	else if (!slot)
+	{
+		return subscription_status_full;
+	}
+	else
+	{
+		slot->node = node;
+		slot->channels = channels;
+		slot->period = period;
+		slot->deadband = deadband;
+		slot->sent = timer_get_ticks () - period;		/* 1 */
+		memset (slot->last, 0xFF, sizeof (slot->last));
+	}
+
+	subscription_update_period ();
+
+	return subscription_status_ok;
+}
+
+//
+//	1.	So the first frame goes out on the next sample pass, whatever the
+//		deadband.
+//
+
+void
+subscription_service_request (uint8_t *data)
+{
+	uint8_t reply[4];
+	uint8_t i;
+
+	reply[0] = data[0];
+	reply[1] = data[1];
+	reply[2] = subscription_set (data[1], data[2],
+		(data[3] << 8) | data[4], (data[5] << 8) | data[6]);
+	reply[3] = 0;
+
+	for (i = 0; i < SUBSCRIPTION_MAX; i++)
+		if (subscriptions[i].node)
+			reply[3]++;
+
+	service_send_reply (reply, 4);
+}
@@ -0,0 +1,99 @@
+//
+//	subscription.h
+//	Per-node pressure subscriptions.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#ifndef _SUBSCRIPTION_H
+#define _SUBSCRIPTION_H
+
+#include <inttypes.h>
+
+#include "pressure.h"
+
+//
+//	Nodes that want pressure at their own rate subscribe through the
+//	service message, giving a channel set, a period and a deadband. The
+//	table is small and kept in RAM only, so subscribers have to subscribe
+//	again after the module resets (see the reset report in `watchdog.h').
+//
+//	Subscriptions don't get frames of their own. After each sample pass,
+//	a channel is sent if any of its subscribers is due, on the regular
+//	pressure IDs and in the regular format, and every subscriber that gets
+//	all of its channels in the pass takes them as its own. Each channel
+//	carries its fastest subscriber's rate, not the sum of them. The pressure
+//	update period is shortened to the fastest subscription, so there is
+//	always a fresh sample to send.
+//
+//	A subscriber is due once its period has run out and, if it has a
+//	deadband, a channel it subscribes to has moved at least that far since
+//	the last frame it got.
+//
+
+#define	SUBSCRIPTION_MAX			4
+
+typedef enum subscription_status_t
+{
+	subscription_status_ok			= 0x00,
+	subscription_status_full		= 0x01,		/* no free slot */
+	subscription_status_invalid		= 0x02		/* zero period */
+}
+subscription_status_t;
+
+typedef struct subscription_t
+{
+	uint8_t		node;			/* zero when the slot is free */
+	uint8_t		channels;		/* `PRESSURE_CHANNEL_FRONT' and so on */
+	uint16_t	period;			/* ms */
+	uint16_t	deadband;		/* psi */
+	uint16_t	last[pressure_channel_count];	/* psi in the last frame sent */
+	uint32_t	sent;			/* ms */
+}
+subscription_t;
+
+//
+//	Return the period of the fastest subscription, or zero if there are
+//	none.
+//
+
+uint16_t
+subscription_get_period (void);
+
+//
+//	Send the readings in `psi', just sampled and indexed by
+//	`pressure_channel_t', to any subscribers that are due. Called from the
+//	pressure periodic handler after each sample pass.
+//
+
+void
+subscription_update
+(
+	uint16_t	*psi
+);
+
+//
+//	Handle a subscription service request:
+//
+//	Subscribe:	0: `svc_cmd_subscribe'
+//				1: The subscriber's node id (not zero)
+//				2: The channel set, `PRESSURE_CHANNEL_FRONT' and so on
+//				3+4: The MSB and LSB of the period (in ms)
+//				5+6: The MSB and LSB of the deadband (in psi, 0 for none)
+//
+//	A node has one subscription; subscribing again replaces it, and an
+//	empty channel set cancels it. The reply is:
+//
+//	0: The command
+//	1: The node id
+//	2: The `subscription_status_t' of the request
+//	3: The number of subscriptions now in the table
+//
+
+void
+subscription_service_request
+(
+	uint8_t	*data
+);
+
+#endif
@@ -0,0 +1,63 @@
+//
+//	timer.c
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#include <avr/io.h>
+#include <util/atomic.h>
+
+#include "timer.h"
+
+static volatile uint32_t ticks;
+
+void
+timer_init (void)
+{
+	TCCR0A = _BV (WGM01) | _BV (CS01) | _BV (CS00);
+	OCR0A = 249;
+	TIMSK0 = _BV (OCIE0A);
+}
+
+void
+timer_periodic_interrupt_handler (void)
+{
+	ticks++;
+}
+
+uint32_t
+timer_get_ticks (void)
+{
+	uint32_t now;
+
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+	{
+		now = ticks;
+	}
+
+	return now;
+}
+
+uint32_t
+timer_get_timestamp (void)
+{
+	uint32_t	now;
+	uint8_t		count;
+
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+	{
+		now = ticks;
+		count = TCNT0;
+
+		if ((TIFR0 & _BV (OCF0A)) && count < OCR0A / 2)		/* 1 */
+			now++;
+	}
+
+	return now * 1000 + count * 4;		/* 2 */
+}
+
+//
+//	1.	The timer has wrapped but its interrupt hasn't run yet.
+//
+//	2.	Timer 0 counts at 250 kHz.
+//
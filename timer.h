@@ -0,0 +1,43 @@
+//
+//	timer.h
+//	General-purpose 1 ms timer and the system clock.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#ifndef _TIMER_H
+#define _TIMER_H
+
+#include <inttypes.h>
+
+//
+//	Initialize the general-purpose timer to interrupt every millisecond.
+//
+
+void
+timer_init (void);
+
+//
+//	This function is fired every millisecond by the general-purpose timer,
+//	ahead of every other periodic handler. Advances the clock.
+//
+
+void
+timer_periodic_interrupt_handler (void);
+
+//
+//	Return the number of milliseconds since start-up.
+//
+
+uint32_t
+timer_get_ticks (void);
+
+//
+//	Return the time since start-up in us. This wraps after about 71 minutes,
+//	so it is only good for measuring intervals.
+//
+
+uint32_t
+timer_get_timestamp (void);
+
+#endif
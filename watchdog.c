@@ -0,0 +1,186 @@
+//
+//	watchdog.c
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/wdt.h>
+#include <util/atomic.h>
+
+#include "can.h"
+#include "can_config.h"
+
+#include "diagnostic.h"
+#include "error.h"
+#include "stepper.h"
+#include "watchdog.h"
+
+static watchdog_record_t record __attribute__ ((section (".noinit")));
+static uint8_t reset_flags __attribute__ ((section (".noinit")));
+
+static watchdog_record_t boot_record;
+
+static volatile uint16_t checkin_ticks[watchdog_task_count];
+static volatile uint8_t timer_ticked;
+
+static const uint16_t task_deadlines[watchdog_task_count] =
+{
+	0,								/* watchdog_task_timer */
+	WATCHDOG_MAIN_LOOP_DEADLINE,	/* watchdog_task_main_loop */
+	WATCHDOG_CAN_DEADLINE			/* watchdog_task_can */
+};
+
+//
+//	Put the outputs into a safe state: the stepper driver is put to sleep
+//	and its outputs disabled, so the bias adjuster holds its position.
+//
+
+static inline void
+watchdog_safe_outputs (void)
+{
+	DDRB |= _BV (STEPPER_ENABLE) | _BV (STEPPER_SLEEP);
+	PORTB = _BV (STEPPER_ENABLE);
+}
+
+//
+//	Runs before `main' and before `.data' and `.bss' are set up. The
+//	watchdog stays enabled after a watchdog reset, so it must be turned
+//	off here before the rest of the start-up code gets a chance to run
+//	past the shortest timeout.
+//
+//	The bootloader has already been through the same steps when it is
+//	installed, and hands the reset flags over in GPIOR0.
+//
+
+void
+watchdog_early_init (void)
+__attribute__ ((naked, used, section (".init3")));
+
+void
+watchdog_early_init (void)
+{
+	reset_flags = MCUSR | GPIOR0;
+	MCUSR = 0;
+	GPIOR0 = 0;
+	wdt_disable ();
+
+	watchdog_safe_outputs ();
+}
+
+void
+watchdog_init (void)
+{
+	uint8_t i;
+
+	if (record.magic != WATCHDOG_RECORD_MAGIC || (reset_flags & (_BV (PORF) | _BV (BORF))))
+	{
+		record.magic = WATCHDOG_RECORD_MAGIC;
+		record.task = watchdog_task_none;
+		record.error_code = 0;
+		record.overrun = 0;
+		record.reset_count = 0;
+	}
+	else if (reset_flags & _BV (WDRF))
+	{
+		if (record.task == watchdog_task_none)		/* 1 */
+		{
+			record.task = watchdog_task_timer;
+			record.overrun = 0;
+		}
+
+		record.reset_count++;
+	}
+
+	boot_record = record;
+
+	record.task = watchdog_task_none;
+	record.ticks = 0;
+
+	for (i = 0; i < watchdog_task_count; i++)
+		checkin_ticks[i] = 0;
+
+	wdt_enable (WATCHDOG_TIMEOUT);
+}
+
+//
+//	1.	The hardware watchdog expired without the supervisor catching an
+//		overrun first. The only way that happens is if the timer interrupt
+//		stopped running, since it checks every other deadline.
+//
+
+uint8_t
+watchdog_reset_flags (void)
+{
+	return reset_flags;
+}
+
+void
+watchdog_checkin (watchdog_task_t task)
+{
+	ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+	{
+		checkin_ticks[task] = record.ticks;
+	}
+}
+
+void
+watchdog_service (void)
+{
+	watchdog_checkin (watchdog_task_main_loop);
+
+	if (timer_ticked)
+	{
+		timer_ticked = 0;
+		wdt_reset ();
+	}
+}
+
+void
+watchdog_periodic_interrupt_handler (void)
+{
+	uint8_t i;
+
+	checkin_ticks[watchdog_task_timer] = ++record.ticks;
+	timer_ticked = 1;
+
+	for (i = 0; i < watchdog_task_count; i++)
+	{
+		if (task_deadlines[i] && (uint16_t)(record.ticks - checkin_ticks[i]) > task_deadlines[i])
+			watchdog_reset_system (i);
+	}
+}
+
+void
+watchdog_reset_system (watchdog_task_t task)
+{
+	cli ();
+
+	record.task = task;
+	record.error_code = error_get_error_code ();
+	record.overrun = (task < watchdog_task_count) ?
+		(uint16_t)(record.ticks - checkin_ticks[task]) : 0;
+
+	watchdog_safe_outputs ();
+	wdt_enable (WDTO_15MS);
+
+	for (;;)
+		;
+}
+
+void
+watchdog_broadcast_reset_report (void)
+{
+	uint8_t data[7];
+
+	data[0] = diag_id_reset_report;
+	data[1] = reset_flags;
+	data[2] = boot_record.task;
+	data[3] = boot_record.error_code;
+	data[4] = (uint8_t)(boot_record.overrun >> 8);
+	data[5] = (uint8_t)(boot_record.overrun);
+	data[6] = boot_record.reset_count;
+
+	diagnostic_send (data, 7);
+}
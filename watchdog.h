@@ -0,0 +1,142 @@
+//
+//	watchdog.h
+//	Task supervisor built on the hardware watchdog.
+//
+//	Michael Jean <michael.jean@shaw.ca>
+//
+
+#ifndef _WATCHDOG_H
+#define _WATCHDOG_H
+
+#include <inttypes.h>
+
+#include "can.h"
+
+//
+//	The hardware watchdog is only kicked from the main loop, and only once
+//	the timer interrupt has ticked since the last kick. A stalled main loop
+//	or a dead timer therefore both let the hardware watchdog expire.
+//
+//	On top of that, every supervised task has to check in before its
+//	deadline expires. The deadlines are checked from the timer interrupt,
+//	so an overrun is caught (and blamed on the right task) well before
+//	the hardware timeout. N.B. a deadline of zero disables monitoring.
+//
+
+#define	WATCHDOG_TIMEOUT			WDTO_250MS	/* 1 */
+#define	WATCHDOG_MAIN_LOOP_DEADLINE	150			/* ms */
+#define	WATCHDOG_CAN_DEADLINE		2500		/* ms, 2 */
+
+//
+//	1.	One of the `WDTO_*' constants from <avr/wdt.h>. This is the only
+//		deadline for the timer task, since nothing else can measure time
+//		when the timer has stopped.
+//
+//	2.	The CAN task checks in from the bus monitor whenever the
+//		controller is enabled and on the bus, whether or not anything is
+//		listening, and all through a bus-off recovery (see `bus.h'). Only
+//		a controller that stops responding runs it out.
+//
+
+typedef enum watchdog_task_t
+{
+	watchdog_task_timer			= 0x00,		/* 1 ms timer interrupt */
+	watchdog_task_main_loop		= 0x01,		/* state machine main loop */
+	watchdog_task_can			= 0x02,		/* CAN controller on the bus */
+	watchdog_task_count			= 0x03,
+	watchdog_task_bootloader	= 0xFD,		/* reset into the bootloader */
+	watchdog_task_fatal_error	= 0xFE,		/* reset from `error_fatal_error' */
+	watchdog_task_none			= 0xFF		/* no overrun recorded */
+}
+watchdog_task_t;
+
+//
+//	The reset record lives in `.noinit' RAM so it survives the watchdog
+//	reset. It is validated against `WATCHDOG_RECORD_MAGIC' at boot, and
+//	cleared after a power-on or brown-out reset.
+//
+
+#define	WATCHDOG_RECORD_MAGIC	0xB7A6
+
+typedef struct watchdog_record_t
+{
+	uint16_t	magic;
+	uint8_t		task;			/* offending `watchdog_task_t' */
+	uint8_t		error_code;		/* error code at time of reset */
+	uint16_t	overrun;		/* ms since the task last checked in */
+	uint16_t	ticks;			/* supervisor tick count at reset */
+	uint8_t		reset_count;	/* watchdog resets since power-on */
+}
+watchdog_record_t;
+
+//
+//	Initialize the supervisor and start the hardware watchdog. Every task
+//	is considered checked in at this point.
+//
+
+void
+watchdog_init (void);
+
+//
+//	Return the MCUSR reset flags captured at boot. Valid from the start of
+//	`main', before `watchdog_init' has been called.
+//
+
+uint8_t
+watchdog_reset_flags (void);
+
+//
+//	Record that task `task' is alive.
+//
+
+void
+watchdog_checkin
+(
+	watchdog_task_t task
+);
+
+//
+//	Service the supervisor from the main loop. Checks in the main loop task
+//	and kicks the hardware watchdog if the timer has ticked since last time.
+//
+
+void
+watchdog_service (void);
+
+//
+//	This function is fired every millisecond by the general-purpose timer.
+//	Checks in the timer task and checks every other task's deadline.
+//
+
+void
+watchdog_periodic_interrupt_handler (void);
+
+//
+//	Record task `task' as the cause of the reset, put the outputs in a safe
+//	state and let the hardware watchdog reset the system. Never returns.
+//
+
+void
+watchdog_reset_system
+(
+	watchdog_task_t task
+)
+__attribute__ ((noreturn));
+
+//
+//	Broadcast the cause of the last reset over the CAN bus.
+//
+//	The packet is sent on the diagnostic message ID with seven bytes:
+//
+//	0:   `diag_id_reset_report'
+//	1:   The MCUSR reset flags captured at boot
+//	2:   The offending task, or `watchdog_task_none'
+//	3:   The error code set at the time of the reset
+//	4+5: The MSB and LSB of the overrun past the task's last check-in (in ms)
+//	6:   The number of watchdog resets since power-on
+//
+
+void
+watchdog_broadcast_reset_report (void);
+
+#endif